@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdlib>
+#include <limits>
+
+// Helpers shared by the benchmark programs.
+
+namespace raytracing {
+
+inline bool parse_int(const char* arg, int min, int &value)
+{
+    char* end;
+    long parsed = std::strtol(arg, &end, 10);
+    if(*arg == '\0' || *end != '\0' || parsed < min || parsed > std::numeric_limits<int>::max())
+        return false;
+    value = static_cast<int>(parsed);
+    return true;
+}
+
+inline bool parse_double(const char* arg, double min, double &value)
+{
+    char* end;
+    double parsed = std::strtod(arg, &end);
+    if(*arg == '\0' || *end != '\0' || !(parsed >= min))
+        return false;
+    value = parsed;
+    return true;
+}
+
+} // namespace raytracing
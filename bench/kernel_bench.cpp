@@ -0,0 +1,703 @@
+#include <aabb.hpp>
+#include <aarect.hpp>
+#include <box.hpp>
+#include <bvh.hpp>
+#include <camera.hpp>
+#include <common.hpp>
+#include <constant_medium.hpp>
+#include <grid_medium.hpp>
+#include <hittable.hpp>
+#include <instance.hpp>
+#include <material.hpp>
+#include <perlin.hpp>
+#include <primitive.hpp>
+#include <scene.hpp>
+#include <sphere.hpp>
+#include <texture.hpp>
+#include <texture_program.hpp>
+
+#include "bench_common.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Kernel microbenchmarks
+//
+// Times single intersection and shading routines in isolation. Every kernel runs over
+// pre-generated inputs, so only the kernel itself is measured:
+//
+//   coherent    camera rays in scanline order, as the first bounce of a render
+//   incoherent  rays between random points around the objects, as after a diffuse bounce
+//
+// Texture kernels get matching lookups (scanline order vs. random), material kernels
+// get the hit records of the rays that hit a unit sphere, and Vec3 kernels get the
+// directions of neighbouring rays.
+//
+// `--verify` instead checks the Vec3 operations and Perlin noise against plain scalar
+// implementations, which matters for `make SIMD=1` builds, and reports how closely
+// baked noise volumes follow the exact noise and the memory and error of every texture
+// format.
+
+namespace {
+    using namespace raytracing;
+
+    // Keeps results alive so the compiler cannot drop the timed calls.
+    volatile double sink;
+
+    struct RaySet {
+        std::string name;
+        std::vector<Ray> rays;
+    };
+
+    struct ShadingSet {
+        std::string name;
+        std::vector<Ray> rays;
+        std::vector<HitRecord> records;
+    };
+
+    struct PointSet {
+        std::string name;
+        std::vector<Point3> points;
+    };
+
+    // Pairs of neighbouring ray directions, `v` flipped to face against `u` so the pairs
+    // can also be used as a direction and surface normal.
+    struct Vec3Set {
+        std::string name;
+        std::vector<Vec3> u, v;
+    };
+
+    struct UVSet {
+        std::string name;
+        struct UV { double u, v; };
+        std::vector<UV> uv;
+    };
+
+    struct Result {
+        std::string kernel, set;
+        size_t ops;
+        double ns_per_op;
+        double hit_rate; // negative if the kernel does not hit or miss
+    };
+
+    struct Options {
+        int count = 1 << 16;
+        double min_seconds = 0.25;
+        std::string filter;
+        std::string image = "assets/earthmap.jpg";
+        bool json = false;
+        bool verify = false;
+    };
+
+    RaySet coherent_rays(int count)
+    {
+        // The objects are centered at the origin and about two units wide.
+        Camera camera(Point3(0, 0, 4), Point3(0, 0, 0), Vec3(0, 1, 0), 40, 1.0, 0.0, 4.0, 0.0, 1.0);
+        int side = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(count))));
+
+        RaySet set{"coherent", {}};
+        set.rays.reserve(static_cast<size_t>(side) * side);
+        for(int j = side - 1; j >= 0; --j)
+            for(int i = 0; i < side; ++i)
+                set.rays.push_back(camera.get_ray((i + 0.5) / side, (j + 0.5) / side));
+        return set;
+    }
+
+    RaySet incoherent_rays(int count)
+    {
+        RaySet set{"incoherent", {}};
+        set.rays.reserve(count);
+        for(int i = 0; i < count; i++) {
+            Point3 origin = 4 * random_unit_vector();
+            Point3 target = Vec3::random(-1.5, 1.5);
+            set.rays.push_back(Ray(origin, unit_vector(target - origin), random_double()));
+        }
+        return set;
+    }
+
+    ShadingSet shading_inputs(const RaySet &rays)
+    {
+        Sphere sphere(Point3(0, 0, 0), 1, nullptr);
+        ShadingSet set{rays.name, {}, {}};
+        for(const Ray &r : rays.rays) {
+            HitRecord rec;
+            if(sphere.hit(r, 0.001, infinity, rec)) {
+                set.rays.push_back(r);
+                set.records.push_back(rec);
+            }
+        }
+        return set;
+    }
+
+    PointSet coherent_points(const RaySet &rays)
+    {
+        // Neighbouring camera rays give neighbouring points on a plane through the objects.
+        PointSet set{"coherent", {}};
+        for(const Ray &r : rays.rays)
+            set.points.push_back(r.at(4.0));
+        return set;
+    }
+
+    PointSet incoherent_points(int count)
+    {
+        PointSet set{"incoherent", {}};
+        for(int i = 0; i < count; i++)
+            set.points.push_back(Vec3::random(-4, 4));
+        return set;
+    }
+
+    Vec3Set vec3_inputs(const RaySet &rays)
+    {
+        Vec3Set set{rays.name, {}, {}};
+        for(size_t i = 0; i + 1 < rays.rays.size(); i++) {
+            Vec3 u = unit_vector(rays.rays[i].direction());
+            Vec3 v = unit_vector(rays.rays[i + 1].direction());
+            set.u.push_back(u);
+            set.v.push_back(dot(u, v) > 0 ? -v : v);
+        }
+        return set;
+    }
+
+    UVSet coherent_uv(int count)
+    {
+        // Scanline order over the whole image, top row first.
+        int side = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(count))));
+        UVSet set{"coherent", {}};
+        for(int j = side - 1; j >= 0; --j)
+            for(int i = 0; i < side; ++i)
+                set.uv.push_back({(i + 0.5) / side, (j + 0.5) / side});
+        return set;
+    }
+
+    UVSet incoherent_uv(int count)
+    {
+        UVSet set{"incoherent", {}};
+        for(int i = 0; i < count; i++)
+            set.uv.push_back({random_double(), random_double()});
+        return set;
+    }
+
+    // Runs `kernel(i)` over all `count` inputs until `min_seconds` have passed and keeps
+    // the fastest pass. A kernel returns nonzero for a hit (or a scattered ray).
+    template<typename Kernel>
+    Result measure(const std::string &name, const std::string &set, size_t count, bool hits, const Options &options,
+                   Kernel &&kernel)
+    {
+        double best = infinity;
+        double elapsed = 0;
+        size_t hit_count = 0;
+        do {
+            double sum = 0;
+            size_t pass_hits = 0;
+            auto start = std::chrono::steady_clock::now();
+            for(size_t i = 0; i < count; i++) {
+                double value = kernel(i);
+                pass_hits += value != 0;
+                sum += value;
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            sink = sum;
+            best = std::min(best, seconds);
+            elapsed += seconds;
+            hit_count = pass_hits;
+        } while(elapsed < options.min_seconds);
+
+        Result result;
+        result.kernel = name;
+        result.set = set;
+        result.ops = count;
+        result.ns_per_op = count ? best * 1e9 / count : 0;
+        result.hit_rate = hits && count ? static_cast<double>(hit_count) / count : -1;
+        return result;
+    }
+
+    // The scalar Vec3 operations, as the reference for `--verify`.
+    namespace scalar {
+        struct Vec { real x, y, z; };
+
+        Vec from(const Vec3 &v) { return {v.x(), v.y(), v.z()}; }
+        Vec scale(real t, Vec v) { return {t * v.x, t * v.y, t * v.z}; }
+        Vec add(Vec a, Vec b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+        real dot(Vec a, Vec b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+        Vec cross(Vec a, Vec b)
+        {
+            return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+        }
+
+        Vec unit_vector(Vec v) { return scale(1 / std::sqrt(dot(v, v)), v); }
+        Vec reflect(Vec v, Vec n) { return add(v, scale(-2 * dot(v, n), n)); }
+
+        Vec refract(Vec uv, Vec n, real etai_over_etat)
+        {
+            real cos_theta = std::fmin(-dot(uv, n), real(1));
+            Vec perp = scale(etai_over_etat, add(uv, scale(cos_theta, n)));
+            return add(perp, scale(-std::sqrt(std::fabs(1 - dot(perp, perp))), n));
+        }
+
+        // Largest component difference, relative to the larger of 1 and the reference.
+        double error(const Vec3 &got, Vec expected)
+        {
+            double scale = std::max({1.0, std::fabs(double(expected.x)), std::fabs(double(expected.y)),
+                                     std::fabs(double(expected.z))});
+            double diff = std::max({std::fabs(double(got.x()) - expected.x), std::fabs(double(got.y()) - expected.y),
+                                    std::fabs(double(got.z()) - expected.z)});
+            return diff / scale;
+        }
+
+        double error(real got, real expected)
+        {
+            return std::fabs(double(got) - expected) / std::max(1.0, std::fabs(double(expected)));
+        }
+    }
+
+    // Compares the Vec3 operations with the scalar ones over unit and non-unit vectors.
+    // Returns false if any result is further off than the SIMD implementation's fused
+    // multiply-adds and refined reciprocal square roots explain.
+    bool verify_vec3(const Vec3Set &set)
+    {
+        const double tolerance = 16 * std::numeric_limits<real>::epsilon();
+        const real eta = 1 / 1.5;
+        const char* names[] = {"dot", "cross", "unit_vector", "reflect", "refract", "arithmetic"};
+        double errors[6] = {};
+
+        for(size_t i = 0; i < set.u.size(); i++) {
+            const Vec3 &u = set.u[i], &n = set.v[i];
+            const Vec3 w = Vec3::random(-4, 4), z = Vec3::random(-4, 4);
+            const scalar::Vec su = scalar::from(u), sn = scalar::from(n), sw = scalar::from(w), sz = scalar::from(z);
+
+            auto check = [&](int op, double error) { errors[op] = std::max(errors[op], error); };
+            check(0, scalar::error(dot(u, n), scalar::dot(su, sn)));
+            check(0, scalar::error(dot(w, z), scalar::dot(sw, sz)));
+            check(1, scalar::error(cross(u, n), scalar::cross(su, sn)));
+            check(1, scalar::error(cross(w, z), scalar::cross(sw, sz)));
+            check(2, scalar::error(unit_vector(w), scalar::unit_vector(sw)));
+            check(3, scalar::error(reflect(u, n), scalar::reflect(su, sn)));
+            check(3, scalar::error(reflect(w, z), scalar::reflect(sw, sz)));
+            check(4, scalar::error(refract(u, n, eta), scalar::refract(su, sn, eta)));
+            check(5, scalar::error(w + z, scalar::add(sw, sz)));
+            check(5, scalar::error(w - z, scalar::add(sw, scalar::scale(-1, sz))));
+            check(5, scalar::error(w * z, {sw.x * sz.x, sw.y * sz.y, sw.z * sz.z}));
+            check(5, scalar::error(w / 3, scalar::scale(1 / real(3), sw)));
+            check(5, scalar::error(w.length_squared(), scalar::dot(sw, sw)));
+        }
+
+        bool passed = true;
+        std::printf("%-24s %12s  %s\n", "Vec3 operation", "max error", "");
+        for(int op = 0; op < 6; op++) {
+            bool ok = errors[op] <= tolerance;
+            passed = passed && ok;
+            std::printf("%-24s %12.3g  %s\n", names[op], errors[op], ok ? "ok" : "FAILED");
+        }
+        return passed;
+    }
+
+    // Compares the noise with the scalar implementation, and baked volumes of several
+    // resolutions with the exact turbulence. Only the former can fail.
+    bool verify_noise(const Perlin &perlin, const PointSet &points)
+    {
+        // SIMD builds evaluate the noise in single precision.
+        const double tolerance = 1e-5;
+        double error = 0;
+        for(const Point3 &p : points.points)
+            for(real scale = 1; scale <= 64; scale *= 2)
+                error = std::max(error, std::fabs(double(perlin.noise(scale * p)) - perlin.scalar_noise(scale * p)));
+        bool passed = error <= tolerance;
+        std::printf("%-24s %12.3g  %s\n\n", "Perlin::noise", error, passed ? "ok" : "FAILED");
+
+        std::printf("%-24s %12s %12s %10s\n", "NoiseVolume voxel size", "max error", "rms error", "MiB");
+        const AABB bounds(Point3(-4, -4, -4), Point3(4, 4, 4));
+        for(real voxel_size : {real(0.25), real(0.125), real(0.0625)}) {
+            NoiseVolume volume(perlin, bounds, voxel_size);
+            double max_error = 0, sum = 0;
+            for(const Point3 &p : points.points) {
+                double e = std::fabs(double(volume.turb(p)) - perlin.turb(p));
+                max_error = std::max(max_error, e);
+                sum += e * e;
+            }
+            std::printf("%-24g %12.3g %12.3g %10.1f\n", double(voxel_size), max_error,
+                        std::sqrt(sum / points.points.size()), volume.size_bytes() / 1048576.0);
+        }
+        return passed;
+    }
+
+    // Memory of the image in every texture format, and the error of trilinear lookups
+    // against float storage. Cannot fail.
+    void verify_texture_formats(const std::string &path, const UVSet &uvs)
+    {
+        const std::pair<const char*, TextureFormat> formats[] = {
+            {"srgb8", TextureFormat::SRGB8}, {"half", TextureFormat::Half}, {"float", TextureFormat::Float},
+        };
+        ImageTexture reference(path.c_str(), TextureFilter::Trilinear, TextureFormat::Float);
+        if(!reference.pixels())
+            return;
+        UVDerivatives duv;
+        duv.dudx = duv.dvdy = 1.0 / 256;
+
+        std::printf("%-24s %12s %12s %10s\n", "ImageTexture format", "max error", "rms error", "MiB");
+        for(const auto &format : formats) {
+            ImageTexture image(path.c_str(), TextureFilter::Trilinear, format.second);
+            double max_error = 0, sum = 0;
+            for(const auto &uv : uvs.uv) {
+                Color d = image.value(uv.u, uv.v, Point3(0, 0, 0), duv) - reference.value(uv.u, uv.v, Point3(0, 0, 0), duv);
+                for(int i = 0; i < 3; i++) {
+                    max_error = std::max(max_error, std::fabs(double(d[i])));
+                    sum += double(d[i]) * d[i];
+                }
+            }
+            std::printf("%-24s %12.3g %12.3g %10.2f\n", format.first, max_error, std::sqrt(sum / (3 * uvs.uv.size())),
+                        ImagePyramid::pyramid_size(image.image_width(), image.image_height(), format.second) / 1048576.0);
+        }
+    }
+
+    bool selected(const Options &options, const std::string &name)
+    {
+        return options.filter.empty() || name.find(options.filter) != std::string::npos;
+    }
+
+    void report(const std::vector<Result> &results, bool json)
+    {
+        if(json) {
+            std::printf("[\n");
+            for(size_t i = 0; i < results.size(); i++) {
+                const Result &r = results[i];
+                std::printf("  {\"kernel\": \"%s\", \"set\": \"%s\", \"ops\": %zu, \"ns_per_op\": %.3f, "
+                            "\"mops_per_second\": %.3f", r.kernel.c_str(), r.set.c_str(), r.ops, r.ns_per_op,
+                            1e3 / r.ns_per_op);
+                if(r.hit_rate >= 0)
+                    std::printf(", \"hit_rate\": %.4f", r.hit_rate);
+                std::printf("}%s\n", i + 1 < results.size() ? "," : "");
+            }
+            std::printf("]\n");
+            return;
+        }
+
+        std::printf("%-30s %-11s %8s %10s %10s %7s\n", "kernel", "set", "ops", "ns/op", "Mops/s", "hit%");
+        for(const Result &r : results) {
+            std::printf("%-30s %-11s %8zu %10.2f %10.2f", r.kernel.c_str(), r.set.c_str(), r.ops, r.ns_per_op,
+                        1e3 / r.ns_per_op);
+            if(r.hit_rate >= 0)
+                std::printf(" %6.1f%%", 100 * r.hit_rate);
+            std::printf("\n");
+        }
+    }
+
+    void usage(const char* program)
+    {
+        std::cerr << "Usage: " << program << " [options]\n"
+                  << "\n"
+                  << "Options:\n"
+                  << "  -k, --kernel <text>     only run kernels whose name contains <text>\n"
+                  << "  -c, --count <inputs>    rays or lookups per set (default: 65536)\n"
+                  << "      --time <seconds>    minimum time per kernel and set (default: 0.25)\n"
+                  << "      --image <path>      image for the ImageTexture kernels (default: assets/earthmap.jpg)\n"
+                  << "      --json              print the results as JSON instead of a table\n"
+                  << "      --verify            check the Vec3 operations against scalar ones instead\n"
+                  << "  -h, --help              show this help\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+
+        if(arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        }
+        if(arg == "--json") {
+            options.json = true;
+            continue;
+        }
+        if(arg == "--verify") {
+            options.verify = true;
+            continue;
+        }
+
+        if(i + 1 >= argc) {
+            std::cerr << "ERROR: Missing value for option `" << arg << "`." << std::endl;
+            usage(argv[0]);
+            return 1;
+        }
+        const char* value = argv[++i];
+
+        bool ok = true;
+        if(arg == "-k" || arg == "--kernel")
+            options.filter = value;
+        else if(arg == "-c" || arg == "--count")
+            ok = parse_int(value, 1, options.count);
+        else if(arg == "--time")
+            ok = parse_double(value, 0, options.min_seconds);
+        else if(arg == "--image")
+            options.image = value;
+        else {
+            std::cerr << "ERROR: Unknown option `" << arg << "`." << std::endl;
+            usage(argv[0]);
+            return 1;
+        }
+
+        if(!ok) {
+            std::cerr << "ERROR: Invalid value `" << value << "` for option `" << arg << "`." << std::endl;
+            return 1;
+        }
+    }
+
+    seed_random(1);
+    const std::vector<RaySet> ray_sets = {coherent_rays(options.count), incoherent_rays(options.count)};
+    const std::vector<ShadingSet> shading_sets = {shading_inputs(ray_sets[0]), shading_inputs(ray_sets[1])};
+    const std::vector<PointSet> point_sets = {coherent_points(ray_sets[0]), incoherent_points(options.count)};
+    const std::vector<UVSet> uv_sets = {coherent_uv(options.count), incoherent_uv(options.count)};
+    const std::vector<Vec3Set> vec3_sets = {vec3_inputs(ray_sets[0]), vec3_inputs(ray_sets[1])};
+
+    Perlin perlin;
+    if(options.verify) {
+        bool vec3_ok = verify_vec3(vec3_sets[1]);
+        std::printf("\n");
+        bool noise_ok = verify_noise(perlin, point_sets[1]);
+        std::printf("\n");
+        verify_texture_formats(options.image, uv_sets[1]);
+        return vec3_ok && noise_ok ? 0 : 1;
+    }
+
+    // Objects under test, all centered at the origin.
+    auto material = std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+    Sphere sphere(Point3(0, 0, 0), 1, material);
+    MovingSphere moving_sphere(Point3(0, -0.25, 0), Point3(0, 0.25, 0), 0, 1, 1, material);
+    XYRect rect(-1, 1, -1, 1, 0, material);
+    Box box(Point3(-1, -1, -1), Point3(1, 1, 1), material);
+    AABB aabb(Point3(-1, -1, -1), Point3(1, 1, 1));
+
+    HittableList spheres;
+    for(int i = 0; i < 1024; i++)
+        spheres.add(std::make_shared<Sphere>(Vec3::random(-1.5, 1.5), 0.05, material));
+    BVHNode bvh(spheres, 0, 1);
+
+    // 64 turned copies of a cluster of 64 spheres, as instances and as Translate and
+    // RotateY chains under a BVHNode.
+    std::vector<Primitive> cluster_spheres;
+    for(uint32_t i = 0; i < 64; i++)
+        cluster_spheres.push_back(Primitive::sphere(0.2 * random_in_unit_sphere(), 0.03, 0));
+    auto cluster = std::make_shared<PrimitiveArray>(std::move(cluster_spheres), std::vector<std::shared_ptr<Material>>{material}, 0, 1);
+    HittableList copies;
+    for(int i = 0; i < 64; i++) {
+        Vec3 offset(-1.5 + (i % 4) * 1.0, -1.5 + (i / 4 % 4) * 1.0, -1.5 + (i / 16) * 1.0);
+        copies.add(std::make_shared<Translate>(std::make_shared<RotateY>(cluster, 360.0 * i / 64), offset));
+    }
+    InstanceBVH instances(copies, 0, 1);
+    BVHNode chains(copies, 0, 1);
+
+    // One copy through a chain of three transforms, and through the Transform that
+    // `collapse_transforms` replaces the chain by.
+    auto chain = std::make_shared<Translate>(std::make_shared<RotateY>(std::make_shared<RotateY>(cluster, 15), 30), Vec3(0.1, 0, 0));
+    Scene collapsed;
+    collapsed.world.add(chain);
+    collapse_transforms(collapsed);
+
+    ConstantMedium sphere_medium(std::make_shared<Sphere>(Point3(0, 0, 0), 1, material), 1, Color(1, 1, 1));
+    ConstantMedium box_medium(std::make_shared<RotateY>(std::make_shared<Box>(Point3(-1, -1, -1), Point3(1, 1, 1), material), 15),
+                              1, Color(1, 1, 1));
+    const AABB cloud_bounds(Point3(-1, -1, -1), Point3(1, 1, 1));
+    GridMedium dense_cloud(DensityGrid::from_noise(Perlin(1), 3, cloud_bounds, 1.0 / 32), 4, Color(1, 1, 1));
+    GridMedium sparse_cloud(DensityGrid::from_noise(Perlin(1), 3, cloud_bounds, 1.0 / 32, GridLayout::Sparse), 4, Color(1, 1, 1));
+
+    struct HitKernel {
+        const char* name;
+        const Hittable* object;
+    };
+    const HitKernel hit_kernels[] = {
+        {"Sphere::hit", &sphere},
+        {"MovingSphere::hit", &moving_sphere},
+        {"XYRect::hit", &rect},
+        {"Box::hit", &box},
+        {"BVHNode::hit", &bvh},
+        {"BVHNode::hit_transformed", &chains},
+        {"InstanceBVH::hit", &instances},
+        {"Translate::hit_chain", chain.get()},
+        {"Transform::hit", collapsed.world.objects[0].get()},
+        {"ConstantMedium::hit", &sphere_medium},
+        {"ConstantMedium::hit_box", &box_medium},
+        {"GridMedium::hit", &dense_cloud},
+        {"GridMedium::hit_sparse", &sparse_cloud},
+    };
+
+    NoiseVolume noise_volume(perlin, AABB(Point3(-4, -4, -4), Point3(4, 4, 4)), 0.125);
+    ImageTexture image(options.image.c_str());
+    if(!image.pixels() && selected(options, "ImageTexture::"))
+        std::cerr << "WARNING: Benchmarking ImageTexture::value without an image." << std::endl;
+    std::unique_ptr<ImageTexture> half_image, float_image; // decoded when their kernels run
+
+    auto solid = std::make_shared<SolidColor>(Color(0.5, 0.5, 0.5));
+    struct ScatterKernel {
+        const char* name;
+        std::shared_ptr<Material> material;
+    };
+    const ScatterKernel scatter_kernels[] = {
+        {"Lambertian::scatter", std::make_shared<Lambertian>(solid)},
+        {"Metal::scatter", std::make_shared<Metal>(Color(0.8, 0.8, 0.8), 0.3)},
+        {"Dielectric::scatter", std::make_shared<Dielectric>(1.5)},
+        {"DiffuseLight::scatter", std::make_shared<DiffuseLight>(solid)},
+        {"Isotropic::scatter", std::make_shared<Isotropic>(solid)},
+    };
+
+    std::vector<Result> results;
+    for(const HitKernel &k : hit_kernels) {
+        if(!selected(options, k.name))
+            continue;
+        for(const RaySet &set : ray_sets)
+            results.push_back(measure(k.name, set.name, set.rays.size(), true, options, [&](size_t i) {
+                HitRecord rec;
+                return k.object->hit(set.rays[i], 0.001, infinity, rec) ? rec.t : 0.0;
+            }));
+    }
+
+    if(selected(options, "AABB::hit"))
+        for(const RaySet &set : ray_sets)
+            results.push_back(measure("AABB::hit", set.name, set.rays.size(), true, options, [&](size_t i) {
+                return aabb.hit(set.rays[i], 0.001, infinity) ? 1.0 : 0.0;
+            }));
+
+    if(selected(options, "Perlin::turb"))
+        for(const PointSet &set : point_sets)
+            results.push_back(measure("Perlin::turb", set.name, set.points.size(), false, options, [&](size_t i) {
+                return perlin.turb(set.points[i]);
+            }));
+
+    if(selected(options, "Perlin::noise"))
+        for(const PointSet &set : point_sets)
+            results.push_back(measure("Perlin::noise", set.name, set.points.size(), false, options, [&](size_t i) {
+                return perlin.noise(set.points[i]);
+            }));
+
+    if(selected(options, "NoiseVolume::turb"))
+        for(const PointSet &set : point_sets)
+            results.push_back(measure("NoiseVolume::turb", set.name, set.points.size(), false, options, [&](size_t i) {
+                return noise_volume.turb(set.points[i]);
+            }));
+
+    CheckerTexture checker(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+    if(selected(options, "CheckerTexture::value"))
+        for(const PointSet &set : point_sets)
+            results.push_back(measure("CheckerTexture::value", set.name, set.points.size(), false, options, [&](size_t i) {
+                return checker.value(0, 0, set.points[i]).x();
+            }));
+
+    // Lookups as far apart as the coherent ones, i.e. an image seen from far enough that
+    // neighbouring pixels are a few texels apart.
+    UVDerivatives duv;
+    duv.dudx = duv.dvdy = 1.0 / std::max(1, static_cast<int>(std::sqrt(static_cast<double>(options.count))));
+    struct ImageKernel {
+        const char* name;
+        TextureFormat format;
+        TextureFilter filter;
+    };
+    const ImageKernel image_kernels[] = {
+        {"ImageTexture::nearest", TextureFormat::SRGB8, TextureFilter::Nearest},
+        {"ImageTexture::bilinear", TextureFormat::SRGB8, TextureFilter::Bilinear},
+        {"ImageTexture::trilinear", TextureFormat::SRGB8, TextureFilter::Trilinear},
+        {"ImageTexture::nearest_half", TextureFormat::Half, TextureFilter::Nearest},
+        {"ImageTexture::trilinear_half", TextureFormat::Half, TextureFilter::Trilinear},
+        {"ImageTexture::nearest_float", TextureFormat::Float, TextureFilter::Nearest},
+        {"ImageTexture::trilinear_float", TextureFormat::Float, TextureFilter::Trilinear},
+    };
+    for(const auto &k : image_kernels) {
+        if(!selected(options, k.name))
+            continue;
+        ImageTexture* texture = &image;
+        if(k.format != TextureFormat::SRGB8) {
+            auto &decoded = k.format == TextureFormat::Half ? half_image : float_image;
+            if(!decoded)
+                decoded = std::make_unique<ImageTexture>(options.image.c_str(), k.filter, k.format);
+            texture = decoded.get();
+        }
+        texture->filter = k.filter;
+        for(const UVSet &set : uv_sets)
+            results.push_back(measure(k.name, set.name, set.uv.size(), false, options, [&](size_t i) {
+                Color c = texture->value(set.uv[i].u, set.uv[i].v, Point3(0, 0, 0), duv);
+                return c.x() + c.y() + c.z();
+            }));
+    }
+
+    // A texture graph as scene files build them, looked up node by node and compiled
+    // (where it folds to a checker of a color and the image), one point at a time and in
+    // batches. The checker picks the point, the image its uv.
+    auto graph = std::make_shared<CheckerTexture>(
+        std::make_shared<CheckerTexture>(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9)),
+        std::make_shared<CheckerTexture>(std::make_shared<SolidColor>(Color(0.1, 0.1, 0.1)),
+                                         std::make_shared<ImageTexture>(image.image(), TextureFilter::Trilinear)));
+    TextureCompiler compiler;
+    auto program = compiler.compile(graph);
+    const size_t batch_size = 256;
+    std::vector<Color> batch_colors(batch_size);
+    for(int s = 0; s < 2; s++) {
+        const PointSet &points = point_sets[s];
+        const UVSet &uvs = uv_sets[s];
+        std::vector<TextureQuery> queries(std::min(points.points.size(), uvs.uv.size()));
+        for(size_t i = 0; i < queries.size(); i++)
+            queries[i] = {static_cast<real>(uvs.uv[i].u), static_cast<real>(uvs.uv[i].v), points.points[i], duv};
+
+        auto texture_kernel = [&](const char* name, const Texture &texture) {
+            if(selected(options, name))
+                results.push_back(measure(name, points.name, queries.size(), false, options, [&](size_t i) {
+                    Color c = texture.value(queries[i].u, queries[i].v, queries[i].p, queries[i].duv);
+                    return c.x() + c.y() + c.z();
+                }));
+        };
+        texture_kernel("TextureGraph::value", *graph);
+        texture_kernel("TextureProgram::value", *program);
+
+        auto batch_program = std::dynamic_pointer_cast<TextureProgram>(program);
+        if(batch_program && selected(options, "TextureProgram::batch"))
+            results.push_back(measure("TextureProgram::batch", points.name, queries.size(), false, options, [&](size_t i) {
+                if(i % batch_size == 0)
+                    batch_program->value(queries.data() + i, std::min(batch_size, queries.size() - i), batch_colors.data());
+                const Color &c = batch_colors[i % batch_size];
+                return c.x() + c.y() + c.z();
+            }));
+    }
+
+    // The Vec3 kernels return a sum of the result's components.
+    auto vec3_kernel = [&](const char* name, auto &&kernel) {
+        if(!selected(options, name))
+            return;
+        for(const Vec3Set &set : vec3_sets)
+            results.push_back(measure(name, set.name, set.u.size(), false, options, [&](size_t i) {
+                return kernel(set.u[i], set.v[i]);
+            }));
+    };
+    auto sum = [](const Vec3 &v) { return v.x() + v.y() + v.z(); };
+    vec3_kernel("Vec3::dot", [&](const Vec3 &u, const Vec3 &v) { return dot(u, v); });
+    vec3_kernel("Vec3::cross", [&](const Vec3 &u, const Vec3 &v) { return sum(cross(u, v)); });
+    vec3_kernel("Vec3::unit_vector", [&](const Vec3 &u, const Vec3 &v) { return sum(unit_vector(u + v)); });
+    vec3_kernel("Vec3::reflect", [&](const Vec3 &u, const Vec3 &v) { return sum(reflect(u, v)); });
+    vec3_kernel("Vec3::refract", [&](const Vec3 &u, const Vec3 &v) { return sum(refract(u, v, 1 / 1.5)); });
+
+    for(const ScatterKernel &k : scatter_kernels) {
+        if(!selected(options, k.name))
+            continue;
+        for(const ShadingSet &set : shading_sets)
+            results.push_back(measure(k.name, set.name, set.records.size(), true, options, [&](size_t i) {
+                Color attenuation;
+                Ray scattered;
+                return k.material->scatter(set.rays[i], set.records[i], attenuation, scattered) ? 1.0 : 0.0;
+            }));
+    }
+
+    if(results.empty()) {
+        std::cerr << "ERROR: No kernel matches `" << options.filter << "`." << std::endl;
+        return 1;
+    }
+    report(results, options.json);
+    return 0;
+}
@@ -0,0 +1,518 @@
+#include <common.hpp>
+#include <render.hpp>
+#include <scene.hpp>
+#include <texture_cache.hpp>
+
+#include "bench_common.hpp"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Rendering benchmark
+//
+// Renders the built-in scenes at a fixed seed, resolution and sample count and
+// reports the results as JSON. Every scene runs in a child process of its own, so
+// its peak resident set size is not inflated by the scenes before it. The images can
+// be saved and compared against those of another build, e.g. a double precision
+// build's images as the reference for a float build.
+
+namespace {
+    using namespace raytracing;
+
+    const std::vector<std::string> default_scenes = {
+        "random_scene",
+        "two_perlin_spheres",
+        "earth",
+        "cornell_box",
+        "cornell_smoke",
+        "final_scene",
+        "instances",
+    };
+
+    struct BenchResult {
+        bool ok;
+        double build_seconds;
+        double render_seconds;
+        uint64_t samples;
+        uint64_t rays;
+        long peak_rss_kib;
+        double idle_fraction; // of all render threads' time
+        uint64_t checksum;
+        bool compared;        // against a reference image
+        double image_rmse;    // in 8-bit color steps
+        uint64_t texture_lookups; // texels read through the texture cache
+        uint64_t texture_misses;
+        uint64_t texture_resident_bytes;
+        double texture_decode_seconds; // summed over the textures decoded in the background
+        double texture_wait_seconds;   // rendering waited for them after the BVH was built
+        uint64_t instances;            // see `InstanceStats`
+        uint64_t instance_geometries;
+        uint64_t instance_bytes;
+        uint64_t geometry_bytes;
+        uint64_t duplicated_bytes;
+    };
+
+    struct BenchOptions {
+        std::string image_dir;     // save the images here
+        std::string reference_dir; // compare the images with the ones saved here
+        double noise_voxel_size = 0;  // bake noise textures, see `bake_noise_textures`
+        bool texture_programs = true; // compile textures, see `compile_textures`
+    };
+
+    struct BaselineEntry {
+        std::string name;
+        double render_seconds = 0;
+        double rays_per_second = 0;
+        uint64_t checksum = 0;
+    };
+
+    // FNV-1a over the PPM output, to tell whether two runs produced the same image.
+    uint64_t image_checksum(const std::string &ppm)
+    {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for(char c : ppm)
+            hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+        return hash;
+    }
+
+    // Reads the plain (P3) PPM files `write_framebuffer` produces.
+    bool read_ppm(std::istream &in, int &width, int &height, std::vector<int> &values)
+    {
+        std::string magic;
+        int max_value;
+        if(!(in >> magic >> width >> height >> max_value) || magic != "P3" || width < 1 || height < 1)
+            return false;
+        values.resize(static_cast<size_t>(width) * height * 3);
+        for(int &value : values)
+            if(!(in >> value))
+                return false;
+        return true;
+    }
+
+    bool compare_image(const std::string &ppm, const std::string &path, double &rmse)
+    {
+        std::ifstream file(path);
+        if(!file) {
+            std::cerr << "ERROR: Could not open reference image `" << path << "`." << std::endl;
+            return false;
+        }
+
+        std::istringstream in(ppm);
+        int width, height, reference_width, reference_height;
+        std::vector<int> values, reference;
+        if(!read_ppm(in, width, height, values) || !read_ppm(file, reference_width, reference_height, reference)) {
+            std::cerr << "ERROR: Could not read reference image `" << path << "`." << std::endl;
+            return false;
+        }
+        if(width != reference_width || height != reference_height) {
+            std::cerr << "ERROR: Reference image `" << path << "` is " << reference_width << 'x' << reference_height
+                      << ", not " << width << 'x' << height << '.' << std::endl;
+            return false;
+        }
+
+        double sum = 0;
+        for(size_t i = 0; i < values.size(); i++) {
+            double d = values[i] - reference[i];
+            sum += d * d;
+        }
+        rmse = std::sqrt(sum / values.size());
+        return true;
+    }
+
+    BenchResult run_scene(const std::string &name, const RenderSettings &settings, const BenchOptions &options)
+    {
+        BenchResult result = {};
+
+        auto start = std::chrono::steady_clock::now();
+        Scene scene;
+        seed_random(settings.seed);
+        if(!build_scene(name, scene))
+            return result;
+        if(options.noise_voxel_size > 0)
+            bake_noise_textures(scene, options.noise_voxel_size);
+        collapse_transforms(scene);
+        if(options.texture_programs)
+            compile_textures(scene);
+        result.build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        Framebuffer framebuffer;
+        RenderStats stats = render(scene, settings, framebuffer);
+        result.render_seconds = stats.seconds;
+        for(const auto &decode : stats.texture_decodes)
+            result.texture_decode_seconds += decode.seconds;
+        result.texture_wait_seconds = stats.texture_wait_seconds;
+        result.samples = stats.samples;
+        result.rays = stats.rays;
+        result.instances = stats.instances.instances;
+        result.instance_geometries = stats.instances.geometries;
+        result.instance_bytes = stats.instances.instance_bytes;
+        result.geometry_bytes = stats.instances.geometry_bytes;
+        result.duplicated_bytes = stats.instances.duplicated_bytes;
+
+        std::ostringstream ppm;
+        write_framebuffer(ppm, framebuffer, stats.samples_per_pixel);
+        result.checksum = image_checksum(ppm.str());
+        if(!options.image_dir.empty()) {
+            std::ofstream file(options.image_dir + "/" + name + ".ppm");
+            if(!(file << ppm.str())) {
+                std::cerr << "ERROR: Could not write the image of `" << name << "` to `" << options.image_dir << "`." << std::endl;
+                return result;
+            }
+        }
+        if(!options.reference_dir.empty()) {
+            if(!compare_image(ppm.str(), options.reference_dir + "/" + name + ".ppm", result.image_rmse))
+                return result;
+            result.compared = true;
+        }
+
+        double busy = 0, idle = 0;
+        for(const auto &w : stats.workers) {
+            busy += w.busy_seconds;
+            idle += w.idle_seconds;
+        }
+        result.idle_fraction = busy + idle > 0 ? idle / (busy + idle) : 0;
+
+        auto cache = texture_cache().stats();
+        result.texture_lookups = cache.lookups;
+        result.texture_misses = cache.misses;
+        result.texture_resident_bytes = cache.resident_bytes;
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        result.peak_rss_kib = usage.ru_maxrss;
+        result.ok = true;
+        return result;
+    }
+
+    // Runs `run_scene` in a forked child and hands the result back through a pipe.
+    BenchResult run_isolated(const std::string &name, const RenderSettings &settings, const BenchOptions &options)
+    {
+        BenchResult result = {};
+        int fds[2];
+        if(pipe(fds) != 0) {
+            std::cerr << "ERROR: Could not create a pipe: " << std::strerror(errno) << std::endl;
+            return result;
+        }
+
+        pid_t pid = fork();
+        if(pid < 0) {
+            std::cerr << "ERROR: Could not fork: " << std::strerror(errno) << std::endl;
+            close(fds[0]);
+            close(fds[1]);
+            return result;
+        }
+        if(pid == 0) {
+            close(fds[0]);
+            BenchResult child = run_scene(name, settings, options);
+            ssize_t written = write(fds[1], &child, sizeof(child));
+            _exit(written == sizeof(child) ? 0 : 1);
+        }
+
+        close(fds[1]);
+        ssize_t got = read(fds[0], &result, sizeof(result));
+        close(fds[0]);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if(got != sizeof(result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            result.ok = false;
+        return result;
+    }
+
+    // Reads the per-scene entries back from a file written by this program. This is
+    // not a general JSON parser; it relies on the layout `write_json` produces.
+    bool read_baseline(const std::string &path, std::vector<BaselineEntry> &entries)
+    {
+        std::ifstream file(path);
+        if(!file) {
+            std::cerr << "ERROR: Could not open baseline `" << path << "`." << std::endl;
+            return false;
+        }
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        const std::string text = buffer.str();
+
+        auto number_after = [&](size_t from, size_t to, const char* key, double &value) {
+            size_t at = text.find(key, from);
+            if(at == std::string::npos || at > to)
+                return false;
+            value = std::strtod(text.c_str() + at + std::strlen(key), nullptr);
+            return true;
+        };
+
+        size_t pos = 0;
+        while((pos = text.find("\"name\": \"", pos)) != std::string::npos) {
+            pos += std::strlen("\"name\": \"");
+            size_t end = text.find('"', pos);
+            size_t object_end = text.find('}', pos);
+            if(end == std::string::npos || object_end == std::string::npos)
+                break;
+
+            BaselineEntry entry;
+            entry.name = text.substr(pos, end - pos);
+            size_t at = text.find("\"checksum\": \"", pos);
+            if(at != std::string::npos && at < object_end)
+                entry.checksum = std::strtoull(text.c_str() + at + std::strlen("\"checksum\": \""), nullptr, 16);
+            if(number_after(pos, object_end, "\"render_seconds\":", entry.render_seconds) &&
+               number_after(pos, object_end, "\"rays_per_second\":", entry.rays_per_second))
+                entries.push_back(entry);
+            pos = object_end;
+        }
+
+        if(entries.empty()) {
+            std::cerr << "ERROR: No scene results found in baseline `" << path << "`." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    const char* accelerator_name(Accelerator accelerator)
+    {
+        switch(accelerator) {
+            case Accelerator::Instances: return "instances";
+            case Accelerator::BVH:       return "bvh";
+            default:                     return "list";
+        }
+    }
+
+    void write_json(std::ostream &out, const RenderSettings &settings, const BenchOptions &options,
+                    const std::vector<std::string> &names, const std::vector<BenchResult> &results)
+    {
+        char checksum[17];
+        out << "{\n"
+            << "  \"settings\": {\"width\": " << settings.image_width << ", \"spp\": " << settings.samples_per_pixel
+            << ", \"depth\": " << settings.max_depth << ", \"threads\": " << settings.threads
+            << ", \"seed\": " << settings.seed
+            << ", \"accelerator\": \"" << accelerator_name(settings.accelerator) << "\""
+            << ", \"precision\": \"" << (sizeof(real) == sizeof(float) ? "float" : "double") << "\""
+            << ", \"bake_noise\": " << options.noise_voxel_size
+            << ", \"texture_programs\": " << (options.texture_programs ? "true" : "false")
+            << ", \"ray_differentials\": " << (settings.ray_differentials ? "true" : "false") << "},\n"
+            << "  \"scenes\": [\n";
+        for(size_t i = 0; i < results.size(); i++) {
+            const BenchResult &r = results[i];
+            std::snprintf(checksum, sizeof(checksum), "%016llx", static_cast<unsigned long long>(r.checksum));
+            out << "    {\"name\": \"" << names[i] << "\""
+                << ", \"build_seconds\": " << r.build_seconds
+                << ", \"render_seconds\": " << r.render_seconds
+                << ", \"samples\": " << r.samples
+                << ", \"rays\": " << r.rays
+                << ", \"samples_per_second\": " << r.samples / r.render_seconds
+                << ", \"rays_per_second\": " << r.rays / r.render_seconds
+                << ", \"peak_rss_kib\": " << r.peak_rss_kib
+                << ", \"idle_fraction\": " << r.idle_fraction
+                << ", \"checksum\": \"" << checksum << "\"";
+            // PSNR of 8-bit images, infinite (null) for identical ones.
+            if(r.compared) {
+                out << ", \"image_rmse\": " << r.image_rmse << ", \"image_psnr\": ";
+                if(r.image_rmse > 0)
+                    out << 20 * std::log10(255 / r.image_rmse);
+                else
+                    out << "null";
+            }
+            if(r.texture_decode_seconds > 0)
+                out << ", \"texture_decode_seconds\": " << r.texture_decode_seconds
+                    << ", \"texture_wait_seconds\": " << r.texture_wait_seconds;
+            if(r.instances > 0)
+                out << ", \"instances\": " << r.instances
+                    << ", \"instance_geometries\": " << r.instance_geometries
+                    << ", \"instance_bytes\": " << r.instance_bytes
+                    << ", \"geometry_bytes\": " << r.geometry_bytes
+                    << ", \"duplicated_bytes\": " << r.duplicated_bytes;
+            if(r.texture_lookups > 0)
+                out << ", \"texture_lookups\": " << r.texture_lookups
+                    << ", \"texture_hit_rate\": " << 1.0 - static_cast<double>(r.texture_misses) / r.texture_lookups
+                    << ", \"texture_resident_bytes\": " << r.texture_resident_bytes;
+            out << "}"
+                << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n"
+            << "}\n";
+    }
+
+    // Prints a table of changes against the baseline to stderr. Returns false if any
+    // scene's ray throughput dropped by more than `tolerance` percent.
+    bool compare(const std::vector<BaselineEntry> &baseline, const std::vector<std::string> &names,
+                 const std::vector<BenchResult> &results, double tolerance)
+    {
+        bool passed = true;
+        std::fprintf(stderr, "%-20s %12s %12s %9s  %s\n", "scene", "base rays/s", "rays/s", "change", "");
+        for(size_t i = 0; i < results.size(); i++) {
+            const BaselineEntry* base = nullptr;
+            for(const auto &entry : baseline)
+                if(entry.name == names[i])
+                    base = &entry;
+            if(!base) {
+                std::fprintf(stderr, "%-20s %12s\n", names[i].c_str(), "(no baseline)");
+                continue;
+            }
+
+            double rays_per_second = results[i].rays / results[i].render_seconds;
+            double change = 100.0 * (rays_per_second / base->rays_per_second - 1.0);
+            const char* note = "";
+            if(change < -tolerance) {
+                note = "REGRESSION";
+                passed = false;
+            }
+            else if(results[i].checksum != base->checksum)
+                note = "image differs";
+            std::fprintf(stderr, "%-20s %12.4g %12.4g %+8.1f%%  %s\n", names[i].c_str(), base->rays_per_second,
+                         rays_per_second, change, note);
+        }
+        return passed;
+    }
+
+    void usage(const char* program)
+    {
+        std::cerr << "Usage: " << program << " [options]\n"
+                  << "\n"
+                  << "Options:\n"
+                  << "  -s, --scene <name>          benchmark only this scene, may be repeated\n"
+                  << "  -w, --width <pixels>        image width (default: 160)\n"
+                  << "  -n, --spp <samples>         samples per pixel (default: 8)\n"
+                  << "  -d, --depth <bounces>       maximum path depth (default: 50)\n"
+                  << "  -t, --threads <count>       render threads, 0 for all hardware threads (default: 1)\n"
+                  << "      --seed <value>          random seed (default: 0)\n"
+                  << "      --accelerator <name>    instances | bvh | list (default: instances)\n"
+                  << "  -o, --output <path>         JSON output file, `-` for stdout (default: -)\n"
+                  << "  -b, --baseline <path>       compare against an earlier JSON output\n"
+                  << "      --tolerance <percent>   allowed drop in rays/s before failing (default: 5)\n"
+                  << "      --images <dir>          save the rendered images as `<dir>/<scene>.ppm`\n"
+                  << "      --reference <dir>       report RMSE and PSNR against the images saved in `<dir>`\n"
+                  << "      --bake-noise <size>     approximate noise textures by grids of this voxel size\n"
+                  << "      --ray-differentials     filter textures over ray differentials instead of ray cones\n"
+                  << "      --no-texture-programs   look textures up through their trees, uncompiled\n"
+                  << "      --texture-cache <MiB>   memory for tiles of tiled (.rtt) textures (default: 256)\n"
+                  << "  -h, --help                  show this help\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> names;
+    std::string output = "-";
+    std::string baseline_path;
+    double tolerance = 5.0;
+    BenchOptions options;
+
+    RenderSettings settings;
+    settings.image_width = 160;
+    settings.samples_per_pixel = 8;
+    settings.threads = 1;
+    settings.progress = false;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+
+        if(arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        }
+        if(arg == "--ray-differentials") {
+            settings.ray_differentials = true;
+            continue;
+        }
+        if(arg == "--no-texture-programs") {
+            options.texture_programs = false;
+            continue;
+        }
+
+        if(i + 1 >= argc) {
+            std::cerr << "ERROR: Missing value for option `" << arg << "`." << std::endl;
+            usage(argv[0]);
+            return 1;
+        }
+        const char* value = argv[++i];
+
+        bool ok = true;
+        if(arg == "-s" || arg == "--scene")
+            names.push_back(value);
+        else if(arg == "-w" || arg == "--width")
+            ok = parse_int(value, 1, settings.image_width);
+        else if(arg == "-n" || arg == "--spp")
+            ok = parse_int(value, 1, settings.samples_per_pixel);
+        else if(arg == "-d" || arg == "--depth")
+            ok = parse_int(value, 1, settings.max_depth);
+        else if(arg == "-t" || arg == "--threads")
+            ok = parse_int(value, 0, settings.threads);
+        else if(arg == "--seed") {
+            char* end;
+            settings.seed = std::strtoull(value, &end, 0);
+            ok = *value != '\0' && *end == '\0';
+        }
+        else if(arg == "--accelerator")
+            ok = parse_accelerator(value, settings.accelerator);
+        else if(arg == "-o" || arg == "--output")
+            output = value;
+        else if(arg == "-b" || arg == "--baseline")
+            baseline_path = value;
+        else if(arg == "--tolerance")
+            ok = parse_double(value, 0, tolerance);
+        else if(arg == "--images")
+            options.image_dir = value;
+        else if(arg == "--reference")
+            options.reference_dir = value;
+        else if(arg == "--bake-noise")
+            ok = parse_double(value, 1e-6, options.noise_voxel_size);
+        else if(arg == "--texture-cache") {
+            int mib = 0;
+            ok = parse_int(value, 1, mib) && texture_cache().set_capacity(static_cast<size_t>(mib) << 20);
+        }
+        else {
+            std::cerr << "ERROR: Unknown option `" << arg << "`." << std::endl;
+            usage(argv[0]);
+            return 1;
+        }
+
+        if(!ok) {
+            std::cerr << "ERROR: Invalid value `" << value << "` for option `" << arg << "`." << std::endl;
+            return 1;
+        }
+    }
+    if(names.empty())
+        names = default_scenes;
+
+    std::vector<BaselineEntry> baseline;
+    if(!baseline_path.empty() && !read_baseline(baseline_path, baseline))
+        return 1;
+
+    std::vector<BenchResult> results;
+    for(const auto &name : names) {
+        std::cerr << "Benchmarking " << name << "..." << std::flush;
+        BenchResult result = run_isolated(name, settings, options);
+        if(!result.ok) {
+            std::cerr << "\nERROR: Benchmark of scene `" << name << "` failed." << std::endl;
+            return 1;
+        }
+        std::cerr << ' ' << result.render_seconds << "s\n";
+        results.push_back(result);
+    }
+
+    if(output == "-")
+        write_json(std::cout, settings, options, names, results);
+    else {
+        std::ofstream file(output);
+        if(!file) {
+            std::cerr << "ERROR: Could not open output file `" << output << "`." << std::endl;
+            return 1;
+        }
+        write_json(file, settings, options, names, results);
+    }
+
+    if(!baseline.empty() && !compare(baseline, names, results, tolerance))
+        return 2;
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include <common.hpp>
+#include <render.hpp>
+#include <scene.hpp>
+#include <topology.hpp>
+
+#include "bench_common.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Thread scaling benchmark
+//
+// Renders one scene with 1, 2, 4, ... threads, once with unpinned threads, once with
+// threads pinned to CPUs and once pinned with a scene replica per NUMA node, and
+// reports time, speedup over one thread of the same mode, parallel efficiency and
+// idle time as JSON.
+
+namespace {
+    using namespace raytracing;
+
+    struct Mode {
+        const char* name;
+        bool pin, replicate;
+    };
+
+    const Mode modes[] = {
+        {"unpinned", false, false},
+        {"pinned", true, false},
+        {"pinned_replicated", true, true},
+    };
+
+    void usage(const char* program)
+    {
+        std::cerr << "Usage: " << program << " [options]\n"
+                  << "\n"
+                  << "Options:\n"
+                  << "  -s, --scene <name>          scene to render (default: final_scene)\n"
+                  << "  -w, --width <pixels>        image width (default: 200)\n"
+                  << "  -n, --spp <samples>         samples per pixel (default: 4)\n"
+                  << "      --max-threads <count>   largest thread count (default: hardware threads)\n"
+                  << "  -o, --output <path>         JSON output file, `-` for stdout (default: -)\n"
+                  << "  -h, --help                  show this help\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string scene_name = "final_scene";
+    std::string output = "-";
+    int max_threads = static_cast<int>(std::thread::hardware_concurrency());
+
+    RenderSettings settings;
+    settings.image_width = 200;
+    settings.samples_per_pixel = 4;
+    settings.progress = false;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+
+        if(arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        }
+
+        if(i + 1 >= argc) {
+            std::cerr << "ERROR: Missing value for option `" << arg << "`." << std::endl;
+            usage(argv[0]);
+            return 1;
+        }
+        const char* value = argv[++i];
+
+        bool ok = true;
+        if(arg == "-s" || arg == "--scene")
+            scene_name = value;
+        else if(arg == "-w" || arg == "--width")
+            ok = parse_int(value, 1, settings.image_width);
+        else if(arg == "-n" || arg == "--spp")
+            ok = parse_int(value, 1, settings.samples_per_pixel);
+        else if(arg == "--max-threads")
+            ok = parse_int(value, 1, max_threads);
+        else if(arg == "-o" || arg == "--output")
+            output = value;
+        else {
+            std::cerr << "ERROR: Unknown option `" << arg << "`." << std::endl;
+            usage(argv[0]);
+            return 1;
+        }
+
+        if(!ok) {
+            std::cerr << "ERROR: Invalid value `" << value << "` for option `" << arg << "`." << std::endl;
+            return 1;
+        }
+    }
+    if(max_threads < 1)
+        max_threads = 1;
+
+    settings.scene_builder = [&](Scene &scene) {
+        seed_random(settings.seed);
+        return build_scene(scene_name, scene);
+    };
+    Scene scene;
+    if(!settings.scene_builder(scene)) {
+        std::cerr << "ERROR: Unknown scene `" << scene_name << "`." << std::endl;
+        return 1;
+    }
+
+    std::vector<int> thread_counts;
+    for(int threads = 1; threads < max_threads; threads *= 2)
+        thread_counts.push_back(threads);
+    thread_counts.push_back(max_threads);
+
+    std::ofstream file;
+    if(output != "-") {
+        file.open(output);
+        if(!file) {
+            std::cerr << "ERROR: Could not open output file `" << output << "`." << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &out = output == "-" ? std::cout : file;
+
+    const CpuTopology &topology = cpu_topology();
+    out << "{\n"
+        << "  \"scene\": \"" << scene_name << "\", \"width\": " << settings.image_width
+        << ", \"spp\": " << settings.samples_per_pixel << ", \"cpus\": " << topology.cpu_count()
+        << ", \"numa_nodes\": " << topology.nodes.size() << ",\n"
+        << "  \"runs\": [\n";
+
+    bool first = true;
+    for(const Mode &mode : modes) {
+        double single_thread_seconds = 0;
+        for(int threads : thread_counts) {
+            settings.threads = threads;
+            settings.pin_threads = mode.pin;
+            settings.replicate_scene = mode.replicate;
+
+            std::cerr << "Rendering " << mode.name << " with " << threads << " threads..." << std::flush;
+            Framebuffer framebuffer;
+            RenderStats stats = render(scene, settings, framebuffer);
+            std::cerr << ' ' << stats.seconds << "s\n";
+
+            if(threads == 1)
+                single_thread_seconds = stats.seconds;
+            double busy = 0, idle = 0;
+            for(const auto &w : stats.workers) {
+                busy += w.busy_seconds;
+                idle += w.idle_seconds;
+            }
+            double speedup = single_thread_seconds / stats.seconds;
+
+            out << (first ? "" : ",\n")
+                << "    {\"mode\": \"" << mode.name << "\", \"threads\": " << threads
+                << ", \"seconds\": " << stats.seconds
+                << ", \"speedup\": " << speedup
+                << ", \"efficiency\": " << speedup / threads
+                << ", \"idle_fraction\": " << (busy + idle > 0 ? idle / (busy + idle) : 0)
+                << ", \"replicate_seconds\": " << stats.replicate_seconds << "}";
+            first = false;
+        }
+    }
+    out << "\n  ]\n"
+        << "}\n";
+    return 0;
+}
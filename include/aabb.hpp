@@ -9,16 +9,16 @@ class AABB {
     public:
         AABB() {}
         AABB(const Point3 &a, const Point3 &b)
-            : maximum(a), minimum(b)
+            : minimum(a), maximum(b)
         {}
 
         Point3 min() const { return minimum; }
         Point3 max() const { return maximum; }
 
-        bool hit(const Ray &r, double t_min, double t_max) const;
+        bool hit(const Ray &r, real t_min, real t_max) const;
 
     public:
-        Point3 maximum, minimum;
+        Point3 minimum, maximum;
 };
 
 AABB surrounding_box(AABB box0, AABB box1);
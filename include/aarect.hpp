@@ -5,14 +5,19 @@
 
 namespace raytracing {
 
+// Intersect axis-aligned rectangles and fill in everything in `rec` except the material.
+bool hit_xy_rect(real x0, real x1, real y0, real y1, real k, const Ray &r, real t_min, real t_max, HitRecord &rec);
+bool hit_xz_rect(real x0, real x1, real z0, real z1, real k, const Ray &r, real t_min, real t_max, HitRecord &rec);
+bool hit_yz_rect(real y0, real y1, real z0, real z1, real k, const Ray &r, real t_min, real t_max, HitRecord &rec);
+
 class XYRect : public Hittable {
     public:
         XYRect() {};
-        XYRect(double _x0, double _x1, double _y0, double _y1, double _k, std::shared_ptr<Material> mat)
+        XYRect(real _x0, real _x1, real _y0, real _y1, real _k, std::shared_ptr<Material> mat)
             : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat)
         {}
 
-        virtual bool hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const override;
+        virtual bool hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const override;
 
         virtual bool bounding_box(double time0, double time1, AABB &output_box) const override {
             // The bounding box must have non-zero width in each dimension, so pad the Z
@@ -23,18 +28,18 @@ class XYRect : public Hittable {
 
 
     public:
-        double x0, x1, y0, y1, k;
+        real x0, x1, y0, y1, k;
         std::shared_ptr<Material> mp;
 };
 
 class XZRect : public Hittable {
     public:
         XZRect() {};
-        XZRect(double _x0, double _x1, double _z0, double _z1, double _k, std::shared_ptr<Material> mat)
+        XZRect(real _x0, real _x1, real _z0, real _z1, real _k, std::shared_ptr<Material> mat)
             : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat)
         {}
 
-        virtual bool hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const override;
+        virtual bool hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const override;
 
         virtual bool bounding_box(double time0, double time1, AABB &output_box) const override {
             // The bounding box must have non-zero width in each dimension, so pad the Z
@@ -45,18 +50,18 @@ class XZRect : public Hittable {
 
 
     public:
-        double x0, x1, z0, z1, k;
+        real x0, x1, z0, z1, k;
         std::shared_ptr<Material> mp;
 };
 
 class YZRect : public Hittable {
     public:
         YZRect() {};
-        YZRect(double _y0, double _y1, double _z0, double _z1, double _k, std::shared_ptr<Material> mat)
+        YZRect(real _y0, real _y1, real _z0, real _z1, real _k, std::shared_ptr<Material> mat)
             : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat)
         {}
 
-        virtual bool hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const override;
+        virtual bool hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const override;
 
         virtual bool bounding_box(double time0, double time1, AABB &output_box) const override {
             // The bounding box must have non-zero width in each dimension, so pad the Z
@@ -67,7 +72,7 @@ class YZRect : public Hittable {
 
 
     public:
-        double y0, y1, z0, z1, k;
+        real y0, y1, z0, z1, k;
         std::shared_ptr<Material> mp;
 };
 
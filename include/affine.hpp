@@ -0,0 +1,84 @@
+#pragma once
+
+#include "common.hpp"
+#include "aabb.hpp"
+#include "hittable.hpp"
+#include "ray.hpp"
+#include "vec3.hpp"
+
+// Affine transforms
+//
+// A 3x4 matrix: a linear part and a translation, applied to points as `A p + t` and to
+// directions as `A v`. Rays keep their parameter under a transform, since their direction
+// is not normalized: the hit at `t` in object space is the hit at `t` in world space.
+// Normals do not transform like directions; a normal of an object transformed by `M`
+// transforms by the inverse transpose of `M`, i.e. by the transpose of the world to object
+// matrix that the ray went through (see `transposed_vector`).
+
+namespace raytracing {
+
+struct Affine {
+    real m[3][4]; // rows: the linear part, then the translation
+
+    static Affine identity();
+    static Affine translation(const Vec3 &offset);
+    // Rotation about y by the angle of `sin_theta` and `cos_theta`, as RotateY.
+    static Affine rotation_y(real sin_theta, real cos_theta);
+
+    Point3 point(const Point3 &p) const
+    {
+        return Point3(m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+                      m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+                      m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+    }
+
+    Vec3 vector(const Vec3 &v) const
+    {
+        return Vec3(m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+                    m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+                    m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+    }
+
+    // The linear part's transpose times `v`.
+    Vec3 transposed_vector(const Vec3 &v) const
+    {
+        return Vec3(m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+                    m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+                    m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z());
+    }
+
+    // `r` with its origin, direction and differentials transformed.
+    Ray ray(const Ray &r) const
+    {
+        Ray transformed = r;
+        transformed.orig = point(r.origin());
+        transformed.dir = vector(r.direction());
+        if(r.has_differentials) {
+            transformed.rx_origin = point(r.rx_origin);
+            transformed.ry_origin = point(r.ry_origin);
+            transformed.rx_direction = vector(r.rx_direction);
+            transformed.ry_direction = vector(r.ry_direction);
+        }
+        return transformed;
+    }
+
+    // The smallest box around `box` transformed.
+    AABB bounds(const AABB &box) const;
+    // The smallest box around the sphere at `center` with `radius` transformed.
+    AABB bounds(const Point3 &center, real radius) const;
+
+    // Returns false, leaving `result` alone, if the linear part is singular.
+    bool inverse(Affine &result) const;
+
+    bool is_identity() const;
+};
+
+// The transform that applies `b`, then `a`.
+Affine operator*(const Affine &a, const Affine &b);
+
+// Takes `rec`, a hit of a ray that `to_object` transformed, to world space. The ray kept its
+// parameter, so `t` needs no change; the normal keeps its side of the surface under the
+// inverse transpose.
+void hit_to_world(const Affine &to_world, const Affine &to_object, HitRecord &rec);
+
+} // namespace raytracing
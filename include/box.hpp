@@ -8,21 +8,26 @@
 
 namespace raytracing {
 
+// Intersects the box spanned by `p0` and `p1` and fills in everything in `rec` except the material.
+bool hit_box(const Point3 &p0, const Point3 &p1, const Ray &r, real t_min, real t_max, HitRecord &rec);
+
 class Box : public Hittable {
     public:
         Box() {}
         Box(const Point3 &p0, const Point3 &p1, std::shared_ptr<Material> ptr);
     
-        virtual bool hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const override;
+        virtual bool hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const override;
         virtual bool bounding_box(double time0, double time1, AABB &output_box) const override
         {
             output_box = AABB(box_min, box_max);
             return true;
         }
+        virtual bool interval(const Ray &r, real &t_enter, real &t_exit) const override;
     
     public:
         Point3 box_min, box_max;
         HittableList sides;
+        std::shared_ptr<Material> mat_ptr;
 };
 
 } // namespace raytracing
\ No newline at end of file
@@ -18,7 +18,7 @@ class BVHNode : public Hittable {
 
         BVHNode(const std::vector<std::shared_ptr<Hittable>> &src_objects, size_t start, size_t end, double time0, double time1);
 
-        virtual bool hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const override;
+        virtual bool hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const override;
         virtual bool bounding_box(double time0, double time1, AABB &output_box) const override;
 
     public:
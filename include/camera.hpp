@@ -4,6 +4,8 @@
 #include "vec3.hpp"
 #include "ray.hpp"
 
+#include <algorithm>
+
 namespace raytracing {
 
 class Camera {
@@ -12,10 +14,10 @@ class Camera {
             Point3 lookfrom, 
             Point3 lookat, 
             Vec3 vup, 
-            double vfov /*vertical Field-Of-View*/, 
-            double aspect_ratio,
-            double aperture,
-            double focus_dist,
+            real vfov /*vertical Field-Of-View*/, 
+            real aspect_ratio,
+            real aperture,
+            real focus_dist,
             double _time0 = 0,
             double _time1 = 0
         )
@@ -39,18 +41,44 @@ class Camera {
             time1 = _time1;
         }
 
-        Ray get_ray(double s, double t) const
+        Ray get_ray(real s, real t) const
         {
             Vec3 rd = lens_radius * random_in_unit_disk();
             Vec3 offset = u * rd.x() + v * rd.y();
 
-            return Ray(origin + offset, lower_left_corner + s * horizontal + t * vertical - origin - offset, random_double(time0, time1));
+            Ray r(origin + offset, lower_left_corner + s * horizontal + t * vertical - origin - offset, random_double(time0, time1));
+            r.spread = pixel_spread;
+            if(differentials) {
+                r.has_differentials = true;
+                r.rx_origin = r.ry_origin = r.orig;
+                r.rx_direction = r.dir + pixel_ds * horizontal;
+                r.ry_direction = r.dir + pixel_dt * vertical;
+            }
+            return r;
+        }
+
+        // Sizes the footprint of rays for an image of `image_width` x `image_height`
+        // pixels: a cone, or with `ray_differentials` the rays through the neighbouring
+        // pixels. Either is as wide as the area each of `samples_per_pixel` samples covers
+        // (as in pbrt, at least 1/8 of the pixel), so textures are filtered about as much
+        // as the samples would filter them anyway. Rays reach the focus plane at t = 1,
+        // where pixels are |vertical| / height wide. Both start at a point, so defocus
+        // blur does not widen them.
+        void set_pixel_footprint(int image_width, int image_height, int samples_per_pixel, bool ray_differentials)
+        {
+            real scale = std::max(real(0.125), 1 / std::sqrt(real(std::max(samples_per_pixel, 1))));
+            pixel_ds = scale / std::max(image_width - 1, 1);
+            pixel_dt = scale / std::max(image_height - 1, 1);
+            pixel_spread = pixel_dt * vertical.length();
+            differentials = ray_differentials;
         }
     
     private:
         Point3 origin, lower_left_corner;
         Vec3 horizontal, vertical, u, v, w;
-        double lens_radius, time0, time1;
+        real lens_radius, time0, time1;
+        real pixel_ds = 0, pixel_dt = 0, pixel_spread = 0;
+        bool differentials = false;
 };
 
 } // namespace raytracing
\ No newline at end of file
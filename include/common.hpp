@@ -1,14 +1,28 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
 #include <cmath>
 #include <limits>
 #include <memory>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
 namespace raytracing {
 
+    // Scalar type of the geometry and shading math (vectors, rays, bounding boxes and
+    // hit records). `make PRECISION=float` builds with single precision.
+#ifdef RAYTRACING_FLOAT
+    using real = float;
+#else
+    using real = double;
+#endif
+
     // Constants
-    const double infinity = std::numeric_limits<double>::infinity();
+    const real infinity = std::numeric_limits<real>::infinity();
     const double pi = 3.1415926535897932385;
 
     // Utility functions
@@ -17,10 +31,35 @@ namespace raytracing {
         return degrees * pi / 180.0;
     }
 
+    // Random number generation
+    //
+    // Every thread owns its own SplitMix64 state, so rendering threads never
+    // contend on (or corrupt) a shared generator the way `rand()` does.
+    inline thread_local uint64_t random_state = 0x853c49e6748fea9bull;
+
+    inline uint64_t mix64(uint64_t z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    inline void seed_random(uint64_t seed, uint64_t stream = 0)
+    {
+        // Seeds the calling thread's generator. Different streams of the same
+        // seed yield independent sequences (used to seed each scanline).
+        random_state = mix64(seed ^ mix64(stream + 0x9e3779b97f4a7c15ull));
+    }
+
+    inline uint64_t random_uint64()
+    {
+        return mix64(random_state += 0x9e3779b97f4a7c15ull);
+    }
+
     inline double random_double() 
     {
         // Returns a random real in [0,1).
-        return rand() / (RAND_MAX + 1.0);
+        return (random_uint64() >> 11) * 0x1.0p-53;
     }
 
     inline double random_double(double min, double max) 
@@ -35,6 +74,17 @@ namespace raytracing {
         return static_cast<int>(random_double(min, max + 1));
     }
 
+    // Cycle counter for cheap, fine-grained timing. Only differences on the same
+    // thread are meaningful; elsewhere than x86 it counts nanoseconds instead.
+    inline uint64_t read_cycle_counter()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
     inline double clamp(double x, double min, double max)
     {
         if(x < min) 
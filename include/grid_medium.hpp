@@ -0,0 +1,116 @@
+#pragma once
+
+#include "common.hpp"
+#include "aabb.hpp"
+#include "hittable.hpp"
+#include "material.hpp"
+#include "perlin.hpp"
+#include "texture.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Heterogeneous participating media
+//
+// A GridMedium fills a box with a density that varies over space, interpolated
+// trilinearly between the samples of a DensityGrid. Free paths are sampled by delta
+// tracking: the ray takes exponential steps as if the medium had a constant density, the
+// majorant, and at each step scatters with the probability of the real density over the
+// majorant, or carries on (a null collision). That is unbiased for any majorant that is
+// at least the density, but each null collision costs a lookup, so the majorant is taken
+// per brick of 8x8x8 cells of a coarse grid: rays cross thin regions in few steps and
+// empty bricks in none.
+//
+// Voxel files hold a grid's samples:
+//
+//   "RTVOXELS" | uint32 version | uint32 nx, ny, nz | nx * ny * nz float32 (x fastest)
+
+namespace raytracing {
+
+enum class GridLayout : uint32_t {
+    Dense, // every sample stored
+    Sparse // only the bricks of 8x8x8 samples that are not all zero
+};
+
+bool parse_grid_layout(const std::string &name, GridLayout &layout);
+
+// nx * ny * nz density samples at the corners of the cells that divide `bounds` evenly.
+class DensityGrid {
+    public:
+        static const int brick_size = 8;
+
+        // `samples` in x fastest, then y, then z order, all at least 0.
+        DensityGrid(const AABB &bounds, int nx, int ny, int nz, const std::vector<float> &samples, GridLayout layout = GridLayout::Dense);
+
+        // The positive half of `noise` at `frequency` times the position, so about half of
+        // the box is empty, sampled every `voxel_size` units. Callers keep `noise_samples`
+        // within `max_noise_samples`.
+        static std::shared_ptr<DensityGrid> from_noise(const Perlin &noise, real frequency, const AABB &bounds, real voxel_size,
+                                                       GridLayout layout = GridLayout::Dense);
+        // Number of samples `from_noise` takes over `bounds`, saturating at SIZE_MAX.
+        static size_t noise_samples(const AABB &bounds, real voxel_size);
+
+        // Reads a voxel file, whose samples then span `bounds`. Returns null on errors.
+        static std::shared_ptr<DensityGrid> load(const std::string &path, const AABB &bounds, GridLayout layout = GridLayout::Dense);
+        bool save(const std::string &path) const;
+
+        // Interpolated density at `p`, which must lie within the bounds.
+        real density(const Point3 &p) const;
+
+        // The largest sample around brick `(bx, by, bz)` of cells.
+        real majorant(int bx, int by, int bz) const { return majorants[(static_cast<size_t>(bz) * brick_count[1] + by) * brick_count[0] + bx]; }
+
+        // All samples, x fastest, then y, then z.
+        std::vector<float> samples() const;
+
+        const AABB &bounds() const { return box; }
+        const int* size() const { return n; } // samples per axis
+        const int* bricks() const { return brick_count; } // of cells, per axis
+        Vec3 brick_extent() const { return brick_size * cell; }
+        GridLayout layout() const { return grid_layout; }
+        size_t size_bytes() const;
+
+    private:
+        float sample(int i, int j, int k) const;
+
+        AABB box;
+        int n[3];
+        Vec3 cell;         // extent of a cell
+        Vec3 inv_cell;
+        GridLayout grid_layout;
+
+        std::vector<float> dense;       // Dense: all samples
+        int sample_bricks[3];           // Sparse: bricks of samples per axis
+        std::vector<uint32_t> brick_of; // Sparse: first sample of every brick in `stored` + 1, 0 if empty
+        std::vector<float> stored;      // Sparse: the bricks that are not empty, x fastest within each
+
+        int brick_count[3];
+        std::vector<float> majorants;
+};
+
+class GridMedium : public Hittable {
+    public:
+        GridMedium(std::shared_ptr<const DensityGrid> g, real d, std::shared_ptr<Texture> a)
+            : grid(g), density_scale(d), phase_function(std::make_shared<Isotropic>(a))
+        {}
+
+        GridMedium(std::shared_ptr<const DensityGrid> g, real d, Color c)
+            : grid(g), density_scale(d), phase_function(std::make_shared<Isotropic>(c))
+        {}
+
+        virtual bool hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const override;
+        virtual bool bounding_box(double time0, double time1, AABB &output_box) const override
+        {
+            output_box = grid->bounds();
+            return true;
+        }
+
+    public:
+        std::shared_ptr<const DensityGrid> grid;
+        real density_scale; // multiplies the grid's samples
+        std::shared_ptr<Material> phase_function;
+};
+
+} // namespace raytracing
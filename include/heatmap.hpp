@@ -0,0 +1,16 @@
+#pragma once
+
+#include <ostream>
+#include <vector>
+
+namespace raytracing {
+
+// Writes per-pixel values (row 0 at the bottom, like `Framebuffer`) as a false-color
+// plain PPM image, from black (cheap) over red and yellow to white (expensive). Values
+// are scaled to the 99th percentile so a few outliers do not wash out the rest.
+void write_heatmap(std::ostream &out, const std::vector<float> &values, int width, int height);
+
+// Writes per-pixel values unchanged as a grayscale PFM (portable float map) image.
+void write_pfm(std::ostream &out, const std::vector<float> &values, int width, int height);
+
+} // namespace raytracing
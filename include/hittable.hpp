@@ -17,20 +17,46 @@ struct HitRecord {
     Vec3 normal;
     std::shared_ptr<Material> mat_ptr;
 
-    double t, u, v;
+    real t, u, v;
+    real p_error = 0; // rounding error of `p` beyond what its magnitude implies
     bool front_face;
 
+    UVDerivatives duv;
+    real curvature = 0; // change of `normal` per unit of change of `p`, e.g. 1 / radius
+
+    // The change of `p` between this hit and where the differentials of `r` meet the
+    // tangent plane at `p`. Differentials (nearly) parallel to the plane give none.
+    inline void position_differentials(const Ray &r, Vec3 &dpdx, Vec3 &dpdy) const
+    {
+        real plane = dot(normal, p);
+        real tx = (plane - dot(normal, r.rx_origin)) / dot(normal, r.rx_direction);
+        real ty = (plane - dot(normal, r.ry_origin)) / dot(normal, r.ry_direction);
+        if(!std::isfinite(tx) || !std::isfinite(ty)) {
+            dpdx = dpdy = Vec3(0, 0, 0);
+            return;
+        }
+        dpdx = r.rx_origin + tx * r.rx_direction - p;
+        dpdy = r.ry_origin + ty * r.ry_direction - p;
+    }
+
     inline void set_face_normal(const Ray &r, const Vec3 &outward_normal)
     {
         front_face = dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
     }
+
 };
 
 class Hittable {
     public:
-        virtual bool hit(const Ray& r, double t_min, double t_max, HitRecord &rec) const = 0;
+        virtual bool hit(const Ray& r, real t_min, real t_max, HitRecord &rec) const = 0;
         virtual bool bounding_box(double time0, double time1, AABB &output_box) const = 0;
+
+        // Where the line of `r` enters and leaves the object, which must be closed and
+        // convex (e.g. the boundary of a medium). The entry may lie behind the origin.
+        // Returns false if the line misses the object. By default this takes two `hit`
+        // calls; shapes that can solve for both at once override it.
+        virtual bool interval(const Ray &r, real &t_enter, real &t_exit) const;
 };
 
 class HittableList : public Hittable
@@ -39,7 +65,7 @@ class HittableList : public Hittable
         HittableList() {}
         HittableList(std::shared_ptr<Hittable> object) { add(object); }
 
-        virtual bool hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const override;
+        virtual bool hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const override;
         virtual bool bounding_box(double time0, double time1, AABB &output_box) const override;
 
         void clear() { objects.clear(); }
@@ -55,8 +81,9 @@ class Translate : public Hittable {
             : ptr(p), offset(displacement)
         {}
 
-        virtual bool hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const override;
+        virtual bool hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const override;
         virtual bool bounding_box(double time0, double time1, AABB &output_box) const override;
+        virtual bool interval(const Ray &r, real &t_enter, real &t_exit) const override;
 
     public:
         std::shared_ptr<Hittable> ptr;
@@ -65,16 +92,17 @@ class Translate : public Hittable {
 
 class RotateY : public Hittable {
     public:
-        RotateY(std::shared_ptr<Hittable> p, double angle);
+        RotateY(std::shared_ptr<Hittable> p, real angle);
 
-        virtual bool hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const override;
+        virtual bool hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const override;
         virtual bool bounding_box(double time0, double time1, AABB &output_box) const override
         { output_box = bbox; return hasbox; }
+        virtual bool interval(const Ray &r, real &t_enter, real &t_exit) const override;
 
     public:
         std::shared_ptr<Hittable> ptr;
-        double sin_theta;
-        double cos_theta;
+        real sin_theta;
+        real cos_theta;
         bool hasbox;
         AABB bbox;
 };
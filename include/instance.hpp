@@ -0,0 +1,89 @@
+#pragma once
+
+#include "common.hpp"
+#include "aabb.hpp"
+#include "affine.hpp"
+#include "hittable.hpp"
+#include "primitive.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Two-level acceleration structure
+//
+// Scenes place shared geometry (an object of a scene file, a group of spheres) any number
+// of times through chains of Translate, RotateY and Transform. An InstanceBVH takes the
+// top-level objects apart into instances: the geometry at the end of a chain, and the
+// chain composed into one affine transform. Every distinct geometry gets one bottom-level
+// BVH (its own, or one built for a group), which all of its instances share, and a flat
+// top-level BVH over the instances' world bounds picks the instances a ray reaches. A ray
+// is transformed into an instance's object space with one matrix, however long the chain
+// was, so a copy costs an instance record rather than a copy of its geometry.
+//
+// Top-level groups that are not transformed are taken apart into their objects, so these
+// are found through the top-level BVH too. Instance records are small; only transformed
+// instances refer to a pair of matrices in a table of their own.
+
+namespace raytracing {
+
+struct InstanceTransform {
+    Affine to_object; // world to object space
+    Affine to_world;  // object to world space
+};
+
+struct Instance {
+    static constexpr uint32_t untransformed = UINT32_MAX;
+
+    const Hittable* geometry;
+    uint32_t transform; // index into the transform table, `untransformed`: rays go to `geometry` as they are
+};
+
+struct InstanceStats {
+    size_t instances = 0;
+    size_t geometries = 0;       // distinct geometries the instances share
+    size_t instance_bytes = 0;   // instance records, their transforms and top-level nodes
+    size_t geometry_bytes = 0;   // the geometries, once each
+    size_t duplicated_bytes = 0; // the geometries, once per instance, as copies would take
+};
+
+class InstanceBVH : public Hittable {
+    public:
+        InstanceBVH(const HittableList &world, double time0, double time1);
+
+        InstanceBVH(const InstanceBVH&) = delete;
+        InstanceBVH& operator=(const InstanceBVH&) = delete;
+
+        virtual bool hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const override;
+        virtual bool bounding_box(double time0, double time1, AABB &output_box) const override;
+
+        const std::vector<Instance> &instances() const { return instance_records; }
+        const InstanceStats &stats() const { return instance_stats; }
+
+    private:
+        // Adds the instances in `object`, which `to_world` places in the world. `top` is
+        // the top-level object it belongs to.
+        void add(const std::shared_ptr<Hittable> &top, const std::shared_ptr<Hittable> &object, const Affine &to_world,
+                 double time0, double time1);
+
+        // The bottom-level structure of `geometry`, built on first use.
+        const Hittable* bottom_level(const std::shared_ptr<Hittable> &geometry, double time0, double time1);
+
+        std::vector<Instance> instance_records;
+        std::vector<InstanceTransform> transforms;
+        std::vector<AABB> instance_bounds; // while building
+        std::vector<PrimitiveBVHNode> nodes;
+
+        std::vector<std::shared_ptr<Hittable>> unbounded; // top-level objects without bounds, tested one by one
+        std::vector<std::shared_ptr<Hittable>> geometries; // keeps the bottom levels alive
+        std::map<const Hittable*, const Hittable*> bottom_levels;
+        std::map<const Hittable*, size_t> uses;
+        InstanceStats instance_stats;
+};
+
+// Memory taken by `object` and everything it owns except materials and textures, roughly.
+size_t object_bytes(const Hittable &object);
+
+} // namespace raytracing
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace raytracing {
+
+// A read-only memory mapping of a whole file. Pages are loaded on first access.
+class MappedFile {
+    public:
+        MappedFile(const std::string &path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool valid() const { return bytes != nullptr; }
+        const unsigned char* data() const { return bytes; }
+        size_t size() const { return length; }
+
+    private:
+        const unsigned char* bytes;
+        size_t length;
+};
+
+} // namespace raytracing
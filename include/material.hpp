@@ -5,6 +5,7 @@
 #include "texture.hpp"
 #include "vec3.hpp"
 #include "hittable.hpp"
+#include "stats.hpp"
 
 #include <memory>
 
@@ -15,7 +16,7 @@ struct HitRecord;
 class Material {
     public:
         virtual bool scatter(const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const = 0;
-        virtual Color emitted(double u, double v, const Point3 &p) const { return Color(0,0,0); }
+        virtual Color emitted(real u, real v, const Point3 &p) const { return Color(0,0,0); }
 };
 
 class Lambertian: public Material {
@@ -31,26 +32,26 @@ class Lambertian: public Material {
 
 class Metal : public Material {
     public:
-        Metal(const Color &a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+        Metal(const Color &a, real f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
         virtual bool scatter(const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const override;
 
     public:
         Color albedo;
-        double fuzz;
+        real fuzz;
 };
 
 class Dielectric : public Material {
     public:
-        Dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+        Dielectric(real index_of_refraction) : ir(index_of_refraction) {}
 
         virtual bool scatter(const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const override;
 
     public:
-        double ir;
+        real ir;
 
     private:
-        static double reflectance(double cosine, double ref_idx);
+        static real reflectance(real cosine, real ref_idx);
 };
 
 class DiffuseLight : public Material {
@@ -60,10 +61,12 @@ class DiffuseLight : public Material {
 
         virtual bool scatter(const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const override
         {
+            STATS_INC(scatter_calls[StatDiffuseLight]);
+            STATS_INC(scatter_absorbed[StatDiffuseLight]);
             return false;
         }
 
-        virtual Color emitted(double u, double v, const Point3 &p) const override {
+        virtual Color emitted(real u, real v, const Point3 &p) const override {
             return emit->value(u, v, p);
         }
 
@@ -78,6 +81,7 @@ class Isotropic : public Material {
 
         virtual bool scatter(const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const override
         {
+            STATS_INC(scatter_calls[StatIsotropic]);
             scattered = Ray(rec.p, random_in_unit_sphere(), r_in.time());
             attenuation = albedo->value(rec.u, rec.v, rec.p);
             return true;
@@ -1,30 +1,83 @@
 #pragma once
 
 #include "common.hpp"
+#include "aabb.hpp"
 #include "vec3.hpp"
 
+#include <cstdint>
+#include <memory>
+#include <vector>
+
 namespace raytracing {
 
+// Gradients and permutations of one noise seed in a single cache-aligned 4 KiB block.
+// The three permutations are interleaved and stored as bytes, since they index only
+// 256 entries.
+struct alignas(64) PerlinTables {
+    static const int point_count = 256;
+
+    uint8_t perm[point_count][4];   // x, y and z permutations, the fourth entry unused
+    float gradient[3][point_count]; // x, y and z components of the unit gradients
+
+    explicit PerlinTables(uint64_t seed);
+
+    // The tables of `seed`, shared by everyone who holds them at the same time.
+    static std::shared_ptr<const PerlinTables> get(uint64_t seed);
+};
+
 class Perlin {
     public:
+        // Tables from a seed drawn from the calling thread's random generator.
         Perlin();
-        ~Perlin();
+        // Tables that depend on `seed` only, whichever thread or process builds them.
+        explicit Perlin(uint64_t seed);
         
-        double noise(const Point3 &p) const;
-        double turb(const Point3 &p, int depth = 7) const;
+        // SIMD builds evaluate the eight lattice corners of `p` at once, in single precision.
+        real noise(const Point3 &p) const;
+        real turb(const Point3 &p, int depth = 7) const;
+
+        // The plain implementation of `noise`, which the SIMD one is checked against.
+        real scalar_noise(const Point3 &p) const;
+
+        uint64_t seed() const { return table_seed; }
     
     private:
-        static int* perlin_generate_perm();
-        static void permute(int* p, int n);
-        static double trilinear_interp(double c[2][2][2], double u, double v, double w);
-        static double perlin_interp(Vec3 c[2][2][2], double u, double v, double w);
+        friend class NoiseVolume;
+
+        static real trilinear_interp(real c[2][2][2], real u, real v, real w);
+        static real perlin_interp(Vec3 c[2][2][2], real u, real v, real w);
+
+    private:
+        uint64_t table_seed;
+        std::shared_ptr<const PerlinTables> tables;
+};
+
+// Most samples a grid baked from noise may hold; larger ones take longer to bake and
+// more memory than they are worth.
+const size_t max_noise_samples = size_t(1) << 26;
+
+// `Perlin::turb` baked on a regular grid over a box and looked up with trilinear
+// interpolation. A lookup costs a few loads instead of seven noise octaves, but the grid
+// smooths away the octaves finer than its voxels, so it suits scenes that tolerate
+// softer noise.
+class NoiseVolume {
+    public:
+        NoiseVolume(const Perlin &noise, const AABB &bounds, real voxel_size, int depth = 7);
+
+        // Number of grid samples a volume over `bounds` would hold.
+        static size_t sample_count(const AABB &bounds, real voxel_size);
+
+        bool contains(const Point3 &p) const;
+        real turb(const Point3 &p) const; // clamped to the volume
+
+        size_t size_bytes() const { return samples.size() * sizeof(float); }
 
     private:
-        static const int point_count = 256;
-        Vec3* ranvec;
-        int* perm_x;
-        int* perm_y;
-        int* perm_z;
+        Point3 origin;
+        Point3 end;
+        real inv_voxel_size;
+        int nx, ny, nz;
+        std::vector<float> samples; // x fastest, then y, then z
 };
 
-} // namespace raytracing
\ No newline at end of file
+} // namespace raytracing
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "common.hpp"
+#include "aabb.hpp"
+#include "hittable.hpp"
+#include "vec3.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace raytracing {
+
+class Material;
+
+enum class PrimitiveType : uint32_t {
+    Sphere,       // data: center, radius
+    MovingSphere, // data: center at time 0, velocity, radius
+    XYRect,       // data: x0, x1, y0, y1, k
+    XZRect,       // data: x0, x1, z0, z1, k
+    YZRect,       // data: y0, y1, z0, z1, k
+    Box           // data: min corner, max corner
+};
+
+// A single primitive as a plain 64-byte record. Arrays of these are intersected
+// without virtual dispatch and can be stored on disk as-is.
+struct Primitive {
+    PrimitiveType type;
+    uint32_t material; // index into the owning PrimitiveArray's material table
+    real data[7];
+
+    static Primitive sphere(const Point3 &center, real radius, uint32_t material);
+    static Primitive moving_sphere(const Point3 &center0, const Point3 &center1, double time0, double time1, real radius, uint32_t material);
+    static Primitive rect(PrimitiveType type, real a0, real a1, real b0, real b1, real k, uint32_t material);
+    static Primitive box(const Point3 &p0, const Point3 &p1, uint32_t material);
+
+    AABB bounds(double time0, double time1) const;
+    bool hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const;
+};
+
+// Node of the flattened BVH over a primitive array. The first child of an interior
+// node directly follows it; `offset` holds the index of the second child.
+struct PrimitiveBVHNode {
+    AABB box;
+    uint32_t offset; // leaf: index of the first primitive, interior: second child
+    uint16_t count;  // leaf: number of primitives, interior: 0
+    uint16_t axis;   // interior: split axis, used to visit the nearer child first
+};
+
+// Nodes a flattened BVH may have above a leaf. Traversals keep their pending nodes on a
+// stack of this size.
+const int max_bvh_depth = 64;
+
+// Builds a flattened BVH over items with the given bounds, leaves of at most
+// `max_leaf_size` of them and no deeper than `max_bvh_depth`. Leaves refer to ranges of
+// `order`, which receives the items' indices sorted into leaf order.
+void build_bvh_nodes(const std::vector<AABB> &bounds, size_t max_leaf_size, std::vector<PrimitiveBVHNode> &nodes,
+                     std::vector<uint32_t> &order);
+
+class PrimitiveArray : public Hittable {
+    public:
+        // Takes ownership of `prims` (reordering them) and builds a BVH over them.
+        PrimitiveArray(std::vector<Primitive> prims, std::vector<std::shared_ptr<Material>> mats, double time0, double time1);
+
+        // Uses externally owned primitives and BVH nodes, e.g. from a memory-mapped file.
+        // The caller keeps that memory alive for the lifetime of the array, and has checked
+        // that the nodes refer to `prims` and to each other only, within `max_bvh_depth`,
+        // and that the primitives' types are known and their materials within `mats`.
+        PrimitiveArray(const Primitive* prims, size_t count, const PrimitiveBVHNode* bvh_nodes, size_t bvh_node_count,
+                       std::vector<std::shared_ptr<Material>> mats);
+
+        PrimitiveArray(const PrimitiveArray&) = delete;
+        PrimitiveArray& operator=(const PrimitiveArray&) = delete;
+
+        virtual bool hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const override;
+        virtual bool bounding_box(double time0, double time1, AABB &output_box) const override;
+
+        size_t size() const { return primitive_count; }
+        const Primitive* primitives() const { return primitive_data; }
+        size_t node_count() const { return bvh_node_count; }
+        const PrimitiveBVHNode* nodes() const { return bvh_nodes; }
+
+    private:
+        void build(double time0, double time1);
+
+    public:
+        std::vector<std::shared_ptr<Material>> materials;
+
+    private:
+        std::vector<Primitive> owned_primitives;
+        std::vector<PrimitiveBVHNode> owned_nodes;
+
+        const Primitive* primitive_data;
+        size_t primitive_count;
+        const PrimitiveBVHNode* bvh_nodes;
+        size_t bvh_node_count;
+};
+
+} // namespace raytracing
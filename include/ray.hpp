@@ -4,25 +4,62 @@
 
 namespace raytracing {
 
+// Change of the texture coordinates between a ray and the rays through its neighbouring
+// pixels to the right (x) and above (y), which textures filter over.
+struct UVDerivatives {
+    real dudx = 0, dvdx = 0;
+    real dudy = 0, dvdy = 0;
+};
+
 class Ray {
     public:
         Ray() {}
-        Ray(const Point3 &origin, const Vec3 &direction, double time = 0.0)
+        Ray(const Point3 &origin, const Vec3 &direction, real time = 0)
             : orig(origin), dir(direction), tm(time)
         {}
 
         Point3 origin() const { return orig; }
         Vec3 direction() const { return dir; }
-        double time() const { return tm; }
+        real time() const { return tm; }
 
-        Point3 at(double t) const {
+        Point3 at(real t) const {
             return orig + t * dir;
         }
 
+        // Width of the ray's cone at `t`, for picking texture mip levels.
+        real footprint(real t) const {
+            return width + t * spread;
+        }
+
     public:
         Point3 orig;
         Vec3 dir;
-        double tm;
+        real tm;
+
+        // The cone of the pixel a ray samples: its width at the origin and its growth
+        // per unit of `t` (not of distance, so it depends on the length of `dir`).
+        real width = 0;
+        real spread = 0;
+
+        // Ray differentials: the rays through the neighbouring pixels to the right (x)
+        // and above (y), followed through transforms and specular bounces. They replace
+        // the cone where present.
+        bool has_differentials = false;
+        Point3 rx_origin, ry_origin;
+        Vec3 rx_direction, ry_direction;
 };
 
+// Moves the hit point `p` off its surface along the unit normal `n`, to the side
+// `direction` leaves towards. The distance covers the rounding error of `p`: some
+// multiple of the epsilon at its magnitude, plus `p_error` for primitives whose hit
+// points are less precise than that (see `HitRecord`). A ray starting there cannot
+// hit the surface it left again, which a fixed minimum hit distance does not ensure
+// in single precision builds.
+inline Point3 offset_ray_origin(const Point3 &p, real p_error, const Vec3 &n, const Vec3 &direction)
+{
+    real magnitude = fmax(fabs(p.x()), fmax(fabs(p.y()), fabs(p.z())));
+    real offset = (1 + magnitude) * 64 * std::numeric_limits<real>::epsilon() + p_error;
+    return dot(direction, n) < 0 ? p - offset * n : p + offset * n;
+}
+
 } // namespace raytracing
\ No newline at end of file
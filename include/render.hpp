@@ -0,0 +1,118 @@
+#pragma once
+
+#include "common.hpp"
+#include "hittable.hpp"
+#include "instance.hpp"
+#include "scene.hpp"
+#include "stats.hpp"
+#include "texture_loader.hpp"
+#include "tiles.hpp"
+#include "vec3.hpp"
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace raytracing {
+
+enum class Integrator {
+    Path,    // full path tracing (`ray_color`)
+    Normals  // shading normals of the first hit, for debugging geometry
+};
+
+enum class Accelerator {
+    Instances, // BVH over instances of shared per-geometry BVHs (see instance.hpp)
+    BVH,       // bounding volume hierarchy over the top-level objects
+    List       // linear scan of the top-level objects
+};
+
+struct RenderSettings {
+    int image_width = 200;
+    int samples_per_pixel = 0; // 0: use the scene's own sample count
+    int max_depth = 50;
+    int threads = 0;           // 0: one per hardware thread
+    int tile_size = 16;        // edge length of the square tiles handed to threads
+    TileOrder tile_order = TileOrder::Hilbert;
+    uint64_t seed = 0;
+    Integrator integrator = Integrator::Path;
+    Accelerator accelerator = Accelerator::Instances;
+    bool progress = true;      // report remaining tiles on stderr
+    bool record_cost = false;  // fill the framebuffer's cost channels
+    bool ray_differentials = false; // trace ray differentials for texture filtering, instead of cones
+
+    // NUMA placement. Pinned threads are spread over the nodes round-robin. Replicas
+    // give every node its own copy of the scene, built by `scene_builder`, which must
+    // reproduce the scene exactly (e.g. rebuild it from the same seed).
+    bool pin_threads = false;
+    bool replicate_scene = false;
+    std::function<bool(Scene&)> scene_builder;
+};
+
+struct Framebuffer {
+    int width = 0, height = 0;
+    std::vector<Color> pixels;
+
+    // Per-pixel cost channels, empty unless `RenderSettings::record_cost` is set.
+    std::vector<float> cycles; // cycle counter ticks spent on the pixel's samples
+    std::vector<float> steps;  // BVH nodes visited plus primitives tested (STATS builds only)
+
+    void resize(int w, int h)
+    {
+        width = w;
+        height = h;
+        pixels.assign(static_cast<size_t>(w) * h, Color(0, 0, 0));
+        cycles.clear();
+        steps.clear();
+    }
+
+    // Row 0 is the bottom scanline, matching the camera's `v` coordinate.
+    Color &at(int i, int j) { return pixels[static_cast<size_t>(j) * width + i]; }
+    const Color &at(int i, int j) const { return pixels[static_cast<size_t>(j) * width + i]; }
+};
+
+struct WorkerStats {
+    double busy_seconds = 0;  // rendering tiles
+    double idle_seconds = 0;  // waiting for the other threads to finish
+    uint64_t tiles = 0;
+    uint64_t steals = 0;      // tiles taken from other threads' queues
+};
+
+struct RenderStats {
+    double seconds = 0;
+    int samples_per_pixel = 0;
+    int threads = 0;
+    uint64_t samples = 0; // camera rays
+    uint64_t rays = 0;    // camera and scattered rays traced into the world
+    RenderCounters counters; // all zero unless built with STATS=1
+    double prepass_seconds = 0; // cost estimate for `TileOrder::Cost`, included in `seconds`
+    std::vector<WorkerStats> workers;
+    int numa_nodes = 1;
+    int scene_replicas = 0;
+    double replicate_seconds = 0; // building the replicas, not included in `seconds`
+    std::vector<TextureDecode> texture_decodes; // textures the scene registered with the loader
+    double texture_wait_seconds = 0; // waiting for them after the BVH was built, not included in `seconds`
+    InstanceStats instances; // all zero unless built with `Accelerator::Instances`
+};
+
+bool parse_integrator(const std::string &name, Integrator &integrator);
+bool parse_accelerator(const std::string &name, Accelerator &accelerator);
+
+// Traces a path starting with `r`; every ray traced into the world is added to `rays`.
+Color ray_color(const Ray &r, const Color &background, const Hittable &world, int depth, uint64_t &rays);
+
+// Renders `scene` into `framebuffer`, which is resized to the requested image size.
+// The accumulated (not yet averaged) sample sums are stored per pixel.
+RenderStats render(const Scene &scene, const RenderSettings &settings, Framebuffer &framebuffer);
+
+// Prints busy and idle time per thread and the resulting load imbalance.
+void write_worker_stats(std::ostream &out, const RenderStats &stats);
+
+// Prints how many instances share how many geometries, and the memory that saves over
+// copying the geometry for every instance.
+void write_instance_stats(std::ostream &out, const InstanceStats &stats);
+
+// Writes the framebuffer as a plain PPM (P3) image, top scanline first.
+void write_framebuffer(std::ostream &out, const Framebuffer &framebuffer, int samples_per_pixel);
+
+} // namespace raytracing
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "common.hpp"
+#include "camera.hpp"
+#include "hittable.hpp"
+#include "texture_program.hpp"
+#include "vec3.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace raytracing {
+
+// A renderable world together with the camera and background it was set up for.
+struct Scene {
+    HittableList world;
+    Color background;
+
+    Point3 lookfrom, lookat;
+    Vec3 vup = Vec3(0, 1, 0);
+    double vfov = 40.0;
+    double aperture = 0.0;
+    double dist_to_focus = 10.0;
+    double aspect_ratio = 3.0 / 2.0;
+
+    // Sample count the scene was tuned for; used unless overridden.
+    int samples_per_pixel = 1;
+
+    // Memory the world refers to without owning it, e.g. a mapped binary scene file.
+    std::shared_ptr<const void> storage;
+
+    Camera camera() const
+    {
+        return Camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
+    }
+};
+
+// Names of the built-in scenes, in the order they are listed by `--help`.
+const std::vector<std::string>& scene_names();
+
+// Builds the built-in scene called `name`. Returns false if there is no such scene.
+bool build_scene(const std::string &name, Scene &scene);
+
+// Bakes the noise textures of the scene into NoiseVolumes with the given voxel size,
+// one over the bounds of every object using them. Objects whose volume would be too
+// large keep the exact noise. Returns the number of volumes baked.
+int bake_noise_textures(Scene &scene, real voxel_size);
+
+// Replaces every chain of Translate, RotateY and Transform in the world by a single
+// Transform of the composed matrix (see transform.hpp). Returns the number of chains.
+int collapse_transforms(Scene &scene);
+
+// Replaces the textures of all materials in the scene by what they compile to (see
+// texture_program.hpp). Runs after `bake_noise_textures`, which needs the trees.
+TextureCompiler::Stats compile_textures(Scene &scene);
+
+} // namespace raytracing
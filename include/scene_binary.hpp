@@ -0,0 +1,100 @@
+#pragma once
+
+#include "scene.hpp"
+
+#include <cstdint>
+#include <string>
+
+namespace raytracing {
+
+// Binary scene container
+//
+// All sections are arrays of fixed-size, native-endian records, aligned to 64 bytes,
+// so a mapped file is used in place: primitives, their BVH nodes and image pixels are
+// never copied. Only the small texture, material and object tables are turned into
+// objects at load time. Textures read through the texture cache are stored as the path
+// of their tiled texture file and reopened.
+//
+//   header | strings | textures | materials | nodes | children | primitives | bvh nodes | blobs
+
+struct BinarySceneSection {
+    uint64_t offset; // in bytes from the start of the file
+    uint64_t size;   // in bytes
+};
+
+struct BinarySceneHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t primitive_size; // sizeof(Primitive) of the writer, guards against layout changes
+    uint32_t bvh_node_size;  // sizeof(PrimitiveBVHNode) of the writer, likewise
+    uint32_t reserved;
+
+    double lookfrom[3], lookat[3], vup[3];
+    double vfov, aperture, dist_to_focus, aspect_ratio;
+    double background[3];
+    int32_t samples_per_pixel;
+    uint32_t root;           // index of the node holding the whole world
+
+    BinarySceneSection strings;    // NUL-terminated strings, first one names the scene's source, then tiled texture paths
+    BinarySceneSection textures;   // BinaryTexture
+    BinarySceneSection materials;  // BinaryMaterial
+    BinarySceneSection nodes;      // BinaryNode, children always before their parents
+    BinarySceneSection children;   // uint32_t node indices referenced by list nodes
+    BinarySceneSection primitives; // Primitive
+    BinarySceneSection bvh_nodes;  // PrimitiveBVHNode
+    BinarySceneSection blobs;      // image mip pyramids, density grid samples
+};
+
+enum class BinaryTextureType : uint32_t { Solid, Checker, Noise, Image, TiledImage };
+
+struct BinaryTexture {
+    BinaryTextureType type;
+    uint32_t children[2];  // Checker: even and odd texture
+    uint32_t width, height; // Image: size in pixels (0 if the image failed to load)
+    uint32_t filter;        // Image, TiledImage: TextureFilter
+    uint32_t format;        // Image: TextureFormat of the pyramid
+    uint64_t blob;          // Image: offset of the tiled mip pyramid within the blob section,
+                            // TiledImage: offset of the tiled texture file's path within the strings
+    double color[3];        // Solid
+    double scale;           // Noise
+    uint64_t seed;          // Noise: seed of the Perlin tables
+};
+
+enum class BinaryMaterialType : uint32_t { Lambertian, Metal, Dielectric, DiffuseLight, Isotropic };
+
+struct BinaryMaterial {
+    BinaryMaterialType type;
+    uint32_t texture;       // Lambertian, DiffuseLight, Isotropic
+    double color[3];        // Metal: albedo
+    double value;           // Metal: fuzz, Dielectric: index of refraction
+};
+
+enum class BinaryNodeType : uint32_t {
+    Primitives, // index: first primitive, count, first BVH node, BVH node count
+    List,       // index: first entry in the children section, count
+    Translate,  // index: child; value: offset
+    RotateY,    // index: child; value: angle in degrees
+    Medium,     // index: boundary, albedo texture; value: density
+    Transform,  // index: child; value: the 3x4 object to world matrix, row by row
+    GridMedium  // index: albedo texture, samples per axis (3), GridLayout; value: bounds (min, max),
+                // density scale; blob: the samples, float32, x fastest
+};
+
+struct BinaryNode {
+    BinaryNodeType type;
+    uint32_t index[5];
+    double value[12];
+    uint64_t blob; // GridMedium: offset of the samples within the blob section
+};
+
+// Returns true if `path` starts with the binary scene magic.
+bool is_binary_scene(const std::string &path);
+
+// Maps a binary scene file and builds `scene` on top of the mapping.
+bool load_binary_scene(const std::string &path, Scene &scene);
+
+// Writes `scene` as a binary scene file. Returns false (after reporting the reason on
+// stderr) if the world contains objects the format cannot represent.
+bool save_binary_scene(const Scene &scene, const std::string &source, const std::string &path);
+
+} // namespace raytracing
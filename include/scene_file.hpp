@@ -0,0 +1,14 @@
+#pragma once
+
+#include "scene.hpp"
+
+#include <string>
+
+namespace raytracing {
+
+// Loads a text scene description (see `scenes/README.md` for the format) into `scene`.
+// Primitives are collected into PrimitiveArrays as they are read. Returns false and
+// reports the offending line on stderr if the file cannot be read or parsed.
+bool load_scene_file(const std::string &path, Scene &scene);
+
+} // namespace raytracing
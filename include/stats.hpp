@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+// Ray tracing statistics
+//
+// Builds with `make STATS=1` define RAYTRACING_STATS and count what the hot paths do
+// (BVH nodes visited, primitives tested, how paths end, ...). Every thread counts into
+// its own `thread_counters`, and `render` adds them up when its workers finish. In
+// normal builds the STATS_ macros expand to nothing and the counters stay zero.
+
+namespace raytracing {
+
+#ifdef RAYTRACING_STATS
+constexpr bool stats_enabled = true;
+#else
+constexpr bool stats_enabled = false;
+#endif
+
+enum StatPrimitive {
+    StatSphere,
+    StatMovingSphere,
+    StatRect,
+    StatBox,
+    StatMedium,
+    StatPrimitiveCount
+};
+
+enum StatMaterial {
+    StatLambertian,
+    StatMetal,
+    StatDielectric,
+    StatDiffuseLight,
+    StatIsotropic,
+    StatMaterialCount
+};
+
+struct RenderCounters {
+    uint64_t bvh_nodes = 0;       // BVHNode and PrimitiveArray nodes visited
+    uint64_t aabb_tests = 0;
+    uint64_t primitive_tests[StatPrimitiveCount] = {};
+    uint64_t primitive_hits[StatPrimitiveCount] = {};
+
+    uint64_t paths_escaped = 0;   // ended in the background
+    uint64_t paths_absorbed = 0;  // ended at an emitter or an absorbing scatter
+    uint64_t paths_truncated = 0; // ended at the depth limit
+
+    uint64_t scatter_calls[StatMaterialCount] = {};
+    uint64_t scatter_absorbed[StatMaterialCount] = {};
+
+    // Node visits plus primitive tests, the unit of the traversal heatmap.
+    uint64_t traversal_steps() const;
+
+    RenderCounters &operator+=(const RenderCounters &other);
+};
+
+inline thread_local RenderCounters thread_counters;
+
+#ifdef RAYTRACING_STATS
+#define STATS_INC(counter) (++::raytracing::thread_counters.counter)
+#else
+#define STATS_INC(counter) ((void)0)
+#endif
+
+// Prints the counters relative to the number of camera rays (`samples`) and of rays
+// traced in total (`rays`).
+void write_counters(std::ostream &out, const RenderCounters &counters, uint64_t samples, uint64_t rays);
+
+} // namespace raytracing
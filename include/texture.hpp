@@ -3,14 +3,23 @@
 #include "common.hpp"
 #include "color.hpp"
 #include "perlin.hpp"
+#include "ray.hpp"
 
+#include <cmath>
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace raytracing {
 
 class Texture {
     public:
-        virtual Color value(double u, double v, const Point3 &p) const = 0;
+        virtual Color value(real u, real v, const Point3 &p) const = 0;
+
+        // A lookup averaged over the footprint of a pixel given by `duv`, for textures
+        // that can filter. Others ignore the footprint.
+        virtual Color value(real u, real v, const Point3 &p, const UVDerivatives &duv) const { return value(u, v, p); }
 };
 
 class SolidColor : public Texture {
@@ -19,67 +28,236 @@ class SolidColor : public Texture {
         
         SolidColor(Color c) : color_value(c) {}
 
-        SolidColor(double red, double green, double blue)
+        SolidColor(real red, real green, real blue)
             : SolidColor(Color(red, green, blue)) 
         {}
 
-        virtual Color value(double u, double v, const Point3 &p) const override { return color_value; }
+        virtual Color value(real u, real v, const Point3 &p) const override { return color_value; }
+
+        Color color() const { return color_value; }
         
     private:
         Color color_value;
 };
 
+// A 3D checkerboard of cells pi/10 units wide (the sign of sin(10x) sin(10y) sin(10z)),
+// found from the parity of the cell indices. Children that are solid colors are read once
+// on construction, so a lookup of a checker of two colors makes no virtual calls.
 class CheckerTexture : public Texture {
     public:
-        CheckerTexture() {}
+        CheckerTexture() : folded(false) {}
         
         CheckerTexture(std::shared_ptr<Texture> _even, std::shared_ptr<Texture> _odd)
-            : even(_even), odd(_odd) 
-        {}
+            : even_texture(_even), odd_texture(_odd)
+        {
+            fold();
+        }
     
         CheckerTexture(Color c1, Color c2)
-            : even(std::make_shared<SolidColor>(c1)), odd(std::make_shared<SolidColor>(c2))
-        {}
+            : even_texture(std::make_shared<SolidColor>(c1)), odd_texture(std::make_shared<SolidColor>(c2))
+        {
+            fold();
+        }
 
-        virtual Color value(double u, double v, const Point3 &p) const override;
+        virtual Color value(real u, real v, const Point3 &p) const override { return value(u, v, p, UVDerivatives()); }
+        virtual Color value(real u, real v, const Point3 &p, const UVDerivatives &duv) const override;
 
-    public:
-        std::shared_ptr<Texture> even;
-        std::shared_ptr<Texture> odd;
+        // Whether `p` lies in an odd cell.
+        static bool odd_cell(const Point3 &p)
+        {
+            const real cells_per_unit = 10 / pi;
+            auto cell = [&](real x) { return static_cast<long long>(std::floor(x * cells_per_unit)); };
+            return (cell(p.x()) + cell(p.y()) + cell(p.z())) & 1;
+        }
+
+        // Fixed at construction, which folds them.
+        const std::shared_ptr<Texture> &even() const { return even_texture; }
+        const std::shared_ptr<Texture> &odd() const { return odd_texture; }
+
+    private:
+        void fold();
+
+        std::shared_ptr<Texture> even_texture;
+        std::shared_ptr<Texture> odd_texture;
+
+        bool folded; // both children are solid colors
+        Color even_color, odd_color;
 };
 
 class NoiseTexture : public Texture {
     public:
         NoiseTexture() {}
-        NoiseTexture(double sc) : scale(sc) {}
+        NoiseTexture(real sc) : scale(sc) {}
+        NoiseTexture(real sc, uint64_t seed) : noise(seed), scale(sc) {}
 
-        virtual Color value(double u, double v, const Point3 &p) const override 
+        virtual Color value(real u, real v, const Point3 &p) const override 
         { 
-            return Color(1,1,1) * 0.5 * (1 + sin(scale*p.z() + 10*noise.turb(p))); 
+            return Color(1,1,1) * 0.5 * (1 + sin(scale*p.z() + 10*turb(p))); 
+        }
+
+        // Replaces `noise.turb` within `bounds` by a NoiseVolume with the given voxel size.
+        void bake(const AABB &bounds, real voxel_size)
+        {
+            baked.push_back(std::make_shared<NoiseVolume>(noise, bounds, voxel_size));
         }
     
     public:
         Perlin noise;
-        double scale;
+        real scale;
+        std::vector<std::shared_ptr<const NoiseVolume>> baked;
+
+    private:
+        real turb(const Point3 &p) const
+        {
+            for(const auto &volume : baked)
+                if(volume->contains(p))
+                    return volume->turb(p);
+            return noise.turb(p);
+        }
 };
 
-class ImageTexture : public Texture {
+enum class TextureFilter : uint32_t {
+    Nearest,   // closest texel of the full resolution image
+    Bilinear,  // four texels of the mip level closest to the footprint
+    Trilinear  // bilinear lookups in the two mip levels around the footprint, blended
+};
+
+bool parse_texture_filter(const std::string &name, TextureFilter &filter);
+
+// How ImageTexture stores its texels. All formats hold linear color: 8-bit texels are
+// sRGB encoded and decoded through a 256-entry table on every read, half and float texels
+// need no decoding but take two and four times the memory.
+enum class TextureFormat : uint32_t {
+    SRGB8,
+    Half,
+    Float
+};
+
+bool parse_texture_format(const std::string &name, TextureFormat &format);
+
+class TiledTexture;
+
+// An image stored as a mip pyramid (full resolution down to 1x1, each level a 2x2 box
+// filter of the one above). Every level is cut into 8x8 texel tiles of 192 bytes (in
+// 8-bit formats) that are stored one after the other, so a lookup and its neighbours
+// touch at most a few cache lines, however large the image is. Levels are chosen by the
+// footprint of the pixel, so distant images read small levels.
+//
+// A pyramid owns its texels, or reads them from memory it does not own (e.g. a mapped
+// scene file) or through the texture cache. It cannot be copied; ImageTextures share it.
+class ImagePyramid {
     public:
         const static int bytes_per_pixel = 0x03;
+        const static int tile_size = 8;
+        const static int tile_bytes = tile_size * tile_size * bytes_per_pixel;
 
-        ImageTexture()
-            : data(nullptr), width(0), height(0), bytes_per_scanline(0)
-        {}
+        // Bytes of one texel in `format`.
+        static constexpr int texel_bytes(TextureFormat format)
+        {
+            return format == TextureFormat::SRGB8 ? bytes_per_pixel : format == TextureFormat::Half ? 2 * bytes_per_pixel : 4 * bytes_per_pixel;
+        }
+
+        // Without texels until `load` is called, e.g. by the TextureLoader.
+        explicit ImagePyramid(TextureFormat _format = TextureFormat::SRGB8) : width(0), height(0), format(_format), data(nullptr) {}
+
+        // Uses an externally owned pyramid of `pyramid_size(w, h, format)` bytes without
+        // copying.
+        ImagePyramid(const unsigned char* pyramid, int w, int h, TextureFormat format = TextureFormat::SRGB8);
+
+        // Reads the pyramid tile by tile through the texture cache (see texture_cache.hpp).
+        // Tiled textures are always 8-bit sRGB.
+        explicit ImagePyramid(std::shared_ptr<const TiledTexture> tiles);
+
+        ImagePyramid(const ImagePyramid&) = delete;
+        ImagePyramid& operator=(const ImagePyramid&) = delete;
+
+        // Decodes an image file, or an encoded image in memory, into this (empty) pyramid.
+        // Must not run concurrently with lookups.
+        bool load(const char* filename);
+        bool load(const unsigned char* encoded, size_t size, const char* name);
+
+        Color value(TextureFilter filter, real u, real v, const UVDerivatives &duv) const;
 
-        ImageTexture(const char* filename);
-        ~ImageTexture() { delete data; }
+        // The tiled mip pyramid, `pyramid_size(image_width(), image_height(), texel_format())`
+        // bytes, or null for cached textures.
+        const unsigned char* pixels() const { return data; }
+        const std::shared_ptr<const TiledTexture> &tiled() const { return tiles; }
+        int image_width() const { return width; }
+        int image_height() const { return height; }
+        int levels() const { return static_cast<int>(mip.size()); }
+        TextureFormat texel_format() const { return format; }
+
+        static size_t pyramid_size(int w, int h, TextureFormat format = TextureFormat::SRGB8);
+
+    private:
+        struct Level {
+            int width, height;
+            int tiles_x;   // tiles per row
+            size_t offset; // in bytes from the start of the pyramid
+        };
+        // Tiles of all formats are whole multiples of an 8-bit one.
+        struct alignas(64) Tile { unsigned char texels[tile_bytes]; };
+
+        static std::vector<Level> layout(int w, int h, TextureFormat format);
+
+        // Cached textures copy the texel to `scratch` and return that.
+        template<TextureFormat F>
+        const unsigned char* texel(const Level &level, int x, int y, unsigned char* scratch) const
+        {
+            constexpr int size = texel_bytes(F);
+            size_t tile = static_cast<size_t>(y / tile_size) * level.tiles_x + x / tile_size;
+            int within = (y % tile_size) * tile_size + x % tile_size;
+            if(data)
+                return data + level.offset + tile * (tile_size * tile_size * size) + within * size;
+            read_tile(static_cast<uint32_t>(level.offset / tile_bytes + tile), within * bytes_per_pixel, scratch);
+            return scratch;
+        }
+        void read_tile(uint32_t tile, int offset, unsigned char* texel) const;
 
-        virtual Color value(double u, double v, const Vec3 &p) const override;
+        bool build(unsigned char* image, const char* name);
+        template<TextureFormat F> Color texel_color(const Level &level, int x, int y) const;
+        template<TextureFormat F> void store(const Level &level, int x, int y, const Color &color);
+        template<TextureFormat F> void build_levels(const unsigned char* image);
+        template<TextureFormat F> Color bilinear(int level, real u, real v) const;
+        template<TextureFormat F> Color lookup(TextureFilter filter, real u, real v, const UVDerivatives &duv) const;
 
     private:
-        unsigned char *data;
         int width, height;
-        int bytes_per_scanline;
+        TextureFormat format;
+        std::vector<Level> mip;
+        std::vector<Tile> storage; // empty unless the pyramid owns its texels
+        const unsigned char* data;
+        std::shared_ptr<const TiledTexture> tiles;
+};
+
+// A filtered view of an ImagePyramid. Textures using the same image share one pyramid
+// (see `load_image_texture`), whatever their filters.
+class ImageTexture : public Texture {
+    public:
+        ImageTexture() : filter(TextureFilter::Trilinear), pyramid(std::make_shared<ImagePyramid>()) {}
+
+        ImageTexture(std::shared_ptr<const ImagePyramid> _pyramid, TextureFilter _filter = TextureFilter::Trilinear)
+            : filter(_filter), pyramid(std::move(_pyramid)) {}
+
+        // Decodes the image into a pyramid of its own.
+        ImageTexture(const char* filename, TextureFilter filter = TextureFilter::Trilinear, TextureFormat format = TextureFormat::SRGB8);
+
+        virtual Color value(real u, real v, const Point3 &p) const override { return value(u, v, p, UVDerivatives()); }
+        virtual Color value(real u, real v, const Point3 &p, const UVDerivatives &duv) const override
+        {
+            return pyramid->value(filter, u, v, duv);
+        }
+
+        const std::shared_ptr<const ImagePyramid> &image() const { return pyramid; }
+        const unsigned char* pixels() const { return pyramid->pixels(); }
+        int image_width() const { return pyramid->image_width(); }
+        int image_height() const { return pyramid->image_height(); }
+
+    public:
+        TextureFilter filter;
+
+    private:
+        std::shared_ptr<const ImagePyramid> pyramid;
 };
 
-} // namespace raytracing
\ No newline at end of file
+} // namespace raytracing
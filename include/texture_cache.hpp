@@ -0,0 +1,158 @@
+#pragma once
+
+#include "texture.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Out-of-core image textures
+//
+// A tiled texture file holds an image already converted to the ImageTexture mip pyramid
+// (see `write_tiled_texture`). Such files are never loaded as a whole: ImageTexture reads
+// single tiles through the process-wide TextureCache, which pages them in on first access
+// into a fixed budget of slots, shared by all textures and render threads, and evicts the
+// least recently used ones (CLOCK) when it is full.
+//
+// Lookups of resident tiles take no locks. Every slot is guarded by a sequence counter (a
+// seqlock) that is odd while the slot is being refilled; readers copy the texels they
+// need, check that the counter did not move and retry otherwise. Misses take a mutex to
+// claim a slot and mark the tile as being loaded, then read the tile without it, so that
+// threads missing different tiles wait on their disk reads in parallel; threads missing a
+// tile that is being loaded wait for it.
+//
+//   header | mip pyramid, as in ImageTexture (aligned to 64 bytes)
+
+namespace raytracing {
+
+struct TiledTextureHeader {
+    char magic[8];           // "RTTILES\0"
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t tile_bytes;     // ImagePyramid::tile_bytes of the writer
+    uint64_t pyramid_offset; // in bytes from the start of the file
+    uint64_t pyramid_size;   // in bytes
+};
+
+bool is_tiled_texture(const std::string &path);
+
+// Converts the image at `image_path` into a tiled texture file.
+bool write_tiled_texture(const std::string &image_path, const std::string &path);
+
+// The path a tiled version of the image at `image_path` is looked for at: the image's
+// with the extension replaced by `.rtt`.
+std::string tiled_texture_path(const std::string &image_path);
+
+class TextureCache;
+
+// An open tiled texture file and its page table: the cache slot + 1 of every tile, 0, or
+// `TextureCache::loading`.
+class TiledTexture {
+    public:
+        ~TiledTexture();
+
+        TiledTexture(const TiledTexture&) = delete;
+        TiledTexture& operator=(const TiledTexture&) = delete;
+
+        int width() const { return header.width; }
+        int height() const { return header.height; }
+        const std::string &path() const { return file_path; }
+
+        // Copies the texel at byte `offset` of pyramid tile `tile` to `texel`.
+        void read(uint32_t tile, int offset, unsigned char texel[ImagePyramid::bytes_per_pixel]) const;
+
+    private:
+        friend class TextureCache;
+
+        TiledTexture(TextureCache &cache, uint32_t id, const std::string &path, int fd, const TiledTextureHeader &header);
+
+        TextureCache &cache;
+        uint32_t id;
+        std::string file_path;
+        int fd;
+        TiledTextureHeader header;
+        uint32_t tile_count;
+        std::unique_ptr<std::atomic<uint32_t>[]> pages;
+        mutable std::atomic<bool> read_failed;
+};
+
+class TextureCache {
+    public:
+        struct Stats {
+            uint64_t lookups = 0;   // texel reads
+            uint64_t misses = 0;    // of them that paged a tile in
+            uint64_t evictions = 0;
+            size_t resident_bytes = 0; // slots in use and page tables
+            size_t capacity_bytes = 0;
+        };
+
+        explicit TextureCache(size_t capacity_bytes);
+
+        TextureCache(const TextureCache&) = delete;
+        TextureCache& operator=(const TextureCache&) = delete;
+
+        // Page table entry of a tile that a thread is reading in.
+        static const uint32_t loading = UINT32_MAX;
+
+        // Changes the budget. Only allowed before the first texture is opened.
+        bool set_capacity(size_t capacity_bytes);
+
+        std::shared_ptr<TiledTexture> open(const std::string &path);
+
+        Stats stats() const;
+
+    private:
+        friend class TiledTexture;
+
+        struct alignas(64) Slot {
+            std::atomic<uint32_t> sequence{0}; // odd while the slot is refilled
+            std::atomic<bool> referenced{false};
+            std::atomic<uint64_t> key{0};      // texture id << 32 | tile, 0 if empty
+            unsigned char texels[ImagePyramid::tile_bytes];
+        };
+
+        struct alignas(64) Counter {
+            std::atomic<uint64_t> value{0};
+        };
+        static const int counter_stripes = 16;
+
+        // Slots are allocated in chunks as the cache fills, so an unused budget costs
+        // no memory.
+        static const uint32_t chunk_slots = 1024;
+        // Every render thread may hold a few tiles at once.
+        static const uint32_t min_slots = 256;
+
+        Slot &slot(uint32_t index) const { return chunks[index / chunk_slots][index % chunk_slots]; }
+
+        // Pages `tile` of `texture` in and returns its slot + 1.
+        uint32_t fault(const TiledTexture &texture, uint32_t tile);
+        void release(TiledTexture &texture);
+        void count_lookup();
+
+        uint32_t slot_count;
+        std::unique_ptr<std::unique_ptr<Slot[]>[]> chunks;
+
+        mutable std::mutex mutex; // guards everything below and slot claims
+        std::condition_variable loaded; // a tile was read in
+        uint32_t clock_hand = 0;
+        uint32_t used_slots = 0;
+        uint32_t next_id = 1;
+        std::vector<TiledTexture*> textures; // by id - 1, null once closed
+        size_t page_table_bytes = 0;
+        uint64_t misses = 0, evictions = 0;
+
+        Counter lookups[counter_stripes];
+};
+
+// The cache all tiled textures are read through, 256 MiB unless changed before use.
+TextureCache &texture_cache();
+
+// Writes the cache's lookups, hit rate and resident memory as one line.
+void write_texture_cache_stats(std::ostream &out, const TextureCache::Stats &stats);
+
+} // namespace raytracing
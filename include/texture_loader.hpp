@@ -0,0 +1,112 @@
+#pragma once
+
+#include "texture.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Image texture registry and deferred decoding
+//
+// Scene construction only registers image textures: `load_image_texture` returns an
+// ImageTexture at once, whose pyramid the process-wide TextureLoader decodes the image
+// into (and builds the mips of) on a pool of threads. `render` builds the BVH in the
+// meantime and waits for the loader before the first ray is traced; anything else that
+// reads pixels (e.g. `save_binary_scene`) must call `texture_loader().wait()` first.
+//
+// Every image is decoded once per texel format: textures of the same file, or of files
+// with the same contents, share one pyramid for as long as any of them is alive. Loads
+// under a TextureScope share pyramids only with each other and decode on their own
+// thread, which gives the scene replicas of NUMA nodes textures in their node's memory.
+
+namespace raytracing {
+
+struct TextureDecode {
+    std::string path;
+    int width, height;  // 0 if the image could not be decoded
+    double seconds;     // decoding and building the mip pyramid
+};
+
+// Pyramids by canonical path and by a hash of the file's contents.
+struct TextureRegistry {
+    std::map<std::pair<std::string, TextureFormat>, std::weak_ptr<const ImagePyramid>> by_path;
+    std::map<std::pair<uint64_t, TextureFormat>, std::weak_ptr<const ImagePyramid>> by_content;
+
+    // Drops the entries of pyramids nobody holds anymore.
+    void prune();
+};
+
+// While alive, images the creating thread loads get pyramids apart from the loader's,
+// decoded at once on that thread. Scopes nest; the innermost one applies.
+class TextureScope {
+    public:
+        TextureScope();
+        ~TextureScope();
+
+        TextureScope(const TextureScope&) = delete;
+        TextureScope& operator=(const TextureScope&) = delete;
+
+    private:
+        friend class TextureLoader;
+
+        TextureRegistry registry;
+        TextureScope* outer;
+};
+
+class TextureLoader {
+    public:
+        // `threads` 0: one per hardware thread.
+        explicit TextureLoader(int threads = 0);
+        ~TextureLoader();
+
+        TextureLoader(const TextureLoader&) = delete;
+        TextureLoader& operator=(const TextureLoader&) = delete;
+
+        // Returns a texture of the image at `path`: through the texture cache if `path` is
+        // a tiled texture file or an 8-bit texture is asked for and a tiled version of it
+        // exists (see texture_cache.hpp), otherwise with a pyramid that is decoded later.
+        std::shared_ptr<ImageTexture> load(const std::string &path, TextureFilter filter, TextureFormat format = TextureFormat::SRGB8);
+
+        // Blocks until all textures requested so far are decoded and returns the ones
+        // decoded since the last call, in the order they finished.
+        std::vector<TextureDecode> wait();
+
+    private:
+        struct Job {
+            std::shared_ptr<ImagePyramid> pyramid;
+            std::string path;
+            std::vector<unsigned char> encoded;
+        };
+
+        void work();
+
+        int max_threads;
+        std::mutex mutex;
+        std::condition_variable idle;
+        std::deque<Job> queue;
+        int active = 0; // workers that have not yet found the queue empty
+        std::vector<std::thread> threads;
+        std::vector<TextureDecode> finished;
+
+        TextureRegistry registry;
+};
+
+// The loader `load_image_texture` hands images to.
+TextureLoader &texture_loader();
+
+// `texture_loader().load(path, filter, format)`.
+std::shared_ptr<ImageTexture> load_image_texture(const std::string &path, TextureFilter filter = TextureFilter::Trilinear,
+                                                 TextureFormat format = TextureFormat::SRGB8);
+
+// Writes one line per decoded texture.
+void write_texture_decodes(std::ostream &out, const std::vector<TextureDecode> &decodes);
+
+} // namespace raytracing
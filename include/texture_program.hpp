@@ -0,0 +1,100 @@
+#pragma once
+
+#include "texture.hpp"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Compiled texture graphs
+//
+// Textures are built as trees of shared pointers (a checker of two colors, of a color and
+// an image, ...) and a lookup makes a virtual call per node on its way down. Before the
+// render, `compile_textures` (see scene.hpp) turns every such tree into a TextureProgram:
+// a flat array of instructions that a lookup steps through in one loop, calling out only
+// for the leaves that do real work (noise, images, unknown textures).
+//
+// While compiling:
+//   - identical subtrees (equal colors, images with the same pyramid and filter, checkers
+//     of identical children) become one instruction that all their parents jump to,
+//   - checkers whose children are equal are replaced by the child, and checkers below a
+//     checker by the child on the same side, since all checkers share their cells,
+//   - trees that fold down to a single leaf are replaced by that leaf, not a program.
+
+namespace raytracing {
+
+// One shading point of a batch lookup.
+struct TextureQuery {
+    real u, v;
+    Point3 p;
+    UVDerivatives duv;
+};
+
+class TextureProgram : public Texture {
+    public:
+        enum class Op : uint32_t {
+            Constant, // `color`
+            Checker,  // continues at `even` or `odd`
+            Noise,    // NoiseTexture `texture`
+            Image,    // `pyramid` with `filter`
+            Call      // any other `texture`, through its virtual `value`
+        };
+
+        struct Instruction {
+            Op op;
+            TextureFilter filter;
+            uint32_t even, odd;
+            Color color;
+            const Texture* texture;
+            const ImagePyramid* pyramid;
+        };
+
+        virtual Color value(real u, real v, const Point3 &p) const override { return value(u, v, p, UVDerivatives()); }
+        virtual Color value(real u, real v, const Point3 &p, const UVDerivatives &duv) const override;
+
+        // Looks up `count` points at once: every instruction sorts the points that reach it
+        // to its children, and every leaf handles all of its points in one loop.
+        void value(const TextureQuery* queries, size_t count, Color* colors) const;
+
+        const std::vector<Instruction> &instructions() const { return code; }
+
+    private:
+        friend class TextureCompiler;
+
+        Color leaf(const Instruction &instruction, real u, real v, const Point3 &p, const UVDerivatives &duv) const;
+
+        std::vector<Instruction> code; // children before their parents, the root last
+        std::vector<std::shared_ptr<Texture>> leaves; // keeps the leaves' textures alive
+};
+
+class TextureCompiler {
+    public:
+        struct Stats {
+            int programs = 0;     // textures replaced by a program
+            int folded = 0;       // textures replaced by one of their leaves
+            int nodes = 0;        // texture nodes of the trees compiled
+            int instructions = 0; // in all programs
+        };
+
+        // Returns the program `texture` compiles to, or the texture that replaces it if the
+        // tree folds down to a single leaf. Textures that are compiled again, e.g. through
+        // another material, return the same result.
+        std::shared_ptr<Texture> compile(const std::shared_ptr<Texture> &texture);
+
+        const Stats &stats() const { return compile_stats; }
+
+    private:
+        // The side of the checkers above a node that the lookup came from, if any.
+        enum class Side { Both, Even, Odd };
+
+        // Appends the instructions of `texture` unless they are there already and returns
+        // the index of its root instruction.
+        uint32_t emit(TextureProgram &program, const std::shared_ptr<Texture> &texture, Side side);
+        uint32_t add(TextureProgram &program, const TextureProgram::Instruction &instruction, const std::shared_ptr<Texture> &owner);
+
+        std::map<const Texture*, std::shared_ptr<Texture>> compiled;
+        Stats compile_stats;
+};
+
+} // namespace raytracing
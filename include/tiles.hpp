@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace raytracing {
+
+enum class TileOrder {
+    Scanline, // row by row, top to bottom
+    Morton,   // Z-order curve
+    Hilbert,  // Hilbert curve, every tile is adjacent to the one before it
+    Cost      // most expensive first, as estimated by a low sample count prepass
+};
+
+bool parse_tile_order(const std::string &name, TileOrder &order);
+
+struct Tile {
+    int x0, y0, x1, y1; // pixel range [x0,x1) x [y0,y1), row 0 at the bottom
+};
+
+// Cuts a `width` x `height` image into tiles of at most `size` x `size` pixels, in
+// scanline order starting at the top left.
+std::vector<Tile> make_tiles(int width, int height, int size);
+
+// Returns tile indices in the given spatial order. `columns` is the number of tiles
+// per row of the scanline-ordered `make_tiles` result. (Cost order is a sort of
+// estimated costs and is done by the caller.)
+std::vector<uint32_t> spatial_tile_order(size_t count, int columns, TileOrder order);
+
+// Work-stealing scheduler over a fixed set of task indices
+//
+// Every worker owns a queue. A worker takes tasks from the front of its own queue and,
+// once that runs dry, steals from the back of the others'. Tasks are coarse (whole
+// tiles), so a mutex per queue is cheap next to the work it hands out.
+class TileScheduler {
+    public:
+        // `contiguous` deals each worker one run of consecutive tasks (keeping the
+        // locality of a space-filling curve); otherwise tasks are dealt round-robin, so
+        // every worker starts with a share of the first (e.g. most expensive) tasks.
+        TileScheduler(const std::vector<uint32_t> &tasks, int workers, bool contiguous);
+
+        bool next(int worker, uint32_t &task);
+
+        uint64_t steals(int worker) const { return queues[worker]->steals; }
+
+    private:
+        struct alignas(64) Queue {
+            std::mutex mutex;
+            std::deque<uint32_t> tasks;
+            uint64_t steals = 0; // tasks this worker took from others
+        };
+        std::vector<std::unique_ptr<Queue>> queues;
+};
+
+} // namespace raytracing
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+
+namespace raytracing {
+
+// CPUs grouped by NUMA node, read from /sys/devices/system/node. Only CPUs this process
+// may run on are listed. Without NUMA information all of them form a single node.
+struct CpuTopology {
+    std::vector<std::vector<int>> nodes;
+
+    int cpu_count() const;
+
+    // Spreads threads over the nodes round-robin, then over the CPUs of each node:
+    // thread 0 goes to node 0, thread 1 to node 1, ... Returns -1 if there are no CPUs.
+    int node_of_thread(int thread) const;
+    int cpu_of_thread(int thread) const;
+};
+
+const CpuTopology &cpu_topology();
+
+// Restricts the calling thread to a single CPU. Returns false if the system refused.
+bool pin_current_thread(int cpu);
+
+} // namespace raytracing
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "common.hpp"
+#include "aabb.hpp"
+#include "affine.hpp"
+#include "hittable.hpp"
+
+#include <memory>
+
+// General transforms
+//
+// A Transform places its child wherever an affine transform takes it: rays go into the
+// child's space through the inverse matrix, and hits come back through the matrix, with
+// normals through the inverse transpose. A chain of Translate and RotateY costs a virtual
+// call and a ray transform per link; `collapse_transforms` (see scene.hpp) composes every
+// chain into a single Transform once the scene is built.
+
+namespace raytracing {
+
+// If `object` is a Translate, RotateY or Transform, sets `to_world` to what it does to
+// its child and returns the child. Returns null for any other object.
+std::shared_ptr<Hittable> transform_child(const std::shared_ptr<Hittable> &object, Affine &to_world);
+
+// A box around `object` transformed by `to_world`, from the bounds of its parts: spheres
+// are bounded exactly and the top levels of BVHs node by node. That is tighter than the
+// object's own box transformed, which grows with every rotation.
+bool transformed_bounds(const Hittable &object, const Affine &to_world, double time0, double time1, AABB &output_box);
+
+class Transform : public Hittable {
+    public:
+        // `to_world` takes the child's space to the world and must be invertible.
+        Transform(std::shared_ptr<Hittable> p, const Affine &to_world);
+
+        virtual bool hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const override;
+        virtual bool bounding_box(double time0, double time1, AABB &output_box) const override
+        { output_box = bbox; return hasbox; }
+        virtual bool interval(const Ray &r, real &t_enter, real &t_exit) const override;
+
+    public:
+        std::shared_ptr<Hittable> ptr;
+        Affine to_world;
+        Affine to_object;
+        bool hasbox;
+        AABB bbox;
+};
+
+} // namespace raytracing
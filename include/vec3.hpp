@@ -5,20 +5,25 @@
 
 #include <common.hpp>
 
+#ifdef RAYTRACING_SIMD
+#include <vec3_simd.hpp>
+#endif
+
 namespace raytracing {
 
+#ifndef RAYTRACING_SIMD
 class Vec3 {
     public:
         Vec3() : e{0, 0, 0} {}
-        Vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+        Vec3(real e0, real e1, real e2) : e{e0, e1, e2} {}
 
-        double x() const { return e[0]; }
-        double y() const { return e[1]; }
-        double z() const { return e[2]; }
+        real x() const { return e[0]; }
+        real y() const { return e[1]; }
+        real z() const { return e[2]; }
 
         Vec3 operator-() const { return Vec3(-e[0], -e[1], -e[2]); }
-        double operator[](int i) const { return e[i]; }
-        double& operator[](int i) { return e[i]; }
+        real operator[](int i) const { return e[i]; }
+        real& operator[](int i) { return e[i]; }
 
         Vec3& operator+=(const Vec3 &v)
         {
@@ -28,7 +33,7 @@ class Vec3 {
             return *this;
         }
 
-        Vec3& operator*=(const double t)
+        Vec3& operator*=(const real t)
         {
             e[0] *= t;
             e[1] *= t;
@@ -36,17 +41,17 @@ class Vec3 {
             return *this;
         }
 
-        Vec3& operator/=(const double t)
+        Vec3& operator/=(const real t)
         {
             return *this *= 1 / t;
         }
 
-        double length() const
+        real length() const
         {
             return std::sqrt(length_squared());
         }
 
-        double length_squared() const {
+        real length_squared() const {
             return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
         }
 
@@ -59,7 +64,7 @@ class Vec3 {
             );
         }
 
-        inline static Vec3 random(double min, double max)
+        inline static Vec3 random(real min, real max)
         {
             return Vec3(
                 random_double(min, max),
@@ -71,20 +76,11 @@ class Vec3 {
         bool near_zero() const;
     
     public:
-        double e[3];
+        real e[3];
 };
 
-// type aliases for Vec3
-using Point3 = Vec3; // 3D point
-using Color = Vec3;  // RGB color
-
 // Vec3 utility functions
 
-inline std::ostream& operator<<(std::ostream &out, const Vec3 &v) 
-{
-    return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
-}
-
 inline Vec3 operator+(const Vec3 &u, const Vec3 &v) 
 {
     return Vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
@@ -100,22 +96,22 @@ inline Vec3 operator*(const Vec3 &u, const Vec3 &v)
     return Vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline Vec3 operator*(double t, const Vec3 &v) 
+inline Vec3 operator*(real t, const Vec3 &v) 
 {
     return Vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
 }
 
-inline Vec3 operator*(const Vec3 &v, double t) 
+inline Vec3 operator*(const Vec3 &v, real t) 
 {
     return t * v;
 }
 
-inline Vec3 operator/(Vec3 v, double t) 
+inline Vec3 operator/(Vec3 v, real t) 
 {
     return (1/t) * v;
 }
 
-inline double dot(const Vec3 &u, const Vec3 &v) 
+inline real dot(const Vec3 &u, const Vec3 &v) 
 {
     return u.e[0] * v.e[0]
          + u.e[1] * v.e[1]
@@ -139,14 +135,24 @@ inline Vec3 reflect(const Vec3 &v, const Vec3 &n)
     return v - 2 * dot(v, n) * n;
 }
 
-inline Vec3 refract(const Vec3 &uv, const Vec3 &n, double etai_over_etat)
+inline Vec3 refract(const Vec3 &uv, const Vec3 &n, real etai_over_etat)
 {
     using namespace std;
-    auto cos_theta = fmin(dot(-uv, n), 1.0);
+    auto cos_theta = fmin(dot(-uv, n), real(1));
     Vec3 r_out_perp = etai_over_etat * (uv + cos_theta * n);
-    Vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
+    Vec3 r_out_parallel = -sqrt(fabs(1 - r_out_perp.length_squared())) * n;
     return r_out_perp + r_out_parallel;
 }
+#endif
+
+// type aliases for Vec3
+using Point3 = Vec3; // 3D point
+using Color = Vec3;  // RGB color
+
+inline std::ostream& operator<<(std::ostream &out, const Vec3 &v) 
+{
+    return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
+}
 
 Vec3 random_in_unit_sphere();
 Vec3 random_unit_vector();
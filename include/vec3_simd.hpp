@@ -0,0 +1,220 @@
+#pragma once
+
+#include <cmath>
+
+#include <common.hpp>
+
+#include <immintrin.h>
+
+// SIMD Vec3
+//
+// Included by vec3.hpp in `make SIMD=1` builds instead of the scalar Vec3, with the same
+// public interface. A vector is one register of four lanes (x, y, z and an unused fourth
+// lane that is always zero): an SSE register of floats in `PRECISION=float` builds, an
+// AVX register of doubles otherwise, so vectors are 16- or 32-byte aligned. Needs AVX2
+// and FMA.
+
+namespace raytracing {
+
+namespace simd {
+
+#ifdef RAYTRACING_FLOAT
+using lanes = __m128;
+
+inline lanes zero() { return _mm_setzero_ps(); }
+inline lanes set(float x, float y, float z) { return _mm_set_ps(0, z, y, x); }
+inline lanes splat(float t) { return _mm_set1_ps(t); }
+inline float first(lanes a) { return _mm_cvtss_f32(a); }
+
+inline lanes add(lanes a, lanes b) { return _mm_add_ps(a, b); }
+inline lanes sub(lanes a, lanes b) { return _mm_sub_ps(a, b); }
+inline lanes mul(lanes a, lanes b) { return _mm_mul_ps(a, b); }
+inline lanes div(lanes a, lanes b) { return _mm_div_ps(a, b); }
+inline lanes min(lanes a, lanes b) { return _mm_min_ps(a, b); }
+inline lanes max(lanes a, lanes b) { return _mm_max_ps(a, b); }
+inline lanes neg(lanes a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+inline lanes fmadd(lanes a, lanes b, lanes c) { return _mm_fmadd_ps(a, b, c); }   // a * b + c
+inline lanes fmsub(lanes a, lanes b, lanes c) { return _mm_fmsub_ps(a, b, c); }   // a * b - c
+inline lanes fnmadd(lanes a, lanes b, lanes c) { return _mm_fnmadd_ps(a, b, c); } // c - a * b
+
+// Dot product of the first three lanes, in all four.
+inline lanes dot(lanes a, lanes b) { return _mm_dp_ps(a, b, 0x7f); }
+
+// (y, z, x, w)
+inline lanes yzx(lanes a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)); }
+
+// Estimate refined by one Newton-Raphson step, within a few ulp of 1 / sqrt(a).
+inline lanes rsqrt(lanes a)
+{
+    lanes y = _mm_rsqrt_ps(a);
+    lanes half_a_yy = mul(mul(splat(0.5f), a), mul(y, y));
+    return mul(y, sub(splat(1.5f), half_a_yy));
+}
+#else
+using lanes = __m256d;
+
+inline lanes zero() { return _mm256_setzero_pd(); }
+inline lanes set(double x, double y, double z) { return _mm256_set_pd(0, z, y, x); }
+inline lanes splat(double t) { return _mm256_set1_pd(t); }
+inline double first(lanes a) { return _mm256_cvtsd_f64(a); }
+
+inline lanes add(lanes a, lanes b) { return _mm256_add_pd(a, b); }
+inline lanes sub(lanes a, lanes b) { return _mm256_sub_pd(a, b); }
+inline lanes mul(lanes a, lanes b) { return _mm256_mul_pd(a, b); }
+inline lanes div(lanes a, lanes b) { return _mm256_div_pd(a, b); }
+inline lanes min(lanes a, lanes b) { return _mm256_min_pd(a, b); }
+inline lanes max(lanes a, lanes b) { return _mm256_max_pd(a, b); }
+inline lanes neg(lanes a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+inline lanes fmadd(lanes a, lanes b, lanes c) { return _mm256_fmadd_pd(a, b, c); }   // a * b + c
+inline lanes fmsub(lanes a, lanes b, lanes c) { return _mm256_fmsub_pd(a, b, c); }   // a * b - c
+inline lanes fnmadd(lanes a, lanes b, lanes c) { return _mm256_fnmadd_pd(a, b, c); } // c - a * b
+
+// Dot product of the first three lanes, in all four.
+inline lanes dot(lanes a, lanes b)
+{
+    lanes m = mul(a, b);
+    lanes pairs = add(m, _mm256_permute4x64_pd(m, _MM_SHUFFLE(2, 3, 0, 1)));
+    return add(pairs, _mm256_permute4x64_pd(pairs, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+// (y, z, x, w)
+inline lanes yzx(lanes a) { return _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 0, 2, 1)); }
+
+// Doubles have no reciprocal square root estimate below AVX-512, so this one is exact.
+inline lanes rsqrt(lanes a) { return _mm256_div_pd(splat(1.0), _mm256_sqrt_pd(a)); }
+#endif
+
+} // namespace simd
+
+class Vec3 {
+    public:
+        Vec3() : m(simd::zero()) {}
+        Vec3(real e0, real e1, real e2) : m(simd::set(e0, e1, e2)) {}
+        explicit Vec3(simd::lanes lanes) : m(lanes) {}
+
+        real x() const { return e[0]; }
+        real y() const { return e[1]; }
+        real z() const { return e[2]; }
+
+        Vec3 operator-() const { return Vec3(simd::neg(m)); }
+        real operator[](int i) const { return e[i]; }
+        real& operator[](int i) { return e[i]; }
+
+        Vec3& operator+=(const Vec3 &v)
+        {
+            m = simd::add(m, v.m);
+            return *this;
+        }
+
+        Vec3& operator*=(const real t)
+        {
+            m = simd::mul(m, simd::splat(t));
+            return *this;
+        }
+
+        Vec3& operator/=(const real t)
+        {
+            return *this *= 1 / t;
+        }
+
+        real length() const
+        {
+            return std::sqrt(length_squared());
+        }
+
+        real length_squared() const {
+            return simd::first(simd::dot(m, m));
+        }
+
+        inline static Vec3 random()
+        {
+            return Vec3(
+                random_double(),
+                random_double(),
+                random_double()
+            );
+        }
+
+        inline static Vec3 random(real min, real max)
+        {
+            return Vec3(
+                random_double(min, max),
+                random_double(min, max),
+                random_double(min, max)
+            );
+        }
+
+        bool near_zero() const;
+
+    public:
+        union {
+            simd::lanes m;
+            real e[4];
+        };
+};
+
+// Vec3 utility functions
+
+inline Vec3 operator+(const Vec3 &u, const Vec3 &v)
+{
+    return Vec3(simd::add(u.m, v.m));
+}
+
+inline Vec3 operator-(const Vec3 &u, const Vec3 &v)
+{
+    return Vec3(simd::sub(u.m, v.m));
+}
+
+inline Vec3 operator*(const Vec3 &u, const Vec3 &v)
+{
+    return Vec3(simd::mul(u.m, v.m));
+}
+
+inline Vec3 operator*(real t, const Vec3 &v)
+{
+    return Vec3(simd::mul(simd::splat(t), v.m));
+}
+
+inline Vec3 operator*(const Vec3 &v, real t)
+{
+    return t * v;
+}
+
+inline Vec3 operator/(Vec3 v, real t)
+{
+    return (1/t) * v;
+}
+
+inline real dot(const Vec3 &u, const Vec3 &v)
+{
+    return simd::first(simd::dot(u.m, v.m));
+}
+
+inline Vec3 cross(const Vec3 &u, const Vec3 &v)
+{
+    // u * v.yzx - u.yzx * v is the cross product in (z, x, y) order.
+    simd::lanes zxy = simd::fmsub(u.m, simd::yzx(v.m), simd::mul(simd::yzx(u.m), v.m));
+    return Vec3(simd::yzx(zxy));
+}
+
+inline Vec3 unit_vector(Vec3 v)
+{
+    return Vec3(simd::mul(v.m, simd::rsqrt(simd::dot(v.m, v.m))));
+}
+
+inline Vec3 reflect(const Vec3 &v, const Vec3 &n)
+{
+    simd::lanes d = simd::dot(v.m, n.m);
+    return Vec3(simd::fnmadd(simd::add(d, d), n.m, v.m));
+}
+
+inline Vec3 refract(const Vec3 &uv, const Vec3 &n, real etai_over_etat)
+{
+    using namespace std;
+    auto cos_theta = fmin(-dot(uv, n), real(1));
+    simd::lanes r_out_perp = simd::mul(simd::splat(etai_over_etat), simd::fmadd(simd::splat(cos_theta), n.m, uv.m));
+    auto parallel_length = sqrt(fabs(1 - simd::first(simd::dot(r_out_perp, r_out_perp))));
+    return Vec3(simd::fnmadd(simd::splat(parallel_length), n.m, r_out_perp));
+}
+
+} // namespace raytracing
@@ -1,7 +1,23 @@
 #include <aabb.hpp>
+#include <stats.hpp>
 
 namespace raytracing {
-    bool AABB::hit(const Ray &r, double t_min, double t_max) const {
+    bool AABB::hit(const Ray &r, real t_min, real t_max) const {
+        STATS_INC(aabb_tests);
+#ifdef RAYTRACING_SIMD
+        // All three slabs at once. The lanes' minimum and maximum are taken over x, y
+        // and z only, by rotating them through the first lane.
+        simd::lanes inv_d = simd::div(simd::splat(1), r.dir.m);
+        simd::lanes t0 = simd::mul(simd::sub(minimum.m, r.orig.m), inv_d);
+        simd::lanes t1 = simd::mul(simd::sub(maximum.m, r.orig.m), inv_d);
+        simd::lanes near = simd::min(t0, t1), far = simd::max(t0, t1);
+        near = simd::max(simd::max(near, simd::yzx(near)), simd::yzx(simd::yzx(near)));
+        far = simd::min(simd::min(far, simd::yzx(far)), simd::yzx(simd::yzx(far)));
+        real t_near = simd::first(near), t_far = simd::first(far);
+        t_min = t_near > t_min ? t_near : t_min;
+        t_max = t_far < t_max ? t_far : t_max;
+        return t_max > t_min;
+#else
         for (int a = 0; a < 3; a++) {
             auto invD = 1.0f / r.direction()[a];
             auto t0 = (min()[a] - r.origin()[a]) * invD;
@@ -14,6 +30,7 @@ namespace raytracing {
                 return false;
         }
         return true;
+#endif
         /*for (int a = 0; a < 3; a++) {
             auto t0 = fmin((minimum[a] - r.origin()[a]) / r.direction()[a],
                            (maximum[a] - r.origin()[a]) / r.direction()[a]);
@@ -1,8 +1,30 @@
 #include "hittable.hpp"
 #include <aarect.hpp>
+#include <stats.hpp>
 
 namespace raytracing {
-    bool XYRect::hit(const Ray &r, double t_min, double t_max, HitRecord& rec) const {
+    // (u, v) derivatives of a rectangle whose `u` runs along `u_axis` over `u_size` and
+    // whose `v` runs along `v_axis` over `v_size`.
+    static void set_rect_derivatives(int u_axis, real u_size, int v_axis, real v_size, const Ray &r, HitRecord &rec)
+    {
+        rec.curvature = 0;
+        if(r.has_differentials) {
+            Vec3 dpdx, dpdy;
+            rec.position_differentials(r, dpdx, dpdy);
+            rec.duv.dudx = dpdx[u_axis] / u_size;
+            rec.duv.dvdx = dpdx[v_axis] / v_size;
+            rec.duv.dudy = dpdy[u_axis] / u_size;
+            rec.duv.dvdy = dpdy[v_axis] / v_size;
+        }
+        else {
+            real width = r.footprint(rec.t);
+            rec.duv.dudx = width / u_size;
+            rec.duv.dvdy = width / v_size;
+            rec.duv.dvdx = rec.duv.dudy = 0;
+        }
+    }
+
+    bool hit_xy_rect(real x0, real x1, real y0, real y1, real k, const Ray &r, real t_min, real t_max, HitRecord &rec) {
         auto t = (k - r.origin().z()) / r.direction().z();
         if (t < t_min || t > t_max)
             return false;
@@ -15,12 +37,22 @@ namespace raytracing {
         rec.t = t;
         auto outward_normal = Vec3(0, 0, 1);
         rec.set_face_normal(r, outward_normal);
-        rec.mat_ptr = mp;
         rec.p = r.at(t);
+        rec.p_error = 0; // clears a sphere's bound left by a farther hit
+        set_rect_derivatives(0, x1 - x0, 1, y1 - y0, r, rec);
+        return true;
+    }
+
+    bool XYRect::hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const {
+        STATS_INC(primitive_tests[StatRect]);
+        if (!hit_xy_rect(x0, x1, y0, y1, k, r, t_min, t_max, rec))
+            return false;
+        STATS_INC(primitive_hits[StatRect]);
+        rec.mat_ptr = mp;
         return true;
     }
 
-    bool XZRect::hit(const Ray &r, double t_min, double t_max, HitRecord& rec) const {
+    bool hit_xz_rect(real x0, real x1, real z0, real z1, real k, const Ray &r, real t_min, real t_max, HitRecord &rec) {
         auto t = (k - r.origin().y()) / r.direction().y();
         if (t < t_min || t > t_max)
             return false;
@@ -33,12 +65,22 @@ namespace raytracing {
         rec.t = t;
         auto outward_normal = Vec3(0, 1, 0);
         rec.set_face_normal(r, outward_normal);
-        rec.mat_ptr = mp;
         rec.p = r.at(t);
+        rec.p_error = 0;
+        set_rect_derivatives(0, x1 - x0, 2, z1 - z0, r, rec);
+        return true;
+    }
+
+    bool XZRect::hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const {
+        STATS_INC(primitive_tests[StatRect]);
+        if (!hit_xz_rect(x0, x1, z0, z1, k, r, t_min, t_max, rec))
+            return false;
+        STATS_INC(primitive_hits[StatRect]);
+        rec.mat_ptr = mp;
         return true;
     }
 
-    bool YZRect::hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const {
+    bool hit_yz_rect(real y0, real y1, real z0, real z1, real k, const Ray &r, real t_min, real t_max, HitRecord &rec) {
         auto t = (k - r.origin().x()) / r.direction().x();
         if (t < t_min || t > t_max)
             return false;
@@ -51,8 +93,18 @@ namespace raytracing {
         rec.t = t;
         auto outward_normal = Vec3(1, 0, 0);
         rec.set_face_normal(r, outward_normal);
-        rec.mat_ptr = mp;
         rec.p = r.at(t);
+        rec.p_error = 0;
+        set_rect_derivatives(1, y1 - y0, 2, z1 - z0, r, rec);
+        return true;
+    }
+
+    bool YZRect::hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const {
+        STATS_INC(primitive_tests[StatRect]);
+        if (!hit_yz_rect(y0, y1, z0, z1, k, r, t_min, t_max, rec))
+            return false;
+        STATS_INC(primitive_hits[StatRect]);
+        rec.mat_ptr = mp;
         return true;
     }
 }
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include <affine.hpp>
+
+#include <cmath>
+
+namespace raytracing {
+    Affine Affine::identity()
+    {
+        return Affine{{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}}};
+    }
+
+    Affine Affine::translation(const Vec3 &offset)
+    {
+        return Affine{{{1, 0, 0, offset.x()}, {0, 1, 0, offset.y()}, {0, 0, 1, offset.z()}}};
+    }
+
+    Affine Affine::rotation_y(real sin_theta, real cos_theta)
+    {
+        return Affine{{{cos_theta, 0, sin_theta, 0}, {0, 1, 0, 0}, {-sin_theta, 0, cos_theta, 0}}};
+    }
+
+    AABB Affine::bounds(const AABB &box) const
+    {
+        // Every output coordinate is a sum of terms in one input coordinate each, so
+        // its extremes take the extreme of every term independently (Arvo).
+        Point3 lo, hi;
+        for(int i = 0; i < 3; i++) {
+            lo[i] = hi[i] = m[i][3];
+            for(int j = 0; j < 3; j++) {
+                real a = m[i][j] * box.min()[j];
+                real b = m[i][j] * box.max()[j];
+                lo[i] += a < b ? a : b;
+                hi[i] += a < b ? b : a;
+            }
+        }
+        return AABB(lo, hi);
+    }
+
+    AABB Affine::bounds(const Point3 &center, real radius) const
+    {
+        // The transformed sphere is an ellipsoid, whose extent along every axis is the
+        // radius times the length of that row of the linear part.
+        const Point3 c = point(center);
+        Vec3 extent;
+        for(int i = 0; i < 3; i++)
+            extent[i] = radius * std::sqrt(m[i][0] * m[i][0] + m[i][1] * m[i][1] + m[i][2] * m[i][2]);
+        return AABB(c - extent, c + extent);
+    }
+
+    bool Affine::inverse(Affine &result) const
+    {
+        // The inverse of the linear part from its cofactors, then the translation
+        // moved back through it.
+        real c[3][3];
+        for(int i = 0; i < 3; i++)
+            for(int j = 0; j < 3; j++) {
+                int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+                int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+                c[j][i] = m[i1][j1] * m[i2][j2] - m[i1][j2] * m[i2][j1];
+            }
+        real det = m[0][0] * c[0][0] + m[0][1] * c[1][0] + m[0][2] * c[2][0];
+        if(det == 0 || !std::isfinite(det))
+            return false;
+
+        for(int i = 0; i < 3; i++) {
+            for(int j = 0; j < 3; j++)
+                result.m[i][j] = c[i][j] / det;
+            result.m[i][3] = -(result.m[i][0] * m[0][3] + result.m[i][1] * m[1][3] + result.m[i][2] * m[2][3]);
+        }
+        return true;
+    }
+
+    bool Affine::is_identity() const
+    {
+        for(int i = 0; i < 3; i++)
+            for(int j = 0; j < 4; j++)
+                if(m[i][j] != (i == j ? 1 : 0))
+                    return false;
+        return true;
+    }
+
+    Affine operator*(const Affine &a, const Affine &b)
+    {
+        Affine result;
+        for(int i = 0; i < 3; i++)
+            for(int j = 0; j < 4; j++) {
+                result.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+                if(j == 3)
+                    result.m[i][j] += a.m[i][3];
+            }
+        return result;
+    }
+
+    void hit_to_world(const Affine &to_world, const Affine &to_object, HitRecord &rec)
+    {
+        rec.p = to_world.point(rec.p);
+        rec.normal = unit_vector(to_object.transposed_vector(rec.normal));
+    }
+}
@@ -1,9 +1,13 @@
 #include <box.hpp>
+#include <stats.hpp>
+
+#include <utility>
 
 namespace raytracing {
     Box::Box(const Point3& p0, const Point3& p1, std::shared_ptr<Material> ptr) {
         box_min = p0;
         box_max = p1;
+        mat_ptr = ptr;
 
         sides.add(std::make_shared<XYRect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr));
         sides.add(std::make_shared<XYRect>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr));
@@ -15,7 +19,45 @@ namespace raytracing {
         sides.add(std::make_shared<YZRect>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr));
     }
 
-    bool Box::hit(const Ray &r, double t_min, double t_max, HitRecord& rec) const {
-        return sides.hit(r, t_min, t_max, rec);
+    bool hit_box(const Point3 &p0, const Point3 &p1, const Ray &r, real t_min, real t_max, HitRecord &rec) {
+        // Same faces, in the same order, as the `sides` list built above.
+        bool hit_anything = false;
+        auto closest_so_far = t_max;
+
+        if (hit_xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), r, t_min, closest_so_far, rec)) { hit_anything = true; closest_so_far = rec.t; }
+        if (hit_xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), r, t_min, closest_so_far, rec)) { hit_anything = true; closest_so_far = rec.t; }
+        if (hit_xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), r, t_min, closest_so_far, rec)) { hit_anything = true; closest_so_far = rec.t; }
+        if (hit_xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), r, t_min, closest_so_far, rec)) { hit_anything = true; closest_so_far = rec.t; }
+        if (hit_yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), r, t_min, closest_so_far, rec)) { hit_anything = true; closest_so_far = rec.t; }
+        if (hit_yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), r, t_min, closest_so_far, rec)) { hit_anything = true; }
+
+        return hit_anything;
+    }
+
+    bool Box::hit(const Ray &r, real t_min, real t_max, HitRecord& rec) const {
+        // Same result as `sides.hit`, without six virtual calls.
+        STATS_INC(primitive_tests[StatBox]);
+        if (!hit_box(box_min, box_max, r, t_min, t_max, rec))
+            return false;
+        STATS_INC(primitive_hits[StatBox]);
+        rec.mat_ptr = mat_ptr;
+        return true;
+    }
+
+    bool Box::interval(const Ray &r, real &t_enter, real &t_exit) const
+    {
+        // The slabs of the faces, as in `AABB::hit`.
+        t_enter = -infinity;
+        t_exit = infinity;
+        for(int a = 0; a < 3; a++) {
+            auto inv_d = 1 / r.direction()[a];
+            auto t0 = (box_min[a] - r.origin()[a]) * inv_d;
+            auto t1 = (box_max[a] - r.origin()[a]) * inv_d;
+            if(inv_d < 0)
+                std::swap(t0, t1);
+            t_enter = t0 > t_enter ? t0 : t_enter;
+            t_exit = t1 < t_exit ? t1 : t_exit;
+        }
+        return t_enter < t_exit;
     }
-}
\ No newline at end of file
+}
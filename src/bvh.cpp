@@ -1,4 +1,5 @@
 #include <bvh.hpp>
+#include <stats.hpp>
 
 #include <algorithm>
 #include <iostream>
@@ -22,13 +23,16 @@ namespace raytracing {
         return true;
     }
 
-    bool BVHNode::hit(const Ray& r, double t_min, double t_max, HitRecord& rec) const 
+    bool BVHNode::hit(const Ray& r, real t_min, real t_max, HitRecord& rec) const 
     {
+        STATS_INC(bvh_nodes);
         if (!box.hit(r, t_min, t_max))
             return false;
 
+        // A leaf of one object holds it as both children; it is tested once, or a
+        // medium would be sampled twice.
         bool hit_left = left->hit(r, t_min, t_max, rec);
-        bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+        bool hit_right = right != left && right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
 
         return hit_left || hit_right;
     }
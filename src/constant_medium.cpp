@@ -1,43 +1,48 @@
 #include "common.hpp"
 #include <constant_medium.hpp>
+#include <stats.hpp>
 
 #include <iostream>
 
 namespace raytracing {
-    bool ConstantMedium::hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const
+    bool ConstantMedium::hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const
     {
         // Print occasional samples when debugging. To enable, set enableDebug true.
         const bool enableDebug = false;
         const bool debugging = enableDebug && random_double() <= 0.00001;
 
-        HitRecord rec1, rec2;
+        STATS_INC(primitive_tests[StatMedium]);
 
-        if(!boundary->hit(r, -infinity, infinity, rec1) || !boundary->hit(r, rec1.t + 0.0001, infinity, rec2))
+        // One query for both ends: a sphere or box boundary solves for them at once, and
+        // for a ray that starts inside, the entry is simply behind the origin.
+        real t_enter, t_exit;
+        if(!boundary->interval(r, t_enter, t_exit))
             return false;
-        
+
         if(debugging)
-            std::cerr << std::endl << "t_min=" << rec1.t << ", t_max=" << rec2.t << std::endl;
+            std::cerr << std::endl << "t_min=" << t_enter << ", t_max=" << t_exit << std::endl;
 
-        if(rec1.t < t_min)
-            rec1.t = t_min;
-        if(rec2.t > t_max)
-            rec2.t = t_max;
+        if(t_enter < t_min)
+            t_enter = t_min;
+        if(t_exit > t_max)
+            t_exit = t_max;
 
-        if(rec1.t >= rec2.t)
+        if(t_enter >= t_exit)
             return false;
         
-        if(rec1.t < 0)
-            rec1.t = 0;
+        if(t_enter < 0)
+            t_enter = 0;
         
         const auto ray_length = r.direction().length();
-        const auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
+        const auto distance_inside_boundary = (t_exit - t_enter) * ray_length;
         const auto hit_distance = neg_inv_density * log(random_double());
 
         if (hit_distance > distance_inside_boundary)
             return false;
 
-        rec.t = rec1.t + hit_distance / ray_length;
+        rec.t = t_enter + hit_distance / ray_length;
         rec.p = r.at(rec.t);
+        rec.p_error = 0;
 
         if (debugging) {
             std::cerr << "hit_distance = " <<  hit_distance << '\n'
@@ -45,6 +50,7 @@ namespace raytracing {
                       << "rec.p = " <<  rec.p << '\n';
         }
 
+        STATS_INC(primitive_hits[StatMedium]);
         rec.normal = Vec3(1, 0, 0);  // arbitrary
         rec.front_face = true;     // also arbitrary
         rec.mat_ptr = phase_function;
@@ -0,0 +1,301 @@
+#include <grid_medium.hpp>
+#include <stats.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+namespace raytracing {
+    static const char voxel_file_magic[8] = {'R', 'T', 'V', 'O', 'X', 'E', 'L', 'S'};
+    static const uint32_t voxel_file_version = 1;
+
+    struct VoxelFileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t nx, ny, nz;
+    };
+
+    bool parse_grid_layout(const std::string &name, GridLayout &layout)
+    {
+        if(name == "dense")
+            layout = GridLayout::Dense;
+        else if(name == "sparse")
+            layout = GridLayout::Sparse;
+        else
+            return false;
+        return true;
+    }
+
+    DensityGrid::DensityGrid(const AABB &bounds, int nx, int ny, int nz, const std::vector<float> &samples, GridLayout layout)
+        : box(bounds), n{nx, ny, nz}, grid_layout(layout)
+    {
+        const Vec3 extent = bounds.max() - bounds.min();
+        cell = Vec3(extent.x() / (nx - 1), extent.y() / (ny - 1), extent.z() / (nz - 1));
+        inv_cell = Vec3(1 / cell.x(), 1 / cell.y(), 1 / cell.z());
+        auto at = [&](int i, int j, int k) { return samples[(static_cast<size_t>(k) * ny + j) * nx + i]; };
+
+        // The majorant of a brick of cells covers the samples on its far faces too.
+        for(int a = 0; a < 3; a++)
+            brick_count[a] = (n[a] - 1 + brick_size - 1) / brick_size;
+        majorants.assign(static_cast<size_t>(brick_count[0]) * brick_count[1] * brick_count[2], 0.0f);
+        for(int k = 0; k < nz; k++)
+            for(int j = 0; j < ny; j++)
+                for(int i = 0; i < nx; i++) {
+                    float value = at(i, j, k);
+                    if(value == 0)
+                        continue;
+                    // A sample on a brick boundary belongs to the bricks on both sides.
+                    for(int bk = std::max(0, (k - 1) / brick_size); bk <= std::min(k / brick_size, brick_count[2] - 1); bk++)
+                        for(int bj = std::max(0, (j - 1) / brick_size); bj <= std::min(j / brick_size, brick_count[1] - 1); bj++)
+                            for(int bi = std::max(0, (i - 1) / brick_size); bi <= std::min(i / brick_size, brick_count[0] - 1); bi++) {
+                                float &m = majorants[(static_cast<size_t>(bk) * brick_count[1] + bj) * brick_count[0] + bi];
+                                m = std::max(m, value);
+                            }
+                }
+
+        if(layout == GridLayout::Dense) {
+            dense = samples;
+            return;
+        }
+
+        const int brick_samples = brick_size * brick_size * brick_size;
+        for(int a = 0; a < 3; a++)
+            sample_bricks[a] = (n[a] + brick_size - 1) / brick_size;
+        brick_of.assign(static_cast<size_t>(sample_bricks[0]) * sample_bricks[1] * sample_bricks[2], 0);
+        std::vector<float> brick(brick_samples);
+        size_t index = 0;
+        for(int bk = 0; bk < sample_bricks[2]; bk++)
+            for(int bj = 0; bj < sample_bricks[1]; bj++)
+                for(int bi = 0; bi < sample_bricks[0]; bi++, index++) {
+                    bool empty = true;
+                    for(int k = 0; k < brick_size; k++)
+                        for(int j = 0; j < brick_size; j++)
+                            for(int i = 0; i < brick_size; i++) {
+                                int x = bi * brick_size + i, y = bj * brick_size + j, z = bk * brick_size + k;
+                                float value = x < nx && y < ny && z < nz ? at(x, y, z) : 0.0f;
+                                brick[(k * brick_size + j) * brick_size + i] = value;
+                                empty = empty && value == 0;
+                            }
+                    if(empty)
+                        continue;
+                    brick_of[index] = static_cast<uint32_t>(stored.size() / brick_samples + 1);
+                    stored.insert(stored.end(), brick.begin(), brick.end());
+                }
+    }
+
+    // Samples along every axis of a grid from noise, at least 2; in double, as huge
+    // boxes or tiny voxels overflow any integer.
+    static void noise_grid_size(const AABB &bounds, real voxel_size, double size[3])
+    {
+        const Vec3 extent = bounds.max() - bounds.min();
+        for(int a = 0; a < 3; a++)
+            size[a] = std::max(2.0, std::ceil(static_cast<double>(extent[a]) / voxel_size) + 1);
+    }
+
+    size_t DensityGrid::noise_samples(const AABB &bounds, real voxel_size)
+    {
+        double size[3];
+        noise_grid_size(bounds, voxel_size, size);
+        double count = size[0] * size[1] * size[2];
+        return count < static_cast<double>(std::numeric_limits<size_t>::max()) ? static_cast<size_t>(count)
+                                                                              : std::numeric_limits<size_t>::max();
+    }
+
+    std::shared_ptr<DensityGrid> DensityGrid::from_noise(const Perlin &noise, real frequency, const AABB &bounds, real voxel_size, GridLayout layout)
+    {
+        const Vec3 extent = bounds.max() - bounds.min();
+        double grid_size[3];
+        noise_grid_size(bounds, voxel_size, grid_size);
+        int size[3];
+        for(int a = 0; a < 3; a++)
+            size[a] = static_cast<int>(grid_size[a]);
+        const Vec3 step(extent.x() / (size[0] - 1), extent.y() / (size[1] - 1), extent.z() / (size[2] - 1));
+
+        std::vector<float> samples(static_cast<size_t>(size[0]) * size[1] * size[2]);
+        size_t index = 0;
+        for(int k = 0; k < size[2]; k++)
+            for(int j = 0; j < size[1]; j++)
+                for(int i = 0; i < size[0]; i++) {
+                    Point3 p = bounds.min() + Vec3(i * step.x(), j * step.y(), k * step.z());
+                    samples[index++] = static_cast<float>(std::max(real(0), noise.noise(frequency * p)));
+                }
+        return std::make_shared<DensityGrid>(bounds, size[0], size[1], size[2], samples, layout);
+    }
+
+    std::shared_ptr<DensityGrid> DensityGrid::load(const std::string &path, const AABB &bounds, GridLayout layout)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if(!file) {
+            std::cerr << "ERROR: Could not open voxel file `" << path << "`." << std::endl;
+            return nullptr;
+        }
+
+        VoxelFileHeader header;
+        auto invalid = [&](const char* reason) {
+            std::cerr << "ERROR: Invalid voxel file `" << path << "`: " << reason << "." << std::endl;
+            return nullptr;
+        };
+        if(!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, voxel_file_magic, sizeof(header.magic)) != 0)
+            return invalid("not a voxel file");
+        if(header.version != voxel_file_version)
+            return invalid("unsupported version");
+        if(header.nx < 2 || header.ny < 2 || header.nz < 2 || header.nx > 4096 || header.ny > 4096 || header.nz > 4096)
+            return invalid("bad size");
+
+        std::vector<float> samples(static_cast<size_t>(header.nx) * header.ny * header.nz);
+        if(!file.read(reinterpret_cast<char*>(samples.data()), samples.size() * sizeof(float)))
+            return invalid("truncated");
+        for(float value : samples)
+            if(!(value >= 0) || !std::isfinite(value))
+                return invalid("negative or non-finite density");
+        return std::make_shared<DensityGrid>(bounds, header.nx, header.ny, header.nz, samples, layout);
+    }
+
+    bool DensityGrid::save(const std::string &path) const
+    {
+        VoxelFileHeader header = {};
+        std::memcpy(header.magic, voxel_file_magic, sizeof(header.magic));
+        header.version = voxel_file_version;
+        header.nx = n[0];
+        header.ny = n[1];
+        header.nz = n[2];
+
+        const std::vector<float> samples = this->samples();
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(float));
+        if(!file) {
+            std::cerr << "ERROR: Could not write voxel file `" << path << "`." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<float> DensityGrid::samples() const
+    {
+        if(grid_layout == GridLayout::Dense)
+            return dense;
+
+        std::vector<float> all;
+        all.reserve(static_cast<size_t>(n[0]) * n[1] * n[2]);
+        for(int k = 0; k < n[2]; k++)
+            for(int j = 0; j < n[1]; j++)
+                for(int i = 0; i < n[0]; i++)
+                    all.push_back(sample(i, j, k));
+        return all;
+    }
+
+    float DensityGrid::sample(int i, int j, int k) const
+    {
+        if(grid_layout == GridLayout::Dense)
+            return dense[(static_cast<size_t>(k) * n[1] + j) * n[0] + i];
+
+        size_t brick = (static_cast<size_t>(k / brick_size) * sample_bricks[1] + j / brick_size) * sample_bricks[0] + i / brick_size;
+        uint32_t id = brick_of[brick];
+        if(id == 0)
+            return 0;
+        size_t offset = ((k % brick_size) * brick_size + j % brick_size) * brick_size + i % brick_size;
+        return stored[(id - 1) * static_cast<size_t>(brick_size * brick_size * brick_size) + offset];
+    }
+
+    real DensityGrid::density(const Point3 &p) const
+    {
+        int c[3];
+        real f[3];
+        for(int a = 0; a < 3; a++) {
+            real x = std::clamp((p[a] - box.min()[a]) * inv_cell[a], real(0), real(n[a] - 1));
+            c[a] = std::min(static_cast<int>(x), n[a] - 2);
+            f[a] = x - c[a];
+        }
+
+        real value = 0;
+        for(int dk = 0; dk < 2; dk++)
+            for(int dj = 0; dj < 2; dj++)
+                for(int di = 0; di < 2; di++) {
+                    real weight = (di ? f[0] : 1 - f[0]) * (dj ? f[1] : 1 - f[1]) * (dk ? f[2] : 1 - f[2]);
+                    value += weight * sample(c[0] + di, c[1] + dj, c[2] + dk);
+                }
+        return value;
+    }
+
+    size_t DensityGrid::size_bytes() const
+    {
+        return (dense.size() + stored.size() + majorants.size()) * sizeof(float) + brick_of.size() * sizeof(uint32_t);
+    }
+
+    bool GridMedium::hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const
+    {
+        STATS_INC(primitive_tests[StatMedium]);
+
+        // The part of the ray inside the grid's box.
+        const AABB &bounds = grid->bounds();
+        real t_enter = t_min, t_exit = t_max;
+        for(int a = 0; a < 3; a++) {
+            auto inv_d = 1 / r.direction()[a];
+            auto t0 = (bounds.min()[a] - r.origin()[a]) * inv_d;
+            auto t1 = (bounds.max()[a] - r.origin()[a]) * inv_d;
+            if(inv_d < 0)
+                std::swap(t0, t1);
+            t_enter = t0 > t_enter ? t0 : t_enter;
+            t_exit = t1 < t_exit ? t1 : t_exit;
+        }
+        if(!(t_enter < t_exit))
+            return false;
+
+        // Walk the bricks along the ray (3D DDA) and track through each with its own
+        // majorant. Free paths have no memory, so a step that leaves a brick is simply
+        // restarted at its far side.
+        const Vec3 extent = grid->brick_extent();
+        const int* bricks = grid->bricks();
+        const Point3 start = r.at(t_enter);
+        int brick[3], step[3];
+        real t_next[3], t_delta[3];
+        for(int a = 0; a < 3; a++) {
+            real d = r.direction()[a];
+            brick[a] = std::clamp(static_cast<int>(std::floor((start[a] - bounds.min()[a]) / extent[a])), 0, bricks[a] - 1);
+            step[a] = d < 0 ? -1 : 1;
+            if(d == 0) {
+                t_next[a] = t_delta[a] = infinity;
+                continue;
+            }
+            t_next[a] = (bounds.min()[a] + (brick[a] + (d > 0)) * extent[a] - r.origin()[a]) / d;
+            t_delta[a] = extent[a] / std::fabs(d);
+        }
+
+        const real ray_length = r.direction().length();
+        real t = t_enter;
+        while(true) {
+            int a = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+            real t_leave = std::min(t_next[a], t_exit);
+            real majorant = density_scale * grid->majorant(brick[0], brick[1], brick[2]);
+            if(majorant > 0) {
+                while(true) {
+                    t -= std::log(1 - random_double()) / (majorant * ray_length);
+                    if(t >= t_leave)
+                        break;
+                    if(random_double() * majorant < density_scale * grid->density(r.at(t))) {
+                        STATS_INC(primitive_hits[StatMedium]);
+                        rec.t = t;
+                        rec.p = r.at(t);
+                        rec.p_error = 0;
+                        rec.normal = Vec3(1, 0, 0); // arbitrary
+                        rec.front_face = true;      // also arbitrary
+                        rec.mat_ptr = phase_function;
+                        return true;
+                    }
+                }
+            }
+
+            if(t_leave >= t_exit)
+                return false;
+            t = t_leave;
+            brick[a] += step[a];
+            if(brick[a] < 0 || brick[a] >= bricks[a])
+                return false;
+            t_next[a] += t_delta[a];
+        }
+    }
+}
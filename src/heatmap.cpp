@@ -0,0 +1,62 @@
+#include <heatmap.hpp>
+#include <common.hpp>
+#include <vec3.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace raytracing {
+    static Color false_color(double x)
+    {
+        static const Color stops[] = {
+            Color(0.00, 0.00, 0.00),
+            Color(0.35, 0.05, 0.50),
+            Color(0.85, 0.15, 0.15),
+            Color(1.00, 0.65, 0.00),
+            Color(1.00, 1.00, 1.00),
+        };
+        const int segments = sizeof(stops) / sizeof(stops[0]) - 1;
+
+        x = clamp(x, 0.0, 1.0) * segments;
+        int i = std::min(static_cast<int>(x), segments - 1);
+        double f = x - i;
+        return (1 - f) * stops[i] + f * stops[i + 1];
+    }
+
+    void write_heatmap(std::ostream &out, const std::vector<float> &values, int width, int height)
+    {
+        double scale = 0;
+        if(!values.empty()) {
+            std::vector<float> sorted(values);
+            auto nth = sorted.begin() + (sorted.size() - 1) * 99 / 100;
+            std::nth_element(sorted.begin(), nth, sorted.end());
+            scale = *nth > 0 ? 1.0 / *nth : 0.0;
+        }
+
+        out << "P3\n" << width << ' ' << height << "\n255\n";
+        for(int j = height - 1; j >= 0; --j)
+        {
+            for(int i = 0; i < width; ++i)
+            {
+                Color c = false_color(values[static_cast<size_t>(j) * width + i] * scale);
+                out << static_cast<int>(255.999 * c.x()) << ' '
+                    << static_cast<int>(255.999 * c.y()) << ' '
+                    << static_cast<int>(255.999 * c.z()) << '\n';
+            }
+        }
+        out << std::flush;
+    }
+
+    void write_pfm(std::ostream &out, const std::vector<float> &values, int width, int height)
+    {
+        // A negative scale marks little-endian data. Rows go bottom to top, which is
+        // already the framebuffer's order.
+        const uint16_t probe = 1;
+        unsigned char first_byte;
+        std::memcpy(&first_byte, &probe, 1);
+        out << "Pf\n" << width << ' ' << height << '\n' << (first_byte ? "-1.0" : "1.0") << '\n';
+        out.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(float)));
+        out << std::flush;
+    }
+}
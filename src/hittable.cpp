@@ -1,10 +1,30 @@
 #include "common.hpp"
 #include "vec3.hpp"
 #include <hittable.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <memory>
 
 namespace raytracing {
-    bool HittableList::hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const 
+    bool Hittable::interval(const Ray &r, real &t_enter, real &t_exit) const
+    {
+        HitRecord rec;
+        if(!hit(r, -infinity, infinity, rec))
+            return false;
+        t_enter = rec.t;
+
+        // Step past the entry by more than its rounding error, or single precision
+        // builds find the entry again instead of the exit for large objects.
+        const real step = std::max(real(0.0001), 64 * std::numeric_limits<real>::epsilon() * std::fabs(t_enter));
+        if(!hit(r, t_enter + step, infinity, rec))
+            return false;
+        t_exit = rec.t;
+        return true;
+    }
+
+    bool HittableList::hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const 
     {
         HitRecord temp_rec;
         bool hit_anything = false;
@@ -42,9 +62,14 @@ namespace raytracing {
         return true;
     }
 
-    bool Translate::hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const 
+    bool Translate::hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const 
     {
-        Ray moved_r(r.origin() - offset, r.direction(), r.time());
+        Ray moved_r = r;
+        moved_r.orig = r.origin() - offset;
+        if(r.has_differentials) {
+            moved_r.rx_origin = r.rx_origin - offset;
+            moved_r.ry_origin = r.ry_origin - offset;
+        }
         if(!ptr->hit(moved_r, t_min, t_max, rec))
             return false;
         
@@ -54,6 +79,11 @@ namespace raytracing {
         return true;
     }
 
+    bool Translate::interval(const Ray &r, real &t_enter, real &t_exit) const
+    {
+        return ptr->interval(Ray(r.origin() - offset, r.direction(), r.time()), t_enter, t_exit);
+    }
+
     bool Translate::bounding_box(double time0, double time1, AABB &output_box) const
     {
         if(!ptr->bounding_box(time0, time1, output_box))
@@ -64,7 +94,7 @@ namespace raytracing {
         return true;
     }
 
-    RotateY::RotateY(std::shared_ptr<Hittable> p, double angle) 
+    RotateY::RotateY(std::shared_ptr<Hittable> p, real angle) 
         : ptr(p)
     {
         auto radians = degrees_to_radians(angle);
@@ -95,34 +125,39 @@ namespace raytracing {
         bbox = AABB(min, max);
     }
 
-    bool RotateY::hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const
+    bool RotateY::hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const
     {
-        auto origin = r.origin();
-        auto direction = r.direction();
-
-        origin[0] = cos_theta*r.origin()[0] - sin_theta*r.origin()[2];
-        origin[2] = sin_theta*r.origin()[0] + cos_theta*r.origin()[2];
-
-        direction[0] = cos_theta*r.direction()[0] - sin_theta*r.direction()[2];
-        direction[2] = sin_theta*r.direction()[0] + cos_theta*r.direction()[2];
-
-        Ray rotated_r(origin, direction, r.time());
+        auto to_object = [this](Vec3 v) {
+            return Vec3(cos_theta*v[0] - sin_theta*v[2], v[1], sin_theta*v[0] + cos_theta*v[2]);
+        };
+        auto to_world = [this](Vec3 v) {
+            return Vec3(cos_theta*v[0] + sin_theta*v[2], v[1], -sin_theta*v[0] + cos_theta*v[2]);
+        };
+
+        Ray rotated_r = r;
+        rotated_r.orig = to_object(r.origin());
+        rotated_r.dir = to_object(r.direction());
+        if(r.has_differentials) {
+            rotated_r.rx_origin = to_object(r.rx_origin);
+            rotated_r.ry_origin = to_object(r.ry_origin);
+            rotated_r.rx_direction = to_object(r.rx_direction);
+            rotated_r.ry_direction = to_object(r.ry_direction);
+        }
 
         if (!ptr->hit(rotated_r, t_min, t_max, rec))
             return false;
 
-        auto p = rec.p;
-        auto normal = rec.normal;
-
-        p[0] =  cos_theta*rec.p[0] + sin_theta*rec.p[2];
-        p[2] = -sin_theta*rec.p[0] + cos_theta*rec.p[2];
-
-        normal[0] =  cos_theta*rec.normal[0] + sin_theta*rec.normal[2];
-        normal[2] = -sin_theta*rec.normal[0] + cos_theta*rec.normal[2];
-
-        rec.p = p;
-        rec.set_face_normal(rotated_r, normal);
+        rec.p = to_world(rec.p);
+        rec.set_face_normal(rotated_r, to_world(rec.normal));
 
         return true;
     }
-}
\ No newline at end of file
+
+    bool RotateY::interval(const Ray &r, real &t_enter, real &t_exit) const
+    {
+        auto to_object = [this](Vec3 v) {
+            return Vec3(cos_theta*v[0] - sin_theta*v[2], v[1], sin_theta*v[0] + cos_theta*v[2]);
+        };
+        return ptr->interval(Ray(to_object(r.origin()), to_object(r.direction()), r.time()), t_enter, t_exit);
+    }
+}
@@ -0,0 +1,204 @@
+#include <instance.hpp>
+#include <aarect.hpp>
+#include <box.hpp>
+#include <bvh.hpp>
+#include <constant_medium.hpp>
+#include <grid_medium.hpp>
+#include <sphere.hpp>
+#include <stats.hpp>
+#include <transform.hpp>
+
+#include <algorithm>
+#include <iostream>
+
+namespace raytracing {
+    InstanceBVH::InstanceBVH(const HittableList &world, double time0, double time1)
+    {
+        for(const auto &object : world.objects)
+            add(object, object, Affine::identity(), time0, time1);
+
+        std::vector<uint32_t> order;
+        build_bvh_nodes(instance_bounds, 1, nodes, order);
+        std::vector<Instance> sorted(instance_records.size());
+        for(size_t i = 0; i < order.size(); i++)
+            sorted[i] = instance_records[order[i]];
+        instance_records.swap(sorted);
+        instance_bounds.clear();
+        instance_bounds.shrink_to_fit();
+
+        instance_stats.instances = instance_records.size();
+        instance_stats.geometries = geometries.size();
+        instance_stats.instance_bytes = instance_records.size() * sizeof(Instance) + transforms.size() * sizeof(InstanceTransform)
+                                      + nodes.size() * sizeof(PrimitiveBVHNode);
+        for(const auto &geometry : geometries) {
+            size_t bytes = object_bytes(*geometry);
+            instance_stats.geometry_bytes += bytes;
+            instance_stats.duplicated_bytes += bytes * uses[geometry.get()];
+        }
+        uses.clear();
+    }
+
+    void InstanceBVH::add(const std::shared_ptr<Hittable> &top, const std::shared_ptr<Hittable> &object, const Affine &to_world,
+                          double time0, double time1)
+    {
+        Affine step;
+        if(auto child = transform_child(object, step))
+            return add(top, child, to_world * step, time0, time1);
+
+        const bool transformed = !to_world.is_identity();
+        if(auto list = std::dynamic_pointer_cast<HittableList>(object); list && !transformed) {
+            for(const auto &child : list->objects)
+                add(top, child, to_world, time0, time1);
+            return;
+        }
+
+        InstanceTransform transform;
+        transform.to_world = to_world;
+        if(transformed && !to_world.inverse(transform.to_object)) {
+            std::cerr << "WARNING: Skipping an object with a singular transform." << std::endl;
+            return;
+        }
+        Instance instance;
+        instance.geometry = bottom_level(object, time0, time1);
+
+        AABB box;
+        bool bounded = transformed ? transformed_bounds(*instance.geometry, to_world, time0, time1, box)
+                                   : instance.geometry->bounding_box(time0, time1, box);
+        if(!bounded) {
+            // Tested on its own, with its transforms if it has any.
+            unbounded.push_back(transformed ? top : object);
+            return;
+        }
+        instance.transform = Instance::untransformed;
+        if(transformed) {
+            instance.transform = static_cast<uint32_t>(transforms.size());
+            transforms.push_back(transform);
+        }
+        instance_records.push_back(instance);
+        instance_bounds.push_back(box);
+        uses[instance.geometry]++;
+    }
+
+    const Hittable* InstanceBVH::bottom_level(const std::shared_ptr<Hittable> &geometry, double time0, double time1)
+    {
+        auto found = bottom_levels.find(geometry.get());
+        if(found != bottom_levels.end())
+            return found->second;
+
+        // Groups get a BVH over their objects; everything else (primitive arrays, BVHs,
+        // single primitives, media) is intersected as it is.
+        std::shared_ptr<Hittable> bottom = geometry;
+        AABB box;
+        auto list = std::dynamic_pointer_cast<HittableList>(geometry);
+        if(list && list->objects.size() > 1 && list->bounding_box(time0, time1, box))
+            bottom = std::make_shared<BVHNode>(*list, time0, time1);
+
+        geometries.push_back(bottom);
+        bottom_levels[geometry.get()] = bottom.get();
+        return bottom.get();
+    }
+
+    bool InstanceBVH::hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const
+    {
+        bool hit_anything = false;
+        auto closest_so_far = t_max;
+
+        for(const auto &object : unbounded)
+            if(object->hit(r, t_min, closest_so_far, rec)) {
+                hit_anything = true;
+                closest_so_far = rec.t;
+            }
+        if(nodes.empty())
+            return hit_anything;
+
+        uint32_t stack[max_bvh_depth];
+        int stack_size = 0;
+        uint32_t index = 0;
+
+        while(true) {
+            const auto &node = nodes[index];
+            STATS_INC(bvh_nodes);
+            if(node.box.hit(r, t_min, closest_so_far)) {
+                if(node.count == 0) {
+                    // Visit the child on the near side of the split plane first.
+                    uint32_t first = index + 1, second = node.offset;
+                    if(r.direction()[node.axis] < 0)
+                        std::swap(first, second);
+                    stack[stack_size++] = second;
+                    index = first;
+                    continue;
+                }
+
+                for(uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                    const Instance &instance = instance_records[i];
+                    if(instance.transform == Instance::untransformed) {
+                        if(instance.geometry->hit(r, t_min, closest_so_far, rec)) {
+                            hit_anything = true;
+                            closest_so_far = rec.t;
+                        }
+                        continue;
+                    }
+
+                    const InstanceTransform &transform = transforms[instance.transform];
+                    if(instance.geometry->hit(transform.to_object.ray(r), t_min, closest_so_far, rec)) {
+                        hit_anything = true;
+                        closest_so_far = rec.t;
+                        hit_to_world(transform.to_world, transform.to_object, rec);
+                    }
+                }
+            }
+
+            if(stack_size == 0)
+                break;
+            index = stack[--stack_size];
+        }
+
+        return hit_anything;
+    }
+
+    bool InstanceBVH::bounding_box(double time0, double time1, AABB &output_box) const
+    {
+        if(nodes.empty() || !unbounded.empty())
+            return false;
+
+        output_box = nodes[0].box;
+        return true;
+    }
+
+    size_t object_bytes(const Hittable &object)
+    {
+        if(auto list = dynamic_cast<const HittableList*>(&object)) {
+            size_t bytes = sizeof(HittableList) + list->objects.capacity() * sizeof(std::shared_ptr<Hittable>);
+            for(const auto &child : list->objects)
+                bytes += object_bytes(*child);
+            return bytes;
+        }
+        if(auto node = dynamic_cast<const BVHNode*>(&object)) {
+            size_t bytes = sizeof(BVHNode) + object_bytes(*node->left);
+            if(node->right != node->left)
+                bytes += object_bytes(*node->right);
+            return bytes;
+        }
+        if(auto array = dynamic_cast<const PrimitiveArray*>(&object))
+            return sizeof(PrimitiveArray) + array->size() * sizeof(Primitive) + array->node_count() * sizeof(PrimitiveBVHNode);
+        if(auto translate = dynamic_cast<const Translate*>(&object))
+            return sizeof(Translate) + object_bytes(*translate->ptr);
+        if(auto rotate = dynamic_cast<const RotateY*>(&object))
+            return sizeof(RotateY) + object_bytes(*rotate->ptr);
+        if(auto transform = dynamic_cast<const Transform*>(&object))
+            return sizeof(Transform) + object_bytes(*transform->ptr);
+        if(auto box = dynamic_cast<const Box*>(&object))
+            return sizeof(Box) - sizeof(HittableList) + object_bytes(box->sides);
+        if(auto medium = dynamic_cast<const ConstantMedium*>(&object))
+            return sizeof(ConstantMedium) + object_bytes(*medium->boundary);
+        if(auto medium = dynamic_cast<const GridMedium*>(&object))
+            return sizeof(GridMedium) + sizeof(DensityGrid) + medium->grid->size_bytes();
+        if(dynamic_cast<const Sphere*>(&object))
+            return sizeof(Sphere);
+        if(dynamic_cast<const MovingSphere*>(&object))
+            return sizeof(MovingSphere);
+        if(dynamic_cast<const XYRect*>(&object) || dynamic_cast<const XZRect*>(&object) || dynamic_cast<const YZRect*>(&object))
+            return sizeof(XYRect);
+        return sizeof(Hittable);
+    }
+}
@@ -1,418 +1,272 @@
-#include "hittable.hpp"
-#include "vec3.hpp"
-#include <iostream>
 #include <common.hpp>
-#include <memory>
-#include <sphere.hpp>
-#include <color.hpp>
-#include <camera.hpp>
-#include <material.hpp>
-#include <aarect.hpp>
-#include <box.hpp>
-#include <constant_medium.hpp>
-#include <bvh.hpp>
-
-namespace raytracing {
-    Color ray_color(const Ray &r, const Color &background, const Hittable &world, int depth)
-    {
-        // If we've exceeded the ray bounce limit, no more light is gathered.
-        if(depth <= 0)
-            return Color(0, 0, 0);
-
-        HitRecord rec;
-
-        // If the ray hits nothing, return the background color.
-        if(!world.hit(r, 0.001, infinity, rec))
-            return background;
-        
-        Ray scattered;
-        Color attenuation;
-        Color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-
-        if(!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-            return emitted;
-        
-        return emitted + attenuation * ray_color(scattered, background, world, depth - 1);
-    }
-}
-
-raytracing::HittableList random_scene()
-{
-    using namespace raytracing;
-    using std::make_shared;
-
-    HittableList world;
-
-    auto checker =std::make_shared<CheckerTexture>(Color(0.1, 0.1, 0.1), Color(0.9, 0.9, 0.9));
-    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000,std::make_shared<Lambertian>(checker)));
-
-    for(int a = -11; a < 11; a++)
-    {
-        for(int b = -11; b < 11; b++)
-        {
-            auto choose_mat = random_double();
-            Point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-            if ((center - Point3(4, 0.2, 0)).length() > 0.9) {
-                std::shared_ptr<Material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = Color::random() * Color::random();
-                    sphere_material =std::make_shared<Lambertian>(albedo);
-                    world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = Color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material =std::make_shared<Metal>(albedo, fuzz);
-                    world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
-                } else {
-                    // glass
-                    sphere_material =std::make_shared<Dielectric>(1.5);
-                    world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
-                }
-            }
-        }
-    }
-
-    auto material1 =std::make_shared<Dielectric>(1.5);
-    world.add(std::make_shared<Sphere>(Point3(0, 1, 0), 1.0, material1));
-
-    auto material2 =std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
-    world.add(std::make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 =std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-    world.add(std::make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
-
-
-    return world;
-}
-
-raytracing::HittableList two_spheres()
-{
-    using namespace raytracing;
-
-    HittableList objects;
-    auto checker = std::make_shared<CheckerTexture>(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
-
-    objects.add(std::make_shared<Sphere>(Point3(0,-10, 0), 10, std::make_shared<Lambertian>(checker)));
-    objects.add(std::make_shared<Sphere>(Point3(0, 10, 0), 10, std::make_shared<Lambertian>(checker)));
-
-    return objects;
-}
-
-raytracing::HittableList two_perlin_spheres() 
-{
-    using namespace raytracing;
-
-    HittableList objects;
-
-    auto pertext = std::make_shared<NoiseTexture>(4);
-    objects.add(std::make_shared<Sphere>(Point3(0,-1000,0), 1000, std::make_shared<Lambertian>(pertext)));
-    objects.add(std::make_shared<Sphere>(Point3(0, 2, 0), 2, std::make_shared<Lambertian>(pertext)));
-
-    return objects;
-}
-
-raytracing::HittableList earth() 
-{
-    using namespace raytracing;
-
-    auto earth_texture = std::make_shared<ImageTexture>("assets/earthmap.jpg");
-    auto earth_surface = std::make_shared<Lambertian>(earth_texture);
-    auto globe = std::make_shared<Sphere>(Point3(0, 0, 0), 2, earth_surface);
-
-    return HittableList(globe);
-}
-
-raytracing::HittableList simple_light()
-{
-    using namespace raytracing;
-
-    HittableList objects;
-    auto pertext = std::make_shared<NoiseTexture>(4);
-    objects.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(pertext)));
-    objects.add(std::make_shared<Sphere>(Point3(0, 2, 0), 2, std::make_shared<Lambertian>(pertext)));
-
-    auto difflight = std::make_shared<DiffuseLight>(Color(4, 4, 4));
-    objects.add(std::make_shared<XYRect>(3, 5, 1, 3, -2, difflight));
-
-    return objects;
-}
+#include <heatmap.hpp>
+#include <render.hpp>
+#include <scene.hpp>
+#include <scene_binary.hpp>
+#include <scene_file.hpp>
+#include <texture_cache.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
 
-raytracing::HittableList cornell_box()
+static void usage(const char* program)
 {
     using namespace raytracing;
 
-    HittableList objects;
-
-    auto red   = std::make_shared<Lambertian>(Color(0.65, 0.05, 0.05));
-    auto white = std::make_shared<Lambertian>(Color(0.75, 0.75, 0.75));
-    auto green = std::make_shared<Lambertian>(Color(0.12, 0.45, 0.15));
-    auto light = std::make_shared<DiffuseLight>(Color(15, 15, 15));
-
-    objects.add(std::make_shared<YZRect>(0, 555, 0, 555, 555, green));
-    objects.add(std::make_shared<YZRect>(0, 555, 0, 555, 0, red));
-    objects.add(std::make_shared<XZRect>(213, 343, 227, 332, 554, light));
-    objects.add(std::make_shared<XZRect>(0, 555, 0, 555, 0, white));
-    objects.add(std::make_shared<XZRect>(0, 555, 0, 555, 555, white));
-    objects.add(std::make_shared<XYRect>(0, 555, 0, 555, 555, white));
-
-    std::shared_ptr<Hittable> box1 = std::make_shared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
-    box1 = std::make_shared<RotateY>(box1, 15);
-    box1 = std::make_shared<Translate>(box1, Vec3(265, 0, 295));
-    objects.add(box1);
-
-    std::shared_ptr<Hittable> box2 = std::make_shared<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white);
-    box2 = std::make_shared<RotateY>(box2, -18);
-    box2 = std::make_shared<Translate>(box2, Vec3(130, 0, 65));
-    objects.add(box2);
-
-    return objects;
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "\n"
+              << "Options:\n"
+              << "  -s, --scene <name>        scene to render (default: final_scene)\n"
+              << "  -f, --scene-file <path>   load the scene from a text or binary scene file instead\n"
+              << "      --write-scene <path>  convert the scene to a binary scene file and exit\n"
+              << "  -w, --width <pixels>      image width (default: 200)\n"
+              << "  -n, --spp <samples>       samples per pixel (default: the scene's own)\n"
+              << "  -d, --depth <bounces>     maximum path depth (default: 50)\n"
+              << "  -t, --threads <count>     render threads (default: hardware threads)\n"
+              << "      --tile-size <pixels>  edge length of the tiles threads work on (default: 16)\n"
+              << "      --tile-order <order>  scanline | morton | hilbert | cost (default: hilbert)\n"
+              << "      --worker-stats        report busy and idle time per thread\n"
+              << "      --pin-threads         pin render threads to CPUs, spread over NUMA nodes\n"
+              << "      --replicate-scene     give every NUMA node its own copy of the scene\n"
+              << "      --seed <value>        random seed for scene and samples (default: 0)\n"
+              << "      --bake-noise <size>   approximate noise textures by grids of this voxel size\n"
+              << "      --ray-differentials   filter textures over ray differentials instead of ray cones\n"
+              << "      --no-texture-programs look textures up through their trees, uncompiled\n"
+              << "      --texture-cache <MiB> memory for tiles of tiled (.rtt) textures (default: 256)\n"
+              << "      --tile-texture <path> convert an image to a tiled texture next to it and exit\n"
+              << "  -o, --output <path>       PPM output file, `-` for stdout (default: -)\n"
+              << "      --integrator <name>   path | normals (default: path)\n"
+              << "      --accelerator <name>  instances | bvh | list (default: instances)\n"
+              << "      --stats               report ray tracing statistics (needs a STATS=1 build)\n"
+              << "      --heatmap <path>      write the render cost per pixel as a false-color PPM\n"
+              << "      --heatmap-raw <path>  write the render cost per pixel as a float PFM\n"
+              << "      --heatmap-metric <m>  cycles | steps (traversal steps, needs a STATS=1 build) (default: cycles)\n"
+              << "  -q, --quiet               do not report progress\n"
+              << "  -h, --help                show this help\n"
+              << "\n"
+              << "Scenes:\n";
+    for(const auto &name : scene_names())
+        std::cerr << "  " << name << "\n";
 }
 
-raytracing::HittableList cornell_smoke()
+static bool parse_int(const char* arg, int min, int &value)
 {
-    using namespace raytracing;
-
-    HittableList objects;
-
-    auto red   = std::make_shared<Lambertian>(Color(0.65, 0.05, 0.05));
-    auto white = std::make_shared<Lambertian>(Color(0.75, 0.75, 0.75));
-    auto green = std::make_shared<Lambertian>(Color(0.12, 0.45, 0.15));
-    auto light = std::make_shared<DiffuseLight>(Color(7, 7, 7));
-
-    objects.add(std::make_shared<YZRect>(0, 555, 0, 555, 555, green));
-    objects.add(std::make_shared<YZRect>(0, 555, 0, 555, 0, red));
-    objects.add(std::make_shared<XZRect>(113, 443, 127, 432, 554, light));
-    objects.add(std::make_shared<XZRect>(0, 555, 0, 555, 0, white));
-    objects.add(std::make_shared<XZRect>(0, 555, 0, 555, 555, white));
-    objects.add(std::make_shared<XYRect>(0, 555, 0, 555, 555, white));
-
-    std::shared_ptr<Hittable> box1 = std::make_shared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
-    box1 = std::make_shared<RotateY>(box1, 15);
-    box1 = std::make_shared<Translate>(box1, Vec3(265, 0, 295));
-    objects.add(std::make_shared<ConstantMedium>(box1, 0.01, Color(0, 0, 0)));
-
-    std::shared_ptr<Hittable> box2 = std::make_shared<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white);
-    box2 = std::make_shared<RotateY>(box2, -18);
-    box2 = std::make_shared<Translate>(box2, Vec3(130, 0, 65));
-    objects.add(std::make_shared<ConstantMedium>(box2, 0.01, Color(1, 1, 1)));
-
-    return objects;
+    char* end;
+    long parsed = std::strtol(arg, &end, 10);
+    if(*arg == '\0' || *end != '\0' || parsed < min || parsed > std::numeric_limits<int>::max())
+        return false;
+    value = static_cast<int>(parsed);
+    return true;
 }
 
-raytracing::HittableList final_scene()
+int main(int argc, char* argv[])
 {
     using namespace raytracing;
 
-    auto boxes1 = std::make_shared<HittableList>();
-    auto ground = std::make_shared<Lambertian>(Color(0.48, 0.83, 0.53));
-
-    const int boxes_per_side = 20;
-    for(int i = 0; i < boxes_per_side; i++)
+    std::string scene_name = "final_scene";
+    std::string scene_file;
+    std::string binary_output;
+    std::string output = "-";
+    std::string heatmap_output;
+    std::string heatmap_raw_output;
+    std::string heatmap_metric = "cycles";
+    std::string tile_texture;
+    int texture_cache_mib = 0;
+    double noise_voxel_size = 0;
+    bool texture_programs = true;
+    bool print_stats = false;
+    bool print_worker_stats = false;
+    RenderSettings settings;
+
+    for(int i = 1; i < argc; i++)
     {
-        for(int j = 0; j < boxes_per_side; j++)
-        {
-            auto w = 100.0;
-            auto x0 = -1000.0 + i*w;
-            auto z0 = -1000.0 + j*w;
-            auto y0 = 0.0;
-            auto x1 = x0 + w;
-            auto y1 = random_double(1,101);
-            auto z1 = z0 + w;
+        std::string arg = argv[i];
 
-            boxes1->add(std::make_shared<Box>(Point3(x0, y0, z0), Point3(x1, y1, z1), ground));
+        if(arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        }
+        if(arg == "-q" || arg == "--quiet") {
+            settings.progress = false;
+            continue;
+        }
+        if(arg == "--stats") {
+            print_stats = true;
+            continue;
+        }
+        if(arg == "--worker-stats") {
+            print_worker_stats = true;
+            continue;
+        }
+        if(arg == "--pin-threads") {
+            settings.pin_threads = true;
+            continue;
+        }
+        if(arg == "--ray-differentials") {
+            settings.ray_differentials = true;
+            continue;
+        }
+        if(arg == "--no-texture-programs") {
+            texture_programs = false;
+            continue;
+        }
+        if(arg == "--replicate-scene") {
+            settings.replicate_scene = true;
+            continue;
         }
-    }
-
-    HittableList objects;
-    objects.add(boxes1);
-
-    auto light = std::make_shared<DiffuseLight>(Color(7, 7, 7));
-    objects.add(std::make_shared<XZRect>(123, 423, 147, 412, 554, light));
-
-    auto center1 = Point3(400, 400, 200);
-    auto center2 = center1 + Vec3(30,0,0);
-    auto moving_sphere_material =std::make_shared<Lambertian>(Color(0.7, 0.3, 0.1));
-    objects.add(std::make_shared<MovingSphere>(center1, center2, 0, 1, 50, moving_sphere_material));
-
-    objects.add(std::make_shared<Sphere>(Point3(260, 150, 45), 50,std::make_shared<Dielectric>(1.5)));
-    objects.add(std::make_shared<Sphere>(
-        Point3(0, 150, 145), 50,std::make_shared<Metal>(Color(0.8, 0.8, 0.9), 1.0)
-    ));
-
-    auto boundary =std::make_shared<Sphere>(Point3(360,150,145), 70,std::make_shared<Dielectric>(1.5));
-    objects.add(boundary);
-    objects.add(std::make_shared<ConstantMedium>(boundary, 0.2, Color(0.2, 0.4, 0.9)));
-    boundary =std::make_shared<Sphere>(Point3(0, 0, 0), 5000,std::make_shared<Dielectric>(1.5));
-    objects.add(std::make_shared<ConstantMedium>(boundary, .0001, Color(1,1,1)));
-
-    auto emat =std::make_shared<Lambertian>(std::make_shared<ImageTexture>("assets/earthmap.jpg"));
-    objects.add(std::make_shared<Sphere>(Point3(400,200,400), 100, emat));
-    auto pertext =std::make_shared<NoiseTexture>(0.1);
-    objects.add(std::make_shared<Sphere>(Point3(220,280,300), 80,std::make_shared<Lambertian>(pertext)));
-
-    HittableList boxes2;
-    auto white =std::make_shared<Lambertian>(Color(.73, .73, .73));
-    int ns = 1000;
-    for (int j = 0; j < ns; j++) {
-        boxes2.add(std::make_shared<Sphere>(Point3::random(0,165), 10, white));
-    }
-
-    objects.add(std::make_shared<Translate>(
-       std::make_shared<RotateY>(
-           std::make_shared<BVHNode>(boxes2, 0.0, 1.0), 15),
-            Vec3(-100,270,395)
-        )
-    );
 
-    return objects;
-}
+        if(i + 1 >= argc) {
+            std::cerr << "ERROR: Missing value for option `" << arg << "`." << std::endl;
+            usage(argv[0]);
+            return 1;
+        }
+        const char* value = argv[++i];
+
+        bool ok = true;
+        if(arg == "-s" || arg == "--scene")
+            scene_name = value;
+        else if(arg == "-f" || arg == "--scene-file")
+            scene_file = value;
+        else if(arg == "--write-scene")
+            binary_output = value;
+        else if(arg == "-w" || arg == "--width")
+            ok = parse_int(value, 1, settings.image_width);
+        else if(arg == "-n" || arg == "--spp")
+            ok = parse_int(value, 1, settings.samples_per_pixel);
+        else if(arg == "-d" || arg == "--depth")
+            ok = parse_int(value, 1, settings.max_depth);
+        else if(arg == "-t" || arg == "--threads")
+            ok = parse_int(value, 0, settings.threads);
+        else if(arg == "--tile-size")
+            ok = parse_int(value, 1, settings.tile_size);
+        else if(arg == "--tile-order")
+            ok = parse_tile_order(value, settings.tile_order);
+        else if(arg == "--seed") {
+            char* end;
+            settings.seed = std::strtoull(value, &end, 0);
+            ok = *value != '\0' && *end == '\0';
+        }
+        else if(arg == "--bake-noise") {
+            char* end;
+            noise_voxel_size = std::strtod(value, &end);
+            ok = *value != '\0' && *end == '\0' && noise_voxel_size > 0;
+        }
+        else if(arg == "--texture-cache")
+            ok = parse_int(value, 1, texture_cache_mib);
+        else if(arg == "--tile-texture")
+            tile_texture = value;
+        else if(arg == "-o" || arg == "--output")
+            output = value;
+        else if(arg == "--heatmap")
+            heatmap_output = value;
+        else if(arg == "--heatmap-raw")
+            heatmap_raw_output = value;
+        else if(arg == "--heatmap-metric") {
+            heatmap_metric = value;
+            ok = heatmap_metric == "cycles" || heatmap_metric == "steps";
+        }
+        else if(arg == "--integrator")
+            ok = parse_integrator(value, settings.integrator);
+        else if(arg == "--accelerator")
+            ok = parse_accelerator(value, settings.accelerator);
+        else {
+            std::cerr << "ERROR: Unknown option `" << arg << "`." << std::endl;
+            usage(argv[0]);
+            return 1;
+        }
 
-template<size_t SZ>
-void write_framebuffer(std::ostream &out, int image_width, int image_height, raytracing::Color framebuffer[][SZ], int samples_per_pixel)
-{
-    for(int j = image_height - 1; j >= 0; --j)
-    {
-        for(int i = 0; i < image_width; ++i)
-        {
-            write_color(std::cout, framebuffer[j][i], samples_per_pixel);
+        if(!ok) {
+            std::cerr << "ERROR: Invalid value `" << value << "` for option `" << arg << "`." << std::endl;
+            return 1;
         }
     }
-    out << std::flush;
-}
 
+    settings.record_cost = !heatmap_output.empty() || !heatmap_raw_output.empty();
+    if((print_stats || (settings.record_cost && heatmap_metric == "steps")) && !stats_enabled) {
+        std::cerr << "ERROR: Statistics are not available, rebuild with `make clean && make STATS=1`." << std::endl;
+        return 1;
+    }
 
-int main(int argc, char* argv[]) 
-{
-    using namespace raytracing;
+    if(!tile_texture.empty())
+        return write_tiled_texture(tile_texture, tiled_texture_path(tile_texture)) ? 0 : 1;
+    if(texture_cache_mib > 0)
+        texture_cache().set_capacity(static_cast<size_t>(texture_cache_mib) << 20);
 
-    // Image
-    auto aspect_ratio = 3.0 / 2.0;
-    
     // World
-    HittableList world;
-
-    Point3 lookfrom, lookat;
-    auto vfov = 40.0;
-    auto aperture = 0.0;
-    Color background(0,0,0);
-    int samples_per_pixel = 1;
-    const int image_width = 200;
-
-    switch(0) {
-        case 1:
-            world = random_scene();
-            lookfrom = Point3(13, 2, 3);
-            lookat = Point3(0, 0, 0);
-            background = Color(0.70, 0.80, 1.00);
-            vfov = 20.0;
-            aperture = 0.1;
-            break;
-        
-        case 2:
-            world = two_spheres();
-            lookfrom = Point3(13, 2, 3);
-            lookat = Point3(0, 0, 0);
-            background = Color(0.70, 0.80, 1.00);
-            vfov = 20.0;
-            break;
-        
-        case 3:
-            world = two_perlin_spheres();
-            lookfrom = Point3(13, 2, 3);
-            lookat = Point3(0, 0, 0);
-            background = Color(0.70, 0.80, 1.00);
-            vfov = 20.0;
-            break;
-        
-        case 4:
-            world = earth();
-            lookfrom = Point3(13, 2, 3);
-            lookat = Point3(0, 0, 0);
-            background = Color(0.70, 0.80, 1.00);
-            vfov = 20.0;
-            break;
-
-        case 5:
-            world = simple_light();
-            samples_per_pixel = 1000;
-            background = Color(0, 0, 0);
-            lookfrom = Point3(26, 3, 6);
-            lookat = Point3(0, 2, 0);
-            vfov = 20.0;
-            break;
-
-        case 6:
-            world = cornell_box();
-            aspect_ratio = 1.0;
-            samples_per_pixel = 200;
-            background = Color(0, 0, 0);
-            lookfrom = Point3(278, 278, -800);
-            lookat = Point3(278, 278, 0);
-            vfov = 40.0;
-            break;
-
-        case 7:
-            world = cornell_smoke();
-            aspect_ratio = 1.0;
-            samples_per_pixel = 200;
-            background = Color(0, 0, 0);
-            lookfrom = Point3(278, 278, -800);
-            lookat = Point3(278, 278, 0);
-            vfov = 40.0;
-            break;
-
-    	default:
-        case 8:
-            world = final_scene();
-            aspect_ratio = 1.0;
-            samples_per_pixel = 1000;
-            background = Color(0,0,0);
-            lookfrom = Point3(478, 278, -600);
-            lookat = Point3(278, 278, 0);
-            vfov = 40.0;
-            break;
+    auto load_world = [&](Scene &scene) {
+        seed_random(settings.seed);
+        bool loaded = false;
+        if(!scene_file.empty())
+            loaded = is_binary_scene(scene_file) ? load_binary_scene(scene_file, scene) : load_scene_file(scene_file, scene);
+        else
+            loaded = build_scene(scene_name, scene);
+        if(loaded && noise_voxel_size > 0)
+            bake_noise_textures(scene, noise_voxel_size);
+        if(loaded)
+            collapse_transforms(scene);
+        // Binary scene files store the texture trees as they are.
+        if(loaded && texture_programs && binary_output.empty())
+            compile_textures(scene);
+        return loaded;
+    };
+
+    Scene scene;
+    if(!load_world(scene)) {
+        if(scene_file.empty()) {
+            std::cerr << "ERROR: Unknown scene `" << scene_name << "`." << std::endl;
+            usage(argv[0]);
+        }
+        return 1;
     }
+    settings.scene_builder = load_world;
 
-    const int image_height = static_cast<int>(image_width / aspect_ratio);
-    const int max_depth = 50;
-
-    // Camera
-    Vec3 vup(0, 1, 0);
-    auto dist_to_focus = 10.0;
-    Camera cam(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
+    if(!binary_output.empty())
+        return save_binary_scene(scene, scene_file.empty() ? scene_name : scene_file, binary_output) ? 0 : 1;
 
     // Render
-
-    auto framebuffer = new Color[image_height][image_width];
-
-    std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-
-    for(int j = image_height - 1; j >= 0; --j)
-    {
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for(int i = 0; i < image_width; ++i) 
-        {
-            Color pixel_color(0, 0, 0);
-            for(int s = 0; s < samples_per_pixel; ++s) 
-            {
-                auto u = (i + random_double()) / (image_width - 1);
-                auto v = (j + random_double()) / (image_height - 1);
-                Ray r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, background, world, max_depth);
-            }
-            framebuffer[j][i] = pixel_color;
+    Framebuffer framebuffer;
+    RenderStats stats = render(scene, settings, framebuffer);
+
+    if(output == "-")
+        write_framebuffer(std::cout, framebuffer, stats.samples_per_pixel);
+    else {
+        std::ofstream file(output);
+        if(!file) {
+            std::cerr << "ERROR: Could not open output file `" << output << "`." << std::endl;
+            return 1;
         }
+        write_framebuffer(file, framebuffer, stats.samples_per_pixel);
     }
 
-    write_framebuffer(std::cout, image_width, image_height, framebuffer, samples_per_pixel);
-
-    std::cerr << "\nDone.\n";
+    const auto &cost = heatmap_metric == "steps" ? framebuffer.steps : framebuffer.cycles;
+    if(!heatmap_output.empty()) {
+        std::ofstream file(heatmap_output);
+        if(!file) {
+            std::cerr << "ERROR: Could not open heatmap file `" << heatmap_output << "`." << std::endl;
+            return 1;
+        }
+        write_heatmap(file, cost, framebuffer.width, framebuffer.height);
+    }
+    if(!heatmap_raw_output.empty()) {
+        std::ofstream file(heatmap_raw_output, std::ios::binary);
+        if(!file) {
+            std::cerr << "ERROR: Could not open heatmap file `" << heatmap_raw_output << "`." << std::endl;
+            return 1;
+        }
+        write_pfm(file, cost, framebuffer.width, framebuffer.height);
+    }
 
-    delete[] framebuffer;
+    if(settings.progress)
+        std::cerr << "\nDone in " << stats.seconds << "s.\n";
+    if(print_worker_stats)
+        write_worker_stats(std::cerr, stats);
+    if(print_stats)
+        write_counters(std::cerr, stats.counters, stats.samples, stats.rays);
+    auto cache_stats = texture_cache().stats();
+    if(cache_stats.lookups > 0)
+        write_texture_cache_stats(std::cerr, cache_stats);
 
     return 0;
 }
@@ -0,0 +1,34 @@
+#include <mapped_file.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace raytracing {
+    MappedFile::MappedFile(const std::string &path)
+        : bytes(nullptr), length(0)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            return;
+
+        struct stat st;
+        if(fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapping != MAP_FAILED) {
+                bytes = static_cast<const unsigned char*>(mapping);
+                length = st.st_size;
+            }
+        }
+
+        // The mapping stays valid after the descriptor is closed.
+        close(fd);
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if(bytes)
+            munmap(const_cast<unsigned char*>(bytes), length);
+    }
+}
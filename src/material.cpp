@@ -1,11 +1,13 @@
 #include "common.hpp"
 #include <vec3.hpp>
 #include <material.hpp>
+#include <stats.hpp>
 #include <hittable.hpp>
 
 namespace raytracing {
     bool Lambertian::scatter(const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const 
     {
+        STATS_INC(scatter_calls[StatLambertian]);
         auto scatter_direction = rec.normal + random_unit_vector();
 
         // Catch degenerate scatter direction
@@ -13,41 +15,70 @@ namespace raytracing {
             scatter_direction = rec.normal;
 
         scattered = Ray(rec.p, scatter_direction, r_in.time());
-        attenuation = albedo->value(rec.u, rec.v, rec.p);
+        attenuation = albedo->value(rec.u, rec.v, rec.p, rec.duv);
         return true;
     }
 
     bool Metal::scatter(const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const
     {
+        STATS_INC(scatter_calls[StatMetal]);
         Vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
         scattered = Ray(rec.p, reflected + fuzz * random_in_unit_sphere(), r_in.time());
         attenuation = albedo;
-        return dot(scattered.direction(), rec.normal) > 0;
+
+        // The neighbouring rays reflect off the neighbouring normals; fuzz offsets them
+        // like the ray itself.
+        if(r_in.has_differentials) {
+            Vec3 dpdx, dpdy;
+            rec.position_differentials(r_in, dpdx, dpdy);
+            scattered.has_differentials = true;
+            scattered.rx_origin = rec.p + dpdx;
+            scattered.ry_origin = rec.p + dpdy;
+            scattered.rx_direction = scattered.dir + reflect(unit_vector(r_in.rx_direction), unit_vector(rec.normal + rec.curvature * dpdx)) - reflected;
+            scattered.ry_direction = scattered.dir + reflect(unit_vector(r_in.ry_direction), unit_vector(rec.normal + rec.curvature * dpdy)) - reflected;
+        }
+
+        // Fuzz can push the reflection below the surface, where it is absorbed.
+        bool outward = dot(scattered.direction(), rec.normal) > 0;
+        if(!outward)
+            STATS_INC(scatter_absorbed[StatMetal]);
+        return outward;
     }
 
     bool Dielectric::scatter(const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const
     {
         using namespace std;
 
+        STATS_INC(scatter_calls[StatDielectric]);
         attenuation = Color(1.0, 1.0, 1.0);
-        double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
+        real refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
 
         Vec3 unit_direction = unit_vector(r_in.direction());
-        double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-        double sin_theta = sqrt(1.0 - cos_theta * cos_theta); 
+        real cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
+        real sin_theta = sqrt(1.0 - cos_theta * cos_theta); 
 
         bool cannot_refract = refraction_ratio * sin_theta > 1.0;
-        Vec3 direction;
-        if(cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
-            direction = reflect(unit_direction, rec.normal);
-        else
-            direction = refract(unit_direction, rec.normal, refraction_ratio);
+        bool reflects = cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double();
+        auto bounce = [&](const Vec3 &unit_direction, const Vec3 &normal) {
+            return reflects ? reflect(unit_direction, normal) : refract(unit_direction, normal, refraction_ratio);
+        };
+
+        scattered = Ray(rec.p, bounce(unit_direction, rec.normal), r_in.time());
 
-        scattered = Ray(rec.p, direction, r_in.time());
+        // The neighbouring rays take the same branch at the neighbouring normals.
+        if(r_in.has_differentials) {
+            Vec3 dpdx, dpdy;
+            rec.position_differentials(r_in, dpdx, dpdy);
+            scattered.has_differentials = true;
+            scattered.rx_origin = rec.p + dpdx;
+            scattered.ry_origin = rec.p + dpdy;
+            scattered.rx_direction = bounce(unit_vector(r_in.rx_direction), unit_vector(rec.normal + rec.curvature * dpdx));
+            scattered.ry_direction = bounce(unit_vector(r_in.ry_direction), unit_vector(rec.normal + rec.curvature * dpdy));
+        }
         return true;
     }
 
-    double Dielectric::reflectance(double cosine, double ref_idx)
+    real Dielectric::reflectance(real cosine, real ref_idx)
     {
         // Use Schlick's approximation for reflectance.
         auto r0 = (1 - ref_idx) / (1 + ref_idx);
@@ -1,26 +1,116 @@
 #include <perlin.hpp>
 
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <mutex>
+
+#ifdef RAYTRACING_SIMD
+#include <immintrin.h>
+#endif
+
 namespace raytracing {
-    Perlin::Perlin() 
+    PerlinTables::PerlinTables(uint64_t seed)
+    {
+        // A generator of our own, so the tables do not depend on the calling thread's.
+        uint64_t state = mix64(seed);
+        auto next_double = [&state]() { return (mix64(state += 0x9e3779b97f4a7c15ull) >> 11) * 0x1.0p-53; };
+
+        for(int i = 0; i < point_count; ++i) {
+            Vec3 v;
+            for(int axis = 0; axis < 3; ++axis)
+                v[axis] = -1 + 2 * next_double();
+            v = unit_vector(v);
+            for(int axis = 0; axis < 3; ++axis)
+                gradient[axis][i] = static_cast<float>(v[axis]);
+        }
+
+        for(int axis = 0; axis < 4; ++axis) {
+            for(int i = 0; i < point_count; ++i)
+                perm[i][axis] = static_cast<uint8_t>(i);
+            for(int i = point_count - 1; i > 0; --i) {
+                int target = static_cast<int>(next_double() * (i + 1));
+                std::swap(perm[i][axis], perm[target][axis]);
+            }
+        }
+    }
+
+    std::shared_ptr<const PerlinTables> PerlinTables::get(uint64_t seed)
     {
-        ranvec = new Vec3[point_count];
-        for(int i = 0; i < point_count; ++i)
-            ranvec[i] = unit_vector(Vec3::random(-1, 1));
-        
-        perm_x = perlin_generate_perm();
-        perm_y = perlin_generate_perm();
-        perm_z = perlin_generate_perm();
+        static std::mutex mutex;
+        static std::map<uint64_t, std::weak_ptr<const PerlinTables>> cache;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        // Drop the tables nobody holds anymore, or every seed ever drawn keeps an entry.
+        for(auto it = cache.begin(); it != cache.end();)
+            it = it->second.expired() ? cache.erase(it) : std::next(it);
+        auto &entry = cache[seed];
+        auto tables = entry.lock();
+        if(!tables) {
+            tables = std::make_shared<const PerlinTables>(seed);
+            entry = tables;
+        }
+        return tables;
     }
 
-    Perlin::~Perlin() 
+    Perlin::Perlin()
+        : Perlin(random_uint64())
+    {}
+
+    Perlin::Perlin(uint64_t seed)
+        : table_seed(seed), tables(PerlinTables::get(seed))
+    {}
+
+#ifdef RAYTRACING_SIMD
+    real Perlin::noise(const Point3 &p) const
+    {
+        auto fi = floor(p.x()), fj = floor(p.y()), fk = floor(p.z());
+        float u = static_cast<float>(p.x() - fi);
+        float v = static_cast<float>(p.y() - fj);
+        float w = static_cast<float>(p.z() - fk);
+        auto i = static_cast<int>(fi), j = static_cast<int>(fj), k = static_cast<int>(fk);
+
+        // Lane c holds the corner (di, dj, dk) with c = 4 di + 2 dj + dk.
+        const auto &perm = tables->perm;
+        int x0 = perm[i & 255][0], x1 = perm[(i + 1) & 255][0];
+        int y0 = perm[j & 255][1], y1 = perm[(j + 1) & 255][1];
+        int z0 = perm[k & 255][2], z1 = perm[(k + 1) & 255][2];
+        __m256i hash = _mm256_setr_epi32(x0 ^ y0 ^ z0, x0 ^ y0 ^ z1, x0 ^ y1 ^ z0, x0 ^ y1 ^ z1,
+                                         x1 ^ y0 ^ z0, x1 ^ y0 ^ z1, x1 ^ y1 ^ z0, x1 ^ y1 ^ z1);
+        __m256 gx = _mm256_i32gather_ps(tables->gradient[0], hash, 4);
+        __m256 gy = _mm256_i32gather_ps(tables->gradient[1], hash, 4);
+        __m256 gz = _mm256_i32gather_ps(tables->gradient[2], hash, 4);
+
+        const __m256 di = _mm256_setr_ps(0, 0, 0, 0, 1, 1, 1, 1);
+        const __m256 dj = _mm256_setr_ps(0, 0, 1, 1, 0, 0, 1, 1);
+        const __m256 dk = _mm256_setr_ps(0, 1, 0, 1, 0, 1, 0, 1);
+
+        // Dot products of the gradients with the offsets from their corners.
+        __m256 ox = _mm256_sub_ps(_mm256_set1_ps(u), di);
+        __m256 oy = _mm256_sub_ps(_mm256_set1_ps(v), dj);
+        __m256 oz = _mm256_sub_ps(_mm256_set1_ps(w), dk);
+        __m256 dots = _mm256_fmadd_ps(gx, ox, _mm256_fmadd_ps(gy, oy, _mm256_mul_ps(gz, oz)));
+
+        // Hermite weights: uu for the far corners, 1 - uu for the near ones.
+        auto weights = [](float t, __m256 far) {
+            float tt = t * t * (3 - 2 * t);
+            return _mm256_fmadd_ps(far, _mm256_set1_ps(2 * tt - 1), _mm256_set1_ps(1 - tt));
+        };
+        __m256 weighted = _mm256_mul_ps(dots, _mm256_mul_ps(weights(u, di), _mm256_mul_ps(weights(v, dj), weights(w, dk))));
+
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(weighted), _mm256_extractf128_ps(weighted, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+        return _mm_cvtss_f32(sum);
+    }
+#else
+    real Perlin::noise(const Point3 &p) const
     {
-        delete[] ranvec;
-        delete[] perm_x;
-        delete[] perm_y;
-        delete[] perm_z;
+        return scalar_noise(p);
     }
+#endif
 
-    double Perlin::noise(const Point3 &p) const 
+    real Perlin::scalar_noise(const Point3 &p) const 
     {
         auto u = p.x() - floor(p.x());
         auto v = p.y() - floor(p.y());
@@ -31,16 +121,20 @@ namespace raytracing {
         auto k = static_cast<int>(floor(p.z()));
 
         Vec3 c[2][2][2];
+        const auto &perm = tables->perm;
+        const auto &gradient = tables->gradient;
 
         for (int di = 0; di < 2; di++)
             for (int dj = 0; dj < 2; dj++)
-                for (int dk = 0; dk < 2; dk++)
-                    c[di][dj][dk] = ranvec[perm_x[(i + di) & 255] ^ perm_y[(j + dj) & 255] ^ perm_z[(k + dk) & 255]];
+                for (int dk = 0; dk < 2; dk++) {
+                    int h = perm[(i + di) & 255][0] ^ perm[(j + dj) & 255][1] ^ perm[(k + dk) & 255][2];
+                    c[di][dj][dk] = Vec3(gradient[0][h], gradient[1][h], gradient[2][h]);
+                }
 
         return perlin_interp(c, u, v, w);
     }
 
-    double Perlin::turb(const Point3 &p, int depth) const
+    real Perlin::turb(const Point3 &p, int depth) const
     {
         auto accum = 0.0;
         auto temp_p = p;
@@ -56,30 +150,7 @@ namespace raytracing {
         return fabs(accum);
     }
 
-    int* Perlin::perlin_generate_perm()
-    {
-        auto p = new int[point_count];
-
-        for(int i = 0; i < Perlin::point_count; i++)
-            p[i] = i;
-
-        permute(p, point_count);
-
-        return p;    
-    }
-
-    void Perlin::permute(int* p, int n)
-    {
-        for(int i = n - 1; i > 0; i--)
-        {
-            int target = random_int(0, i);
-            int tmp = p[i];
-            p[i] = p[target];
-            p[target] = tmp;
-        }
-    }
-
-    double Perlin::trilinear_interp(double c[2][2][2], double u, double v, double w) 
+    real Perlin::trilinear_interp(real c[2][2][2], real u, real v, real w) 
     {
         auto accum = 0.0;
         for (int i = 0; i < 2; i++)
@@ -89,7 +160,7 @@ namespace raytracing {
         return accum;
     }
 
-    double Perlin::perlin_interp(Vec3 c[2][2][2], double u, double v, double w) 
+    real Perlin::perlin_interp(Vec3 c[2][2][2], real u, real v, real w) 
     {
         auto uu = u * u * (3 - 2 * u);
         auto vv = v * v * (3 - 2 * v);
@@ -104,4 +175,58 @@ namespace raytracing {
                 }
         return accum;
     }
-}
\ No newline at end of file
+
+    size_t NoiseVolume::sample_count(const AABB &bounds, real voxel_size)
+    {
+        // One voxel of margin on every side, for hit points just outside the bounds.
+        size_t count = 1;
+        for(int axis = 0; axis < 3; axis++)
+            count *= static_cast<size_t>(std::ceil((bounds.max()[axis] - bounds.min()[axis]) / voxel_size)) + 3;
+        return count;
+    }
+
+    NoiseVolume::NoiseVolume(const Perlin &noise, const AABB &bounds, real voxel_size, int depth)
+        : inv_voxel_size(1 / voxel_size)
+    {
+        Vec3 margin(voxel_size, voxel_size, voxel_size);
+        origin = bounds.min() - margin;
+        end = bounds.max() + margin;
+        nx = static_cast<int>(std::ceil((bounds.max().x() - bounds.min().x()) / voxel_size)) + 3;
+        ny = static_cast<int>(std::ceil((bounds.max().y() - bounds.min().y()) / voxel_size)) + 3;
+        nz = static_cast<int>(std::ceil((bounds.max().z() - bounds.min().z()) / voxel_size)) + 3;
+
+        samples.resize(static_cast<size_t>(nx) * ny * nz);
+        size_t index = 0;
+        for(int k = 0; k < nz; k++)
+            for(int j = 0; j < ny; j++)
+                for(int i = 0; i < nx; i++)
+                    samples[index++] = static_cast<float>(noise.turb(origin + voxel_size * Vec3(i, j, k), depth));
+    }
+
+    bool NoiseVolume::contains(const Point3 &p) const
+    {
+        return p.x() >= origin.x() && p.y() >= origin.y() && p.z() >= origin.z()
+            && p.x() <= end.x() && p.y() <= end.y() && p.z() <= end.z();
+    }
+
+    real NoiseVolume::turb(const Point3 &p) const
+    {
+        real c[2][2][2];
+        real f[3];
+        int cell[3];
+        const int n[3] = {nx, ny, nz};
+        for(int axis = 0; axis < 3; axis++) {
+            // Points outside the volume take the value at its border.
+            real x = std::clamp((p[axis] - origin[axis]) * inv_voxel_size, real(0), real(n[axis] - 1));
+            cell[axis] = std::min(static_cast<int>(x), n[axis] - 2);
+            f[axis] = x - cell[axis];
+        }
+
+        const float* base = &samples[(static_cast<size_t>(cell[2]) * ny + cell[1]) * nx + cell[0]];
+        for(int dk = 0; dk < 2; dk++)
+            for(int dj = 0; dj < 2; dj++)
+                for(int di = 0; di < 2; di++)
+                    c[di][dj][dk] = base[(static_cast<size_t>(dk) * ny + dj) * nx + di];
+        return Perlin::trilinear_interp(c, f[0], f[1], f[2]);
+    }
+}
@@ -0,0 +1,287 @@
+#include <primitive.hpp>
+#include <aarect.hpp>
+#include <box.hpp>
+#include <sphere.hpp>
+#include <stats.hpp>
+
+#include <algorithm>
+
+namespace raytracing {
+    Primitive Primitive::sphere(const Point3 &center, real radius, uint32_t material)
+    {
+        return Primitive{PrimitiveType::Sphere, material, {center.x(), center.y(), center.z(), radius}};
+    }
+
+    Primitive Primitive::moving_sphere(const Point3 &center0, const Point3 &center1, double time0, double time1, real radius, uint32_t material)
+    {
+        // Store the center at time 0 and the velocity, so center(t) = c + t * v.
+        auto velocity = (center1 - center0) / (time1 - time0);
+        auto c = center0 - time0 * velocity;
+        return Primitive{PrimitiveType::MovingSphere, material, {c.x(), c.y(), c.z(), velocity.x(), velocity.y(), velocity.z(), radius}};
+    }
+
+    Primitive Primitive::rect(PrimitiveType type, real a0, real a1, real b0, real b1, real k, uint32_t material)
+    {
+        return Primitive{type, material, {a0, a1, b0, b1, k}};
+    }
+
+    Primitive Primitive::box(const Point3 &p0, const Point3 &p1, uint32_t material)
+    {
+        return Primitive{PrimitiveType::Box, material, {p0.x(), p0.y(), p0.z(), p1.x(), p1.y(), p1.z()}};
+    }
+
+    AABB Primitive::bounds(double time0, double time1) const
+    {
+        const auto &d = data;
+        switch(type) {
+            case PrimitiveType::Sphere: {
+                Vec3 r(d[3], d[3], d[3]);
+                return AABB(Point3(d[0], d[1], d[2]) - r, Point3(d[0], d[1], d[2]) + r);
+            }
+            case PrimitiveType::MovingSphere: {
+                Vec3 r(d[6], d[6], d[6]);
+                Point3 c0 = Point3(d[0], d[1], d[2]) + time0 * Vec3(d[3], d[4], d[5]);
+                Point3 c1 = Point3(d[0], d[1], d[2]) + time1 * Vec3(d[3], d[4], d[5]);
+                return surrounding_box(AABB(c0 - r, c0 + r), AABB(c1 - r, c1 + r));
+            }
+            // Rectangles are padded like their Hittable counterparts.
+            case PrimitiveType::XYRect:
+                return AABB(Point3(d[0], d[2], d[4] - 0.0001), Point3(d[1], d[3], d[4] + 0.0001));
+            case PrimitiveType::XZRect:
+                return AABB(Point3(d[0], d[4] - 0.0001, d[2]), Point3(d[1], d[4] + 0.0001, d[3]));
+            case PrimitiveType::YZRect:
+                return AABB(Point3(d[4] - 0.0001, d[0], d[2]), Point3(d[4] + 0.0001, d[1], d[3]));
+            case PrimitiveType::Box:
+                return AABB(Point3(d[0], d[1], d[2]), Point3(d[3], d[4], d[5]));
+        }
+        return AABB();
+    }
+
+#ifdef RAYTRACING_STATS
+    static StatPrimitive stat_primitive(PrimitiveType type)
+    {
+        switch(type) {
+            case PrimitiveType::Sphere:       return StatSphere;
+            case PrimitiveType::MovingSphere: return StatMovingSphere;
+            case PrimitiveType::Box:          return StatBox;
+            default:                          return StatRect;
+        }
+    }
+#endif
+
+    bool Primitive::hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const
+    {
+        STATS_INC(primitive_tests[stat_primitive(type)]);
+
+        const auto &d = data;
+        bool hit = false;
+        switch(type) {
+            case PrimitiveType::Sphere:
+                hit = hit_sphere(Point3(d[0], d[1], d[2]), d[3], r, t_min, t_max, rec);
+                break;
+            case PrimitiveType::MovingSphere:
+                hit = hit_sphere(Point3(d[0], d[1], d[2]) + r.time() * Vec3(d[3], d[4], d[5]), d[6], r, t_min, t_max, rec);
+                break;
+            case PrimitiveType::XYRect:
+                hit = hit_xy_rect(d[0], d[1], d[2], d[3], d[4], r, t_min, t_max, rec);
+                break;
+            case PrimitiveType::XZRect:
+                hit = hit_xz_rect(d[0], d[1], d[2], d[3], d[4], r, t_min, t_max, rec);
+                break;
+            case PrimitiveType::YZRect:
+                hit = hit_yz_rect(d[0], d[1], d[2], d[3], d[4], r, t_min, t_max, rec);
+                break;
+            case PrimitiveType::Box:
+                hit = hit_box(Point3(d[0], d[1], d[2]), Point3(d[3], d[4], d[5]), r, t_min, t_max, rec);
+                break;
+        }
+
+        if(hit)
+            STATS_INC(primitive_hits[stat_primitive(type)]);
+        return hit;
+    }
+
+    PrimitiveArray::PrimitiveArray(std::vector<Primitive> prims, std::vector<std::shared_ptr<Material>> mats, double time0, double time1)
+        : materials(std::move(mats)), owned_primitives(std::move(prims))
+    {
+        build(time0, time1);
+
+        primitive_data = owned_primitives.data();
+        primitive_count = owned_primitives.size();
+        bvh_nodes = owned_nodes.data();
+        bvh_node_count = owned_nodes.size();
+    }
+
+    PrimitiveArray::PrimitiveArray(const Primitive* prims, size_t count, const PrimitiveBVHNode* nodes, size_t node_count,
+                                   std::vector<std::shared_ptr<Material>> mats)
+        : materials(std::move(mats)), primitive_data(prims), primitive_count(count), bvh_nodes(nodes), bvh_node_count(node_count)
+    {}
+
+    bool PrimitiveArray::hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const
+    {
+        if(bvh_node_count == 0)
+            return false;
+
+        bool hit_anything = false;
+        auto closest_so_far = t_max;
+
+        uint32_t stack[max_bvh_depth];
+        int stack_size = 0;
+        uint32_t index = 0;
+
+        while(true) {
+            const auto &node = bvh_nodes[index];
+            STATS_INC(bvh_nodes);
+            if(node.box.hit(r, t_min, closest_so_far)) {
+                if(node.count == 0) {
+                    // Visit the child on the near side of the split plane first.
+                    uint32_t first = index + 1, second = node.offset;
+                    if(r.direction()[node.axis] < 0)
+                        std::swap(first, second);
+                    stack[stack_size++] = second;
+                    index = first;
+                    continue;
+                }
+
+                for(uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                    const auto &prim = primitive_data[i];
+                    if(prim.hit(r, t_min, closest_so_far, rec)) {
+                        hit_anything = true;
+                        closest_so_far = rec.t;
+                        rec.mat_ptr = materials[prim.material];
+                    }
+                }
+            }
+
+            if(stack_size == 0)
+                break;
+            index = stack[--stack_size];
+        }
+
+        return hit_anything;
+    }
+
+    bool PrimitiveArray::bounding_box(double time0, double time1, AABB &output_box) const
+    {
+        if(bvh_node_count == 0)
+            return false;
+
+        output_box = bvh_nodes[0].box;
+        return true;
+    }
+
+    void PrimitiveArray::build(double time0, double time1)
+    {
+        const size_t n = owned_primitives.size();
+        if(n == 0)
+            return;
+
+        std::vector<AABB> bounds(n);
+        for(size_t i = 0; i < n; i++)
+            bounds[i] = owned_primitives[i].bounds(time0, time1);
+        std::vector<uint32_t> order;
+        build_bvh_nodes(bounds, 4, owned_nodes, order);
+
+        std::vector<Primitive> sorted(n);
+        for(size_t i = 0; i < n; i++)
+            sorted[i] = owned_primitives[order[i]];
+        owned_primitives.swap(sorted);
+    }
+
+    void build_bvh_nodes(const std::vector<AABB> &bounds, size_t max_leaf_size, std::vector<PrimitiveBVHNode> &nodes,
+                         std::vector<uint32_t> &order)
+    {
+        const size_t n = bounds.size();
+        nodes.clear();
+        order.clear();
+        if(n == 0)
+            return;
+
+        // Only the centroids are needed to partition. Keeping them next to the
+        // item index makes the partitioning passes run over contiguous memory.
+        struct BuildItem { Point3 centroid; uint32_t index; };
+        std::vector<BuildItem> items(n);
+        for(size_t i = 0; i < n; i++)
+            items[i] = {0.5 * (bounds[i].min() + bounds[i].max()), static_cast<uint32_t>(i)};
+
+        nodes.reserve(n);
+
+        // Split along the widest centroid axis, depth first so that the left child
+        // of every interior node directly follows it.
+        const size_t unallocated = static_cast<size_t>(-1);
+        struct Task { size_t node, parent, begin, end; int depth; };
+        std::vector<Task> tasks;
+        tasks.push_back({unallocated, unallocated, 0, n, 0});
+
+        while(!tasks.empty()) {
+            Task task = tasks.back();
+            tasks.pop_back();
+
+            // Right children are allocated once their left sibling's subtree is complete.
+            if(task.node == unallocated) {
+                task.node = nodes.size();
+                nodes.emplace_back();
+                if(task.parent != unallocated)
+                    nodes[task.parent].offset = static_cast<uint32_t>(task.node);
+            }
+
+            size_t count = task.end - task.begin;
+            if(count <= max_leaf_size) {
+                nodes[task.node].offset = static_cast<uint32_t>(task.begin);
+                nodes[task.node].count = static_cast<uint16_t>(count);
+                nodes[task.node].axis = 0;
+                continue;
+            }
+
+            Point3 lo = items[task.begin].centroid, hi = lo;
+            for(size_t i = task.begin + 1; i < task.end; i++) {
+                for(int a = 0; a < 3; a++) {
+                    lo[a] = std::min(lo[a], items[i].centroid[a]);
+                    hi[a] = std::max(hi[a], items[i].centroid[a]);
+                }
+            }
+            Vec3 extent = hi - lo;
+            int axis = extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2) : (extent.y() > extent.z() ? 1 : 2);
+
+            // Split at the spatial middle of the centroids, which takes one partitioning
+            // pass; fall back to the median if that leaves one side (nearly) empty, as it
+            // does for items with the same centroid. Past half the depth traversals allow,
+            // every split is at the median: it halves the items, and 32 halvings take
+            // any number of them that 32-bit indices can address down to one.
+            real split = 0.5 * (lo[axis] + hi[axis]);
+            auto middle = std::partition(items.begin() + task.begin, items.begin() + task.end,
+                [axis, split](const BuildItem &item) { return item.centroid[axis] < split; });
+            size_t mid = middle - items.begin();
+            const size_t min_side = std::max<size_t>(1, count / 8);
+            if(task.depth >= max_bvh_depth / 2 || mid - task.begin < min_side || task.end - mid < min_side) {
+                mid = task.begin + count / 2;
+                std::nth_element(items.begin() + task.begin, items.begin() + mid, items.begin() + task.end,
+                    [axis](const BuildItem &a, const BuildItem &b) { return a.centroid[axis] < b.centroid[axis]; });
+            }
+
+            nodes[task.node].count = 0;
+            nodes[task.node].axis = static_cast<uint16_t>(axis);
+
+            size_t left = nodes.size();
+            nodes.emplace_back();
+            tasks.push_back({unallocated, task.node, mid, task.end, task.depth + 1});
+            tasks.push_back({left, task.node, task.begin, mid, task.depth + 1});
+        }
+
+        order.resize(n);
+        for(size_t i = 0; i < n; i++)
+            order[i] = items[i].index;
+
+        // Children always come after their parent, so a reverse sweep fits the boxes bottom up.
+        for(size_t i = nodes.size(); i-- > 0;) {
+            auto &node = nodes[i];
+            if(node.count == 0) {
+                node.box = surrounding_box(nodes[i + 1].box, nodes[node.offset].box);
+                continue;
+            }
+            node.box = bounds[order[node.offset]];
+            for(uint32_t j = node.offset + 1; j < node.offset + node.count; j++)
+                node.box = surrounding_box(node.box, bounds[order[j]]);
+        }
+    }
+}
@@ -0,0 +1,400 @@
+#include <render.hpp>
+#include <bvh.hpp>
+#include <camera.hpp>
+#include <color.hpp>
+#include <instance.hpp>
+#include <material.hpp>
+#include <stats.hpp>
+#include <tiles.hpp>
+#include <topology.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace raytracing {
+    bool parse_integrator(const std::string &name, Integrator &integrator)
+    {
+        if(name == "path")
+            integrator = Integrator::Path;
+        else if(name == "normals")
+            integrator = Integrator::Normals;
+        else
+            return false;
+        return true;
+    }
+
+    bool parse_accelerator(const std::string &name, Accelerator &accelerator)
+    {
+        if(name == "instances")
+            accelerator = Accelerator::Instances;
+        else if(name == "bvh")
+            accelerator = Accelerator::BVH;
+        else if(name == "list")
+            accelerator = Accelerator::List;
+        else
+            return false;
+        return true;
+    }
+
+    Color ray_color(const Ray &r, const Color &background, const Hittable &world, int depth, uint64_t &rays)
+    {
+        // If we've exceeded the ray bounce limit, no more light is gathered.
+        if(depth <= 0) {
+            STATS_INC(paths_truncated);
+            return Color(0, 0, 0);
+        }
+
+        HitRecord rec;
+        rays++;
+
+        // If the ray hits nothing, return the background color.
+        if(!world.hit(r, 0, infinity, rec)) {
+            STATS_INC(paths_escaped);
+            return background;
+        }
+
+        Ray scattered;
+        Color attenuation;
+        Color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+
+        if(!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
+            STATS_INC(paths_absorbed);
+            return emitted;
+        }
+        scattered.orig = offset_ray_origin(rec.p, rec.p_error, rec.normal, scattered.direction());
+        // The scattered ray continues the cone at the angle it had (ignoring the
+        // surface's curvature), rescaled to the length of its own direction.
+        if(r.spread > 0) {
+            scattered.width = r.footprint(rec.t);
+            scattered.spread = r.spread * scattered.direction().length() / r.direction().length();
+        }
+
+        return emitted + attenuation * ray_color(scattered, background, world, depth - 1, rays);
+    }
+
+    static Color normal_color(const Ray &r, const Color &background, const Hittable &world, uint64_t &rays)
+    {
+        HitRecord rec;
+        rays++;
+        if(!world.hit(r, 0, infinity, rec))
+            return background;
+        return 0.5 * (rec.normal + Color(1, 1, 1));
+    }
+
+    // BVHNode builds (also of the groups instances share) draw random split axes, so
+    // seed them like the pixels.
+    static std::shared_ptr<Hittable> build_accelerator(const Scene &scene, const RenderSettings &settings)
+    {
+        if(settings.accelerator == Accelerator::List || scene.world.objects.empty())
+            return nullptr;
+        seed_random(settings.seed, ~0ull);
+        if(settings.accelerator == Accelerator::Instances)
+            return std::make_shared<InstanceBVH>(scene.world, 0.0, 1.0);
+        return std::make_shared<BVHNode>(scene.world, 0.0, 1.0);
+    }
+
+    RenderStats render(const Scene &scene, const RenderSettings &settings, Framebuffer &framebuffer)
+    {
+        RenderStats stats;
+        stats.samples_per_pixel = settings.samples_per_pixel > 0 ? settings.samples_per_pixel : scene.samples_per_pixel;
+        stats.threads = settings.threads > 0 ? settings.threads : static_cast<int>(std::thread::hardware_concurrency());
+        if(stats.threads < 1)
+            stats.threads = 1;
+
+        const int image_width = settings.image_width;
+        const int image_height = static_cast<int>(image_width / scene.aspect_ratio);
+        const int samples_per_pixel = stats.samples_per_pixel;
+        framebuffer.resize(image_width, image_height);
+        const bool record_cost = settings.record_cost;
+        const bool record_steps = stats_enabled && record_cost;
+        if(record_cost)
+            framebuffer.cycles.assign(static_cast<size_t>(image_width) * image_height, 0.0f);
+        if(record_steps)
+            framebuffer.steps.assign(static_cast<size_t>(image_width) * image_height, 0.0f);
+
+        const CpuTopology &topology = cpu_topology();
+        stats.numa_nodes = static_cast<int>(topology.nodes.size());
+
+        std::shared_ptr<Hittable> bvh = build_accelerator(scene, settings);
+        const Hittable &shared_world = bvh ? *bvh : static_cast<const Hittable&>(scene.world);
+        if(auto instances = std::dynamic_pointer_cast<InstanceBVH>(bvh)) {
+            stats.instances = instances->stats();
+            if(settings.progress)
+                write_instance_stats(std::cerr, stats.instances);
+        }
+
+        // Scene replicas are built by a thread pinned to their node, so first-touch
+        // allocation puts the objects, primitive arrays, BVH and textures in its memory.
+        // The texture scope keeps the replica from sharing the decoded images of the
+        // shared scene, and decodes its own on the pinned thread. Tiled textures stay in
+        // the one texture cache.
+        struct SceneReplica {
+            Scene scene;
+            std::shared_ptr<Hittable> bvh;
+            bool ok = false;
+        };
+        std::vector<SceneReplica> replicas;
+        if(settings.replicate_scene && settings.scene_builder) {
+            auto replicate_start = std::chrono::steady_clock::now();
+            replicas.resize(topology.nodes.size());
+            std::vector<std::thread> builders;
+            for(size_t node = 0; node < replicas.size(); node++)
+                builders.emplace_back([&, node] {
+                    pin_current_thread(topology.nodes[node].front());
+                    SceneReplica &replica = replicas[node];
+                    TextureScope textures;
+                    replica.ok = settings.scene_builder(replica.scene);
+                    if(replica.ok)
+                        replica.bvh = build_accelerator(replica.scene, settings);
+                });
+            for(auto &builder : builders)
+                builder.join();
+
+            for(const auto &replica : replicas)
+                if(!replica.ok) {
+                    std::cerr << "ERROR: Could not build a scene replica, rendering from the shared scene." << std::endl;
+                    replicas.clear();
+                    break;
+                }
+            stats.scene_replicas = static_cast<int>(replicas.size());
+            stats.replicate_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - replicate_start).count();
+        }
+
+        // Textures decode on the loader's threads while the scene and its BVH are built.
+        auto texture_wait_start = std::chrono::steady_clock::now();
+        stats.texture_decodes = texture_loader().wait();
+        stats.texture_wait_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - texture_wait_start).count();
+        if(settings.progress)
+            write_texture_decodes(std::cerr, stats.texture_decodes);
+
+        auto world_of_thread = [&](int thread_index) -> const Hittable& {
+            if(replicas.empty())
+                return shared_world;
+            const SceneReplica &replica = replicas[topology.node_of_thread(thread_index)];
+            return replica.bvh ? *replica.bvh : static_cast<const Hittable&>(replica.scene.world);
+        };
+
+        Camera cam = scene.camera();
+        cam.set_pixel_footprint(image_width, image_height, samples_per_pixel, settings.ray_differentials);
+        auto render_pixel = [&](const Hittable &world, int i, int j, int samples, uint64_t &rays) {
+            Color pixel_color(0, 0, 0);
+            for(int s = 0; s < samples; ++s)
+            {
+                auto u = (i + random_double()) / (image_width - 1);
+                auto v = (j + random_double()) / (image_height - 1);
+                Ray r = cam.get_ray(u, v);
+                if(settings.integrator == Integrator::Normals)
+                    pixel_color += normal_color(r, scene.background, world, rays);
+                else
+                    pixel_color += ray_color(r, scene.background, world, settings.max_depth, rays);
+            }
+            return pixel_color;
+        };
+
+        const std::vector<Tile> tiles = make_tiles(image_width, image_height, settings.tile_size);
+        const int columns = (image_width + settings.tile_size - 1) / settings.tile_size;
+
+        // Runs `work(thread_index)` on all threads. Pinned workers all get a new thread,
+        // so the caller's own affinity is left alone.
+        auto run_workers = [&](auto &&work) {
+            std::vector<std::thread> threads;
+            if(settings.pin_threads) {
+                for(int t = 0; t < stats.threads; t++)
+                    threads.emplace_back([&, t] {
+                        pin_current_thread(topology.cpu_of_thread(t));
+                        work(t);
+                    });
+            }
+            else {
+                for(int t = 1; t < stats.threads; t++)
+                    threads.emplace_back(work, t);
+                work(0);
+            }
+            for(auto &thread : threads)
+                thread.join();
+        };
+
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<uint32_t> order;
+        if(settings.tile_order == TileOrder::Cost) {
+            // Estimate the cost of every tile from one sample on every fourth pixel in
+            // each direction, then render the most expensive tiles first.
+            std::vector<uint64_t> cost(tiles.size(), 0);
+            std::atomic<size_t> next_tile(0);
+            run_workers([&](int thread_index) {
+                const Hittable &world = world_of_thread(thread_index);
+                uint64_t rays = 0;
+                size_t t;
+                while((t = next_tile++) < tiles.size()) {
+                    const Tile &tile = tiles[t];
+                    uint64_t cycles_before = read_cycle_counter();
+                    for(int j = tile.y0; j < tile.y1; j += 4)
+                        for(int i = tile.x0; i < tile.x1; i += 4) {
+                            seed_random(~settings.seed, static_cast<uint64_t>(j) * image_width + i);
+                            render_pixel(world, i, j, 1, rays);
+                        }
+                    cost[t] = read_cycle_counter() - cycles_before;
+                }
+            });
+            order = spatial_tile_order(tiles.size(), columns, TileOrder::Scanline);
+            std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return cost[a] > cost[b]; });
+            stats.prepass_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        else
+            order = spatial_tile_order(tiles.size(), columns, settings.tile_order);
+
+        // Cost order deals the expensive tiles round-robin so every worker starts on
+        // some; the spatial orders give each worker a compact run of the curve.
+        TileScheduler scheduler(order, stats.threads, settings.tile_order != TileOrder::Cost);
+        stats.workers.assign(stats.threads, WorkerStats());
+
+        std::atomic<int> tiles_remaining(static_cast<int>(tiles.size()));
+        std::atomic<uint64_t> total_rays(0);
+        std::mutex progress_mutex;
+        std::mutex counters_mutex;
+
+        // Every pixel reseeds the generator from its index, so the image depends
+        // neither on the thread count nor on the tile size and order.
+        auto worker = [&](int thread_index) {
+            const Hittable &world = world_of_thread(thread_index);
+            uint64_t rays = 0;
+            thread_counters = RenderCounters();
+            WorkerStats &worker_stats = stats.workers[thread_index];
+
+            // Samples accumulate in a tile buffer allocated (and so first touched) by this
+            // thread, which keeps it in the thread's NUMA node. The shared framebuffer is
+            // only written once per tile.
+            std::vector<Color> tile_pixels(static_cast<size_t>(settings.tile_size) * settings.tile_size);
+
+            uint32_t t;
+            while(scheduler.next(thread_index, t))
+            {
+                auto tile_start = std::chrono::steady_clock::now();
+                const Tile &tile = tiles[t];
+                const int tile_width = tile.x1 - tile.x0;
+                for(int j = tile.y0; j < tile.y1; ++j)
+                {
+                    for(int i = tile.x0; i < tile.x1; ++i)
+                    {
+                        const size_t pixel = static_cast<size_t>(j) * image_width + i;
+                        uint64_t steps_before = record_steps ? thread_counters.traversal_steps() : 0;
+                        uint64_t cycles_before = record_cost ? read_cycle_counter() : 0;
+
+                        seed_random(settings.seed, pixel);
+                        tile_pixels[(j - tile.y0) * tile_width + (i - tile.x0)] = render_pixel(world, i, j, samples_per_pixel, rays);
+
+                        if(record_cost)
+                            framebuffer.cycles[pixel] = static_cast<float>(read_cycle_counter() - cycles_before);
+                        if(record_steps)
+                            framebuffer.steps[pixel] = static_cast<float>(thread_counters.traversal_steps() - steps_before);
+                    }
+                }
+                for(int j = tile.y0; j < tile.y1; ++j)
+                    std::copy_n(&tile_pixels[(j - tile.y0) * tile_width], tile_width, &framebuffer.at(tile.x0, j));
+                worker_stats.busy_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - tile_start).count();
+                worker_stats.tiles++;
+
+                int remaining = --tiles_remaining;
+                if(settings.progress) {
+                    std::lock_guard<std::mutex> lock(progress_mutex);
+                    std::cerr << "\rTiles remaining: " << remaining << ' ' << std::flush;
+                }
+            }
+            worker_stats.steals = scheduler.steals(thread_index);
+
+            total_rays += rays;
+            if(stats_enabled) {
+                std::lock_guard<std::mutex> lock(counters_mutex);
+                stats.counters += thread_counters;
+            }
+        };
+
+        auto render_start = std::chrono::steady_clock::now();
+        run_workers(worker);
+        auto end = std::chrono::steady_clock::now();
+
+        const double render_seconds = std::chrono::duration<double>(end - render_start).count();
+        for(auto &w : stats.workers)
+            w.idle_seconds = std::max(0.0, render_seconds - w.busy_seconds);
+
+        stats.seconds = std::chrono::duration<double>(end - start).count();
+        stats.samples = static_cast<uint64_t>(image_width) * image_height * samples_per_pixel;
+        stats.rays = total_rays;
+        return stats;
+    }
+
+    void write_instance_stats(std::ostream &out, const InstanceStats &stats)
+    {
+        const double mib = 1024.0 * 1024.0;
+        char line[160];
+        std::snprintf(line, sizeof(line), "Instances: %zu of %zu geometries (%.2f MiB), %.2f MiB of instance records",
+                      stats.instances, stats.geometries, stats.geometry_bytes / mib, stats.instance_bytes / mib);
+        out << line;
+        // Copies would take the records' place and the geometries' own memory.
+        if(stats.instances > stats.geometries) {
+            double copies = static_cast<double>(stats.duplicated_bytes);
+            double saved = copies - stats.geometry_bytes - stats.instance_bytes;
+            std::snprintf(line, sizeof(line), " instead of %.2f MiB of copies, %.2f MiB saved", copies / mib, saved / mib);
+            out << line;
+        }
+        out << "\n";
+    }
+
+    void write_worker_stats(std::ostream &out, const RenderStats &stats)
+    {
+        char line[128];
+        double busy_sum = 0, busy_max = 0, idle_sum = 0;
+        for(const auto &w : stats.workers) {
+            busy_sum += w.busy_seconds;
+            busy_max = std::max(busy_max, w.busy_seconds);
+            idle_sum += w.idle_seconds;
+        }
+        const double busy_mean = stats.workers.empty() ? 0 : busy_sum / stats.workers.size();
+
+        out << "Workers:\n";
+        std::snprintf(line, sizeof(line), "  %6s %10s %10s %7s %7s\n", "thread", "busy (s)", "idle (s)", "tiles", "steals");
+        out << line;
+        for(size_t t = 0; t < stats.workers.size(); t++) {
+            const auto &w = stats.workers[t];
+            std::snprintf(line, sizeof(line), "  %6zu %10.3f %10.3f %7llu %7llu\n", t, w.busy_seconds, w.idle_seconds,
+                          static_cast<unsigned long long>(w.tiles), static_cast<unsigned long long>(w.steals));
+            out << line;
+        }
+        std::snprintf(line, sizeof(line), "  NUMA nodes: %d, scene replicas: %d", stats.numa_nodes, stats.scene_replicas);
+        out << line;
+        if(stats.scene_replicas > 0) {
+            std::snprintf(line, sizeof(line), " (built in %.3fs)", stats.replicate_seconds);
+            out << line;
+        }
+        out << "\n";
+        if(stats.prepass_seconds > 0) {
+            std::snprintf(line, sizeof(line), "  cost prepass: %.3fs\n", stats.prepass_seconds);
+            out << line;
+        }
+        std::snprintf(line, sizeof(line), "  idle: %.1f%% of thread time, load imbalance (max/mean busy): %.3f\n",
+                      busy_sum + idle_sum > 0 ? 100 * idle_sum / (busy_sum + idle_sum) : 0.0,
+                      busy_mean > 0 ? busy_max / busy_mean : 1.0);
+        out << line;
+    }
+
+    void write_framebuffer(std::ostream &out, const Framebuffer &framebuffer, int samples_per_pixel)
+    {
+        out << "P3\n" << framebuffer.width << ' ' << framebuffer.height << "\n255\n";
+
+        for(int j = framebuffer.height - 1; j >= 0; --j)
+        {
+            for(int i = 0; i < framebuffer.width; ++i)
+            {
+                write_color(out, framebuffer.at(i, j), samples_per_pixel);
+            }
+        }
+        out << std::flush;
+    }
+}
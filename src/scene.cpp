@@ -0,0 +1,560 @@
+#include <scene.hpp>
+#include <sphere.hpp>
+#include <material.hpp>
+#include <aarect.hpp>
+#include <box.hpp>
+#include <constant_medium.hpp>
+#include <grid_medium.hpp>
+#include <bvh.hpp>
+#include <primitive.hpp>
+#include <texture_loader.hpp>
+#include <transform.hpp>
+
+#include <iostream>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace raytracing {
+    static HittableList random_scene()
+    {
+        using std::make_shared;
+
+        HittableList world;
+
+        auto checker =std::make_shared<CheckerTexture>(Color(0.1, 0.1, 0.1), Color(0.9, 0.9, 0.9));
+        world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000,std::make_shared<Lambertian>(checker)));
+
+        for(int a = -11; a < 11; a++)
+        {
+            for(int b = -11; b < 11; b++)
+            {
+                auto choose_mat = random_double();
+                Point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+
+                if ((center - Point3(4, 0.2, 0)).length() > 0.9) {
+                    std::shared_ptr<Material> sphere_material;
+
+                    if (choose_mat < 0.8) {
+                        // diffuse
+                        auto albedo = Color::random() * Color::random();
+                        sphere_material =std::make_shared<Lambertian>(albedo);
+                        world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
+                    } else if (choose_mat < 0.95) {
+                        // metal
+                        auto albedo = Color::random(0.5, 1);
+                        auto fuzz = random_double(0, 0.5);
+                        sphere_material =std::make_shared<Metal>(albedo, fuzz);
+                        world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
+                    } else {
+                        // glass
+                        sphere_material =std::make_shared<Dielectric>(1.5);
+                        world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
+                    }
+                }
+            }
+        }
+
+        auto material1 =std::make_shared<Dielectric>(1.5);
+        world.add(std::make_shared<Sphere>(Point3(0, 1, 0), 1.0, material1));
+
+        auto material2 =std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
+        world.add(std::make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
+
+        auto material3 =std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
+        world.add(std::make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
+
+
+        return world;
+    }
+
+    static HittableList two_spheres()
+    {
+        HittableList objects;
+        auto checker = std::make_shared<CheckerTexture>(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+
+        objects.add(std::make_shared<Sphere>(Point3(0,-10, 0), 10, std::make_shared<Lambertian>(checker)));
+        objects.add(std::make_shared<Sphere>(Point3(0, 10, 0), 10, std::make_shared<Lambertian>(checker)));
+
+        return objects;
+    }
+
+    static HittableList two_perlin_spheres() 
+    {
+        HittableList objects;
+
+        auto pertext = std::make_shared<NoiseTexture>(4);
+        objects.add(std::make_shared<Sphere>(Point3(0,-1000,0), 1000, std::make_shared<Lambertian>(pertext)));
+        objects.add(std::make_shared<Sphere>(Point3(0, 2, 0), 2, std::make_shared<Lambertian>(pertext)));
+
+        return objects;
+    }
+
+    static HittableList earth() 
+    {
+        auto earth_texture = load_image_texture("assets/earthmap.jpg");
+        auto earth_surface = std::make_shared<Lambertian>(earth_texture);
+        auto globe = std::make_shared<Sphere>(Point3(0, 0, 0), 2, earth_surface);
+
+        return HittableList(globe);
+    }
+
+    static HittableList simple_light()
+    {
+        HittableList objects;
+        auto pertext = std::make_shared<NoiseTexture>(4);
+        objects.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(pertext)));
+        objects.add(std::make_shared<Sphere>(Point3(0, 2, 0), 2, std::make_shared<Lambertian>(pertext)));
+
+        auto difflight = std::make_shared<DiffuseLight>(Color(4, 4, 4));
+        objects.add(std::make_shared<XYRect>(3, 5, 1, 3, -2, difflight));
+
+        return objects;
+    }
+
+    static HittableList cornell_box()
+    {
+        HittableList objects;
+
+        auto red   = std::make_shared<Lambertian>(Color(0.65, 0.05, 0.05));
+        auto white = std::make_shared<Lambertian>(Color(0.75, 0.75, 0.75));
+        auto green = std::make_shared<Lambertian>(Color(0.12, 0.45, 0.15));
+        auto light = std::make_shared<DiffuseLight>(Color(15, 15, 15));
+
+        objects.add(std::make_shared<YZRect>(0, 555, 0, 555, 555, green));
+        objects.add(std::make_shared<YZRect>(0, 555, 0, 555, 0, red));
+        objects.add(std::make_shared<XZRect>(213, 343, 227, 332, 554, light));
+        objects.add(std::make_shared<XZRect>(0, 555, 0, 555, 0, white));
+        objects.add(std::make_shared<XZRect>(0, 555, 0, 555, 555, white));
+        objects.add(std::make_shared<XYRect>(0, 555, 0, 555, 555, white));
+
+        std::shared_ptr<Hittable> box1 = std::make_shared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
+        box1 = std::make_shared<RotateY>(box1, 15);
+        box1 = std::make_shared<Translate>(box1, Vec3(265, 0, 295));
+        objects.add(box1);
+
+        std::shared_ptr<Hittable> box2 = std::make_shared<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white);
+        box2 = std::make_shared<RotateY>(box2, -18);
+        box2 = std::make_shared<Translate>(box2, Vec3(130, 0, 65));
+        objects.add(box2);
+
+        return objects;
+    }
+
+    static HittableList cornell_smoke()
+    {
+        HittableList objects;
+
+        auto red   = std::make_shared<Lambertian>(Color(0.65, 0.05, 0.05));
+        auto white = std::make_shared<Lambertian>(Color(0.75, 0.75, 0.75));
+        auto green = std::make_shared<Lambertian>(Color(0.12, 0.45, 0.15));
+        auto light = std::make_shared<DiffuseLight>(Color(7, 7, 7));
+
+        objects.add(std::make_shared<YZRect>(0, 555, 0, 555, 555, green));
+        objects.add(std::make_shared<YZRect>(0, 555, 0, 555, 0, red));
+        objects.add(std::make_shared<XZRect>(113, 443, 127, 432, 554, light));
+        objects.add(std::make_shared<XZRect>(0, 555, 0, 555, 0, white));
+        objects.add(std::make_shared<XZRect>(0, 555, 0, 555, 555, white));
+        objects.add(std::make_shared<XYRect>(0, 555, 0, 555, 555, white));
+
+        std::shared_ptr<Hittable> box1 = std::make_shared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
+        box1 = std::make_shared<RotateY>(box1, 15);
+        box1 = std::make_shared<Translate>(box1, Vec3(265, 0, 295));
+        objects.add(std::make_shared<ConstantMedium>(box1, 0.01, Color(0, 0, 0)));
+
+        std::shared_ptr<Hittable> box2 = std::make_shared<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white);
+        box2 = std::make_shared<RotateY>(box2, -18);
+        box2 = std::make_shared<Translate>(box2, Vec3(130, 0, 65));
+        objects.add(std::make_shared<ConstantMedium>(box2, 0.01, Color(1, 1, 1)));
+
+        return objects;
+    }
+
+    static HittableList cornell_cloud()
+    {
+        HittableList objects;
+
+        auto red   = std::make_shared<Lambertian>(Color(0.65, 0.05, 0.05));
+        auto white = std::make_shared<Lambertian>(Color(0.75, 0.75, 0.75));
+        auto green = std::make_shared<Lambertian>(Color(0.12, 0.45, 0.15));
+        auto light = std::make_shared<DiffuseLight>(Color(7, 7, 7));
+
+        objects.add(std::make_shared<YZRect>(0, 555, 0, 555, 555, green));
+        objects.add(std::make_shared<YZRect>(0, 555, 0, 555, 0, red));
+        objects.add(std::make_shared<XZRect>(113, 443, 127, 432, 554, light));
+        objects.add(std::make_shared<XZRect>(0, 555, 0, 555, 0, white));
+        objects.add(std::make_shared<XZRect>(0, 555, 0, 555, 555, white));
+        objects.add(std::make_shared<XYRect>(0, 555, 0, 555, 555, white));
+
+        // A cloud of Perlin noise, about 50 units per blob, that leaves half its box empty.
+        AABB bounds(Point3(80, 40, 80), Point3(475, 420, 475));
+        auto grid = DensityGrid::from_noise(Perlin(), 0.02, bounds, 5, GridLayout::Sparse);
+        objects.add(std::make_shared<GridMedium>(grid, 0.2, Color(0.9, 0.9, 0.9)));
+
+        return objects;
+    }
+
+    static HittableList final_scene()
+    {
+        auto boxes1 = std::make_shared<HittableList>();
+        auto ground = std::make_shared<Lambertian>(Color(0.48, 0.83, 0.53));
+
+        const int boxes_per_side = 20;
+        for(int i = 0; i < boxes_per_side; i++)
+        {
+            for(int j = 0; j < boxes_per_side; j++)
+            {
+                auto w = 100.0;
+                auto x0 = -1000.0 + i*w;
+                auto z0 = -1000.0 + j*w;
+                auto y0 = 0.0;
+                auto x1 = x0 + w;
+                auto y1 = random_double(1,101);
+                auto z1 = z0 + w;
+
+                boxes1->add(std::make_shared<Box>(Point3(x0, y0, z0), Point3(x1, y1, z1), ground));
+            }
+        }
+
+        HittableList objects;
+        objects.add(boxes1);
+
+        auto light = std::make_shared<DiffuseLight>(Color(7, 7, 7));
+        objects.add(std::make_shared<XZRect>(123, 423, 147, 412, 554, light));
+
+        auto center1 = Point3(400, 400, 200);
+        auto center2 = center1 + Vec3(30,0,0);
+        auto moving_sphere_material =std::make_shared<Lambertian>(Color(0.7, 0.3, 0.1));
+        objects.add(std::make_shared<MovingSphere>(center1, center2, 0, 1, 50, moving_sphere_material));
+
+        objects.add(std::make_shared<Sphere>(Point3(260, 150, 45), 50,std::make_shared<Dielectric>(1.5)));
+        objects.add(std::make_shared<Sphere>(
+            Point3(0, 150, 145), 50,std::make_shared<Metal>(Color(0.8, 0.8, 0.9), 1.0)
+        ));
+
+        auto boundary =std::make_shared<Sphere>(Point3(360,150,145), 70,std::make_shared<Dielectric>(1.5));
+        objects.add(boundary);
+        objects.add(std::make_shared<ConstantMedium>(boundary, 0.2, Color(0.2, 0.4, 0.9)));
+        boundary =std::make_shared<Sphere>(Point3(0, 0, 0), 5000,std::make_shared<Dielectric>(1.5));
+        objects.add(std::make_shared<ConstantMedium>(boundary, .0001, Color(1,1,1)));
+
+        auto emat =std::make_shared<Lambertian>(load_image_texture("assets/earthmap.jpg"));
+        objects.add(std::make_shared<Sphere>(Point3(400,200,400), 100, emat));
+        auto pertext =std::make_shared<NoiseTexture>(0.1);
+        objects.add(std::make_shared<Sphere>(Point3(220,280,300), 80,std::make_shared<Lambertian>(pertext)));
+
+        HittableList boxes2;
+        auto white =std::make_shared<Lambertian>(Color(.73, .73, .73));
+        int ns = 1000;
+        for (int j = 0; j < ns; j++) {
+            boxes2.add(std::make_shared<Sphere>(Point3::random(0,165), 10, white));
+        }
+
+        objects.add(std::make_shared<Translate>(
+           std::make_shared<RotateY>(
+               std::make_shared<BVHNode>(boxes2, 0.0, 1.0), 15),
+                Vec3(-100,270,395)
+            )
+        );
+
+        return objects;
+    }
+
+    // A field of copies of one cluster of spheres, each turned and moved. The cluster is
+    // stored once and every copy is an instance of it.
+    static HittableList instances()
+    {
+        std::vector<std::shared_ptr<Material>> materials = {
+            std::make_shared<Lambertian>(Color(0.8, 0.3, 0.2)),
+            std::make_shared<Lambertian>(Color(0.2, 0.5, 0.8)),
+            std::make_shared<Metal>(Color(0.8, 0.8, 0.7), 0.2),
+        };
+        std::vector<Primitive> spheres;
+        for(uint32_t i = 0; i < 500; i++) {
+            Vec3 p = 3 * random_in_unit_sphere();
+            spheres.push_back(Primitive::sphere(Point3(p.x(), p.y() + 3, p.z()), 0.25, i % 3));
+        }
+        auto cluster = std::make_shared<PrimitiveArray>(std::move(spheres), materials, 0.0, 1.0);
+
+        HittableList objects;
+        objects.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5))));
+
+        const int copies_per_side = 32;
+        for(int i = 0; i < copies_per_side; i++)
+            for(int j = 0; j < copies_per_side; j++) {
+                std::shared_ptr<Hittable> copy = std::make_shared<RotateY>(cluster, random_double(0, 360));
+                auto x = 8 * (i - 0.5 * (copies_per_side - 1)) + random_double(-2, 2);
+                auto z = 8 * (j - 0.5 * (copies_per_side - 1)) + random_double(-2, 2);
+                objects.add(std::make_shared<Translate>(copy, Vec3(x, 0, z)));
+            }
+
+        return objects;
+    }
+
+    const std::vector<std::string>& scene_names()
+    {
+        static const std::vector<std::string> names = {
+            "random_scene",
+            "two_spheres",
+            "two_perlin_spheres",
+            "earth",
+            "simple_light",
+            "cornell_box",
+            "cornell_smoke",
+            "cornell_cloud",
+            "final_scene",
+            "instances",
+        };
+        return names;
+    }
+
+    bool build_scene(const std::string &name, Scene &scene)
+    {
+        if(name == "random_scene") {
+            scene.world = random_scene();
+            scene.lookfrom = Point3(13, 2, 3);
+            scene.lookat = Point3(0, 0, 0);
+            scene.background = Color(0.70, 0.80, 1.00);
+            scene.vfov = 20.0;
+            scene.aperture = 0.1;
+        }
+        else if(name == "two_spheres") {
+            scene.world = two_spheres();
+            scene.lookfrom = Point3(13, 2, 3);
+            scene.lookat = Point3(0, 0, 0);
+            scene.background = Color(0.70, 0.80, 1.00);
+            scene.vfov = 20.0;
+        }
+        else if(name == "two_perlin_spheres") {
+            scene.world = two_perlin_spheres();
+            scene.lookfrom = Point3(13, 2, 3);
+            scene.lookat = Point3(0, 0, 0);
+            scene.background = Color(0.70, 0.80, 1.00);
+            scene.vfov = 20.0;
+        }
+        else if(name == "earth") {
+            scene.world = earth();
+            scene.lookfrom = Point3(13, 2, 3);
+            scene.lookat = Point3(0, 0, 0);
+            scene.background = Color(0.70, 0.80, 1.00);
+            scene.vfov = 20.0;
+        }
+        else if(name == "simple_light") {
+            scene.world = simple_light();
+            scene.samples_per_pixel = 1000;
+            scene.background = Color(0, 0, 0);
+            scene.lookfrom = Point3(26, 3, 6);
+            scene.lookat = Point3(0, 2, 0);
+            scene.vfov = 20.0;
+        }
+        else if(name == "cornell_box") {
+            scene.world = cornell_box();
+            scene.aspect_ratio = 1.0;
+            scene.samples_per_pixel = 200;
+            scene.background = Color(0, 0, 0);
+            scene.lookfrom = Point3(278, 278, -800);
+            scene.lookat = Point3(278, 278, 0);
+            scene.vfov = 40.0;
+        }
+        else if(name == "cornell_smoke") {
+            scene.world = cornell_smoke();
+            scene.aspect_ratio = 1.0;
+            scene.samples_per_pixel = 200;
+            scene.background = Color(0, 0, 0);
+            scene.lookfrom = Point3(278, 278, -800);
+            scene.lookat = Point3(278, 278, 0);
+            scene.vfov = 40.0;
+        }
+        else if(name == "cornell_cloud") {
+            scene.world = cornell_cloud();
+            scene.aspect_ratio = 1.0;
+            scene.samples_per_pixel = 200;
+            scene.background = Color(0, 0, 0);
+            scene.lookfrom = Point3(278, 278, -800);
+            scene.lookat = Point3(278, 278, 0);
+            scene.vfov = 40.0;
+        }
+        else if(name == "final_scene") {
+            scene.world = final_scene();
+            scene.aspect_ratio = 1.0;
+            scene.samples_per_pixel = 1000;
+            scene.background = Color(0, 0, 0);
+            scene.lookfrom = Point3(478, 278, -600);
+            scene.lookat = Point3(278, 278, 0);
+            scene.vfov = 40.0;
+        }
+        else if(name == "instances") {
+            scene.world = instances();
+            scene.samples_per_pixel = 100;
+            scene.background = Color(0.70, 0.80, 1.00);
+            scene.lookfrom = Point3(0, 40, -150);
+            scene.lookat = Point3(0, 0, 0);
+            scene.vfov = 40.0;
+        }
+        else
+            return false;
+
+        return true;
+    }
+
+    // The textures `material` looks up, to read or replace.
+    static std::vector<std::shared_ptr<Texture>*> textures_of(Material &material)
+    {
+        if(auto lambertian = dynamic_cast<Lambertian*>(&material))
+            return {&lambertian->albedo};
+        if(auto light = dynamic_cast<DiffuseLight*>(&material))
+            return {&light->emit};
+        if(auto isotropic = dynamic_cast<Isotropic*>(&material))
+            return {&isotropic->albedo};
+        return {};
+    }
+
+    // Calls `visit(material, box)` for every material below `object`, with the bounds of
+    // the object using it or null if they are not known. Textures see world space hit
+    // points, so objects below a transform get the transform's bounding box (`world_box`).
+    template<typename Visit>
+    static void visit_materials(const std::shared_ptr<Hittable> &object, bool transformed, const AABB* world_box, Visit &visit)
+    {
+        AABB own_box;
+        const AABB* box = world_box;
+        if(!transformed && object->bounding_box(0, 1, own_box))
+            box = &own_box;
+
+        if(auto list = std::dynamic_pointer_cast<HittableList>(object)) {
+            for(const auto &child : list->objects)
+                visit_materials(child, transformed, world_box, visit);
+        }
+        else if(auto node = std::dynamic_pointer_cast<BVHNode>(object)) {
+            visit_materials(node->left, transformed, world_box, visit);
+            if(node->right != node->left)
+                visit_materials(node->right, transformed, world_box, visit);
+        }
+        else if(auto translate = std::dynamic_pointer_cast<Translate>(object))
+            visit_materials(translate->ptr, true, box, visit);
+        else if(auto rotate = std::dynamic_pointer_cast<RotateY>(object))
+            visit_materials(rotate->ptr, true, box, visit);
+        else if(auto transform = std::dynamic_pointer_cast<Transform>(object))
+            visit_materials(transform->ptr, true, box, visit);
+        else if(auto sphere = std::dynamic_pointer_cast<Sphere>(object))
+            visit(sphere->mat_ptr, box);
+        else if(auto moving = std::dynamic_pointer_cast<MovingSphere>(object))
+            visit(moving->mat_ptr, box);
+        else if(auto rect = std::dynamic_pointer_cast<XYRect>(object))
+            visit(rect->mp, box);
+        else if(auto rect = std::dynamic_pointer_cast<XZRect>(object))
+            visit(rect->mp, box);
+        else if(auto rect = std::dynamic_pointer_cast<YZRect>(object))
+            visit(rect->mp, box);
+        else if(auto b = std::dynamic_pointer_cast<Box>(object))
+            visit(b->mat_ptr, box);
+        else if(auto medium = std::dynamic_pointer_cast<ConstantMedium>(object))
+            visit(medium->phase_function, box);
+        else if(auto medium = std::dynamic_pointer_cast<GridMedium>(object))
+            visit(medium->phase_function, box);
+        else if(auto primitives = std::dynamic_pointer_cast<PrimitiveArray>(object)) {
+            // The materials are shared by primitives anywhere in the array.
+            for(const auto &material : primitives->materials)
+                visit(material, static_cast<const AABB*>(nullptr));
+        }
+    }
+
+    // Collects the noise textures below `texture` with the bounds of the object using them.
+    static void find_noise(const std::shared_ptr<Texture> &texture, const AABB &box, std::map<NoiseTexture*, std::vector<AABB>> &bounds)
+    {
+        if(auto noise = std::dynamic_pointer_cast<NoiseTexture>(texture))
+            bounds[noise.get()].push_back(box);
+        else if(auto checker = std::dynamic_pointer_cast<CheckerTexture>(texture)) {
+            find_noise(checker->even(), box, bounds);
+            find_noise(checker->odd(), box, bounds);
+        }
+    }
+
+    int bake_noise_textures(Scene &scene, real voxel_size)
+    {
+        std::map<NoiseTexture*, std::vector<AABB>> bounds;
+        auto visit = [&](const std::shared_ptr<Material> &material, const AABB* box) {
+            if(material && box)
+                for(auto texture : textures_of(*material))
+                    find_noise(*texture, *box, bounds);
+        };
+        for(const auto &object : scene.world.objects)
+            visit_materials(object, false, nullptr, visit);
+
+        int baked = 0;
+        for(const auto &[texture, boxes] : bounds)
+            for(const AABB &box : boxes) {
+                size_t samples = NoiseVolume::sample_count(box, voxel_size);
+                if(samples > max_noise_samples) {
+                    std::cerr << "WARNING: Not baking noise over an object, its volume would hold " << samples << " samples." << std::endl;
+                    continue;
+                }
+                texture->bake(box, voxel_size);
+                baked++;
+            }
+        return baked;
+    }
+
+    TextureCompiler::Stats compile_textures(Scene &scene)
+    {
+        TextureCompiler compiler;
+        auto visit = [&](const std::shared_ptr<Material> &material, const AABB*) {
+            if(material)
+                for(auto texture : textures_of(*material))
+                    *texture = compiler.compile(*texture);
+        };
+        for(const auto &object : scene.world.objects)
+            visit_materials(object, false, nullptr, visit);
+        return compiler.stats();
+    }
+
+    // Returns what replaces `object`: a Transform for a chain of transforms, the object
+    // itself otherwise, with the chains below it replaced in place. Objects shared by
+    // several parents are replaced by one result. Chains whose product is singular, which
+    // a Transform cannot invert, are kept.
+    static std::shared_ptr<Hittable> collapse_chains(const std::shared_ptr<Hittable> &object,
+                                                     std::map<const Hittable*, std::shared_ptr<Hittable>> &collapsed, int &chains)
+    {
+        auto found = collapsed.find(object.get());
+        if(found != collapsed.end())
+            return found->second;
+
+        std::shared_ptr<Hittable> result = object;
+        Affine to_world = Affine::identity(), step;
+        std::shared_ptr<Hittable> child = object;
+        while(auto next = transform_child(child, step)) {
+            to_world = to_world * step;
+            child = next;
+        }
+
+        Affine to_object;
+        if(child != object && !to_world.inverse(to_object))
+            std::cerr << "WARNING: Keeping a chain of transforms that is singular as it is." << std::endl;
+        else if(child != object) {
+            child = collapse_chains(child, collapsed, chains);
+            result = to_world.is_identity() ? child : std::make_shared<Transform>(child, to_world);
+            chains++;
+        }
+        else if(auto list = std::dynamic_pointer_cast<HittableList>(object)) {
+            for(auto &entry : list->objects)
+                entry = collapse_chains(entry, collapsed, chains);
+        }
+        else if(auto node = std::dynamic_pointer_cast<BVHNode>(object)) {
+            node->left = collapse_chains(node->left, collapsed, chains);
+            node->right = collapse_chains(node->right, collapsed, chains);
+        }
+        else if(auto medium = std::dynamic_pointer_cast<ConstantMedium>(object))
+            medium->boundary = collapse_chains(medium->boundary, collapsed, chains);
+
+        collapsed[object.get()] = result;
+        return result;
+    }
+
+    int collapse_transforms(Scene &scene)
+    {
+        std::map<const Hittable*, std::shared_ptr<Hittable>> collapsed;
+        int chains = 0;
+        for(auto &object : scene.world.objects)
+            object = collapse_chains(object, collapsed, chains);
+        return chains;
+    }
+}
@@ -0,0 +1,784 @@
+#include <scene_binary.hpp>
+#include <aarect.hpp>
+#include <box.hpp>
+#include <bvh.hpp>
+#include <constant_medium.hpp>
+#include <grid_medium.hpp>
+#include <mapped_file.hpp>
+#include <material.hpp>
+#include <primitive.hpp>
+#include <sphere.hpp>
+#include <texture.hpp>
+#include <texture_cache.hpp>
+#include <texture_loader.hpp>
+#include <transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace raytracing {
+    static const char binary_scene_magic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\n'};
+    static const uint32_t binary_scene_version = 8;
+    static const uint64_t binary_scene_alignment = 64;
+
+    static uint64_t align(uint64_t offset)
+    {
+        return (offset + binary_scene_alignment - 1) & ~(binary_scene_alignment - 1);
+    }
+
+    // Flattens a Hittable graph into the record tables of the binary format. Shared
+    // objects, materials and textures are written once and referenced by index.
+    class BinarySceneWriter {
+        public:
+            bool add_world(const HittableList &world, uint32_t &root)
+            {
+                return add_group(world.objects, root);
+            }
+
+            bool write(const Scene &scene, const std::string &source, uint32_t root, const std::string &path)
+            {
+                BinarySceneHeader header = {};
+                std::memcpy(header.magic, binary_scene_magic, sizeof(header.magic));
+                header.version = binary_scene_version;
+                header.primitive_size = sizeof(Primitive);
+                header.bvh_node_size = sizeof(PrimitiveBVHNode);
+                for(int i = 0; i < 3; i++) {
+                    header.lookfrom[i] = scene.lookfrom[i];
+                    header.lookat[i] = scene.lookat[i];
+                    header.vup[i] = scene.vup[i];
+                    header.background[i] = scene.background[i];
+                }
+                header.vfov = scene.vfov;
+                header.aperture = scene.aperture;
+                header.dist_to_focus = scene.dist_to_focus;
+                header.aspect_ratio = scene.aspect_ratio;
+                header.samples_per_pixel = scene.samples_per_pixel;
+                header.root = root;
+
+                std::string strings = source + '\0';
+                for(const auto &tiled : tiled_paths) {
+                    textures[tiled.first].blob = strings.size();
+                    strings += tiled.second + '\0';
+                }
+
+                uint64_t blob_size = 0;
+                for(auto &blob : blobs) {
+                    blob.offset = align(blob_size);
+                    blob_size = blob.offset + blob.size;
+                    for(uint32_t texture : blob.textures)
+                        textures[texture].blob = blob.offset;
+                    for(uint32_t node : blob.nodes)
+                        nodes[node].blob = blob.offset;
+                }
+
+                uint64_t offset = align(sizeof(BinarySceneHeader));
+                auto place = [&offset](BinarySceneSection &section, uint64_t size) {
+                    section.offset = offset;
+                    section.size = size;
+                    offset = align(offset + size);
+                };
+                place(header.strings, strings.size());
+                place(header.textures, textures.size() * sizeof(BinaryTexture));
+                place(header.materials, materials.size() * sizeof(BinaryMaterial));
+                place(header.nodes, nodes.size() * sizeof(BinaryNode));
+                place(header.children, children.size() * sizeof(uint32_t));
+                place(header.primitives, primitives.size() * sizeof(Primitive));
+                place(header.bvh_nodes, bvh_nodes.size() * sizeof(PrimitiveBVHNode));
+                place(header.blobs, blob_size);
+
+                std::ofstream out(path, std::ios::binary);
+                if(!out) {
+                    std::cerr << "ERROR: Could not open output file `" << path << "`." << std::endl;
+                    return false;
+                }
+
+                uint64_t written = 0;
+                auto put = [&](uint64_t at, const void* data, uint64_t size) {
+                    static const char zeros[binary_scene_alignment] = {};
+                    while(written < at) {
+                        auto padding = std::min<uint64_t>(at - written, sizeof(zeros));
+                        out.write(zeros, padding);
+                        written += padding;
+                    }
+                    out.write(static_cast<const char*>(data), size);
+                    written += size;
+                };
+                put(0, &header, sizeof(header));
+                put(header.strings.offset, strings.data(), strings.size());
+                put(header.textures.offset, textures.data(), header.textures.size);
+                put(header.materials.offset, materials.data(), header.materials.size);
+                put(header.nodes.offset, nodes.data(), header.nodes.size);
+                put(header.children.offset, children.data(), header.children.size);
+                put(header.primitives.offset, primitives.data(), header.primitives.size);
+                put(header.bvh_nodes.offset, bvh_nodes.data(), header.bvh_nodes.size);
+                for(const auto &blob : blobs)
+                    put(header.blobs.offset + blob.offset, blob.data, blob.size);
+                put(offset, nullptr, 0); // pad so that empty trailing sections lie within the file
+
+                if(!out) {
+                    std::cerr << "ERROR: Could not write scene file `" << path << "`." << std::endl;
+                    return false;
+                }
+                return true;
+            }
+
+        private:
+            bool unsupported(const char* what)
+            {
+                std::cerr << "ERROR: The binary scene format cannot represent this " << what << "." << std::endl;
+                return false;
+            }
+
+            bool add_texture(const std::shared_ptr<Texture> &texture, uint32_t &id)
+            {
+                auto cached = texture_ids.find(texture.get());
+                if(cached != texture_ids.end()) {
+                    id = cached->second;
+                    return true;
+                }
+
+                BinaryTexture record = {};
+                if(auto solid = std::dynamic_pointer_cast<SolidColor>(texture)) {
+                    record.type = BinaryTextureType::Solid;
+                    for(int i = 0; i < 3; i++)
+                        record.color[i] = solid->color()[i];
+                }
+                else if(auto checker = std::dynamic_pointer_cast<CheckerTexture>(texture)) {
+                    record.type = BinaryTextureType::Checker;
+                    if(!add_texture(checker->even(), record.children[0]) || !add_texture(checker->odd(), record.children[1]))
+                        return false;
+                }
+                else if(auto noise = std::dynamic_pointer_cast<NoiseTexture>(texture)) {
+                    record.type = BinaryTextureType::Noise;
+                    record.scale = noise->scale;
+                    record.seed = noise->noise.seed();
+                }
+                else if(auto image = std::dynamic_pointer_cast<ImageTexture>(texture)) {
+                    record.type = BinaryTextureType::Image;
+                    record.filter = static_cast<uint32_t>(image->filter);
+                    const ImagePyramid &pyramid = *image->image();
+                    if(pyramid.tiled()) {
+                        record.type = BinaryTextureType::TiledImage;
+                        tiled_paths.emplace_back(static_cast<uint32_t>(textures.size()), pyramid.tiled()->path());
+                    }
+                    else if(pyramid.pixels()) {
+                        record.width = pyramid.image_width();
+                        record.height = pyramid.image_height();
+                        record.format = static_cast<uint32_t>(pyramid.texel_format());
+                        // Textures sharing a pyramid share its blob.
+                        auto blob = blob_ids.find(pyramid.pixels());
+                        if(blob == blob_ids.end()) {
+                            uint64_t size = ImagePyramid::pyramid_size(record.width, record.height, pyramid.texel_format());
+                            blob = blob_ids.emplace(pyramid.pixels(), blobs.size()).first;
+                            blobs.push_back({pyramid.pixels(), size, 0, {}, {}});
+                        }
+                        blobs[blob->second].textures.push_back(static_cast<uint32_t>(textures.size()));
+                    }
+                }
+                else
+                    return unsupported("texture");
+
+                id = static_cast<uint32_t>(textures.size());
+                textures.push_back(record);
+                texture_ids[texture.get()] = id;
+                return true;
+            }
+
+            bool add_material(const std::shared_ptr<Material> &material, uint32_t &id)
+            {
+                auto cached = material_ids.find(material.get());
+                if(cached != material_ids.end()) {
+                    id = cached->second;
+                    return true;
+                }
+
+                BinaryMaterial record = {};
+                bool ok = true;
+                if(auto lambertian = std::dynamic_pointer_cast<Lambertian>(material)) {
+                    record.type = BinaryMaterialType::Lambertian;
+                    ok = add_texture(lambertian->albedo, record.texture);
+                }
+                else if(auto metal = std::dynamic_pointer_cast<Metal>(material)) {
+                    record.type = BinaryMaterialType::Metal;
+                    for(int i = 0; i < 3; i++)
+                        record.color[i] = metal->albedo[i];
+                    record.value = metal->fuzz;
+                }
+                else if(auto dielectric = std::dynamic_pointer_cast<Dielectric>(material)) {
+                    record.type = BinaryMaterialType::Dielectric;
+                    record.value = dielectric->ir;
+                }
+                else if(auto light = std::dynamic_pointer_cast<DiffuseLight>(material)) {
+                    record.type = BinaryMaterialType::DiffuseLight;
+                    ok = add_texture(light->emit, record.texture);
+                }
+                else if(auto isotropic = std::dynamic_pointer_cast<Isotropic>(material)) {
+                    record.type = BinaryMaterialType::Isotropic;
+                    ok = add_texture(isotropic->albedo, record.texture);
+                }
+                else
+                    return unsupported("material");
+
+                if(!ok)
+                    return false;
+
+                id = static_cast<uint32_t>(materials.size());
+                materials.push_back(record);
+                material_ids[material.get()] = id;
+                return true;
+            }
+
+            // Converts the plain primitive types to records. Returns false in `is_primitive`
+            // for anything else.
+            bool as_primitive(const std::shared_ptr<Hittable> &object, Primitive &prim, bool &is_primitive)
+            {
+                is_primitive = true;
+                uint32_t material;
+
+                if(auto sphere = std::dynamic_pointer_cast<Sphere>(object)) {
+                    if(!add_material(sphere->mat_ptr, material))
+                        return false;
+                    prim = Primitive::sphere(sphere->center, sphere->radius, material);
+                }
+                else if(auto moving = std::dynamic_pointer_cast<MovingSphere>(object)) {
+                    if(!add_material(moving->mat_ptr, material))
+                        return false;
+                    prim = Primitive::moving_sphere(moving->center0, moving->center1, moving->time0, moving->time1, moving->radius, material);
+                }
+                else if(auto rect = std::dynamic_pointer_cast<XYRect>(object)) {
+                    if(!add_material(rect->mp, material))
+                        return false;
+                    prim = Primitive::rect(PrimitiveType::XYRect, rect->x0, rect->x1, rect->y0, rect->y1, rect->k, material);
+                }
+                else if(auto rect = std::dynamic_pointer_cast<XZRect>(object)) {
+                    if(!add_material(rect->mp, material))
+                        return false;
+                    prim = Primitive::rect(PrimitiveType::XZRect, rect->x0, rect->x1, rect->z0, rect->z1, rect->k, material);
+                }
+                else if(auto rect = std::dynamic_pointer_cast<YZRect>(object)) {
+                    if(!add_material(rect->mp, material))
+                        return false;
+                    prim = Primitive::rect(PrimitiveType::YZRect, rect->y0, rect->y1, rect->z0, rect->z1, rect->k, material);
+                }
+                else if(auto box = std::dynamic_pointer_cast<Box>(object)) {
+                    if(!add_material(box->mat_ptr, material))
+                        return false;
+                    prim = Primitive::box(box->box_min, box->box_max, material);
+                }
+                else
+                    is_primitive = false;
+
+                return true;
+            }
+
+            bool add_primitives(std::vector<Primitive> prims, uint32_t &id)
+            {
+                // Let PrimitiveArray build the BVH; the material table is not needed for that.
+                PrimitiveArray array(std::move(prims), {}, 0.0, 1.0);
+                return append_array(array, id);
+            }
+
+            bool append_array(const PrimitiveArray &array, uint32_t &id)
+            {
+                BinaryNode node = {};
+                node.type = BinaryNodeType::Primitives;
+                node.index[0] = static_cast<uint32_t>(primitives.size());
+                node.index[1] = static_cast<uint32_t>(array.size());
+                node.index[2] = static_cast<uint32_t>(bvh_nodes.size());
+                node.index[3] = static_cast<uint32_t>(array.node_count());
+
+                for(size_t i = 0; i < array.size(); i++) {
+                    Primitive prim = array.primitives()[i];
+                    // Arrays loaded from text index their own material table.
+                    if(!array.materials.empty() && !add_material(array.materials[prim.material], prim.material))
+                        return false;
+                    primitives.push_back(prim);
+                }
+
+                // Node offsets stay relative to the array's own primitives and nodes.
+                bvh_nodes.insert(bvh_nodes.end(), array.nodes(), array.nodes() + array.node_count());
+
+                id = static_cast<uint32_t>(nodes.size());
+                nodes.push_back(node);
+                return true;
+            }
+
+            bool add_group(const std::vector<std::shared_ptr<Hittable>> &objects, uint32_t &id)
+            {
+                std::vector<Primitive> prims;
+                std::vector<uint32_t> ids;
+
+                for(const auto &object : objects) {
+                    Primitive prim;
+                    bool is_primitive;
+                    if(!as_primitive(object, prim, is_primitive))
+                        return false;
+
+                    if(is_primitive)
+                        prims.push_back(prim);
+                    else {
+                        uint32_t child;
+                        if(!add_hittable(object, child))
+                            return false;
+                        ids.push_back(child);
+                    }
+                }
+
+                if(!prims.empty()) {
+                    uint32_t child;
+                    if(!add_primitives(std::move(prims), child))
+                        return false;
+                    ids.push_back(child);
+                }
+
+                if(ids.size() == 1) {
+                    id = ids.front();
+                    return true;
+                }
+
+                BinaryNode node = {};
+                node.type = BinaryNodeType::List;
+                node.index[0] = static_cast<uint32_t>(children.size());
+                node.index[1] = static_cast<uint32_t>(ids.size());
+                children.insert(children.end(), ids.begin(), ids.end());
+
+                id = static_cast<uint32_t>(nodes.size());
+                nodes.push_back(node);
+                return true;
+            }
+
+            static void collect_bvh_leaves(const std::shared_ptr<Hittable> &object, std::vector<std::shared_ptr<Hittable>> &leaves)
+            {
+                auto node = std::dynamic_pointer_cast<BVHNode>(object);
+                if(!node) {
+                    leaves.push_back(object);
+                    return;
+                }
+                collect_bvh_leaves(node->left, leaves);
+                // Single-object nodes store the object as both children.
+                if(node->right != node->left)
+                    collect_bvh_leaves(node->right, leaves);
+            }
+
+            bool add_hittable(const std::shared_ptr<Hittable> &object, uint32_t &id)
+            {
+                auto cached = node_ids.find(object.get());
+                if(cached != node_ids.end()) {
+                    id = cached->second;
+                    return true;
+                }
+
+                BinaryNode node = {};
+                bool ok = true;
+
+                if(auto array = std::dynamic_pointer_cast<PrimitiveArray>(object))
+                    ok = append_array(*array, id);
+                else if(auto list = std::dynamic_pointer_cast<HittableList>(object))
+                    ok = add_group(list->objects, id);
+                else if(std::dynamic_pointer_cast<BVHNode>(object)) {
+                    // The BVH is rebuilt over the primitives, so only its leaves matter.
+                    std::vector<std::shared_ptr<Hittable>> leaves;
+                    collect_bvh_leaves(object, leaves);
+                    ok = add_group(leaves, id);
+                }
+                else if(auto translate = std::dynamic_pointer_cast<Translate>(object)) {
+                    node.type = BinaryNodeType::Translate;
+                    for(int i = 0; i < 3; i++)
+                        node.value[i] = translate->offset[i];
+                    ok = add_hittable(translate->ptr, node.index[0]);
+                    id = static_cast<uint32_t>(nodes.size());
+                    nodes.push_back(node);
+                }
+                else if(auto rotate = std::dynamic_pointer_cast<RotateY>(object)) {
+                    node.type = BinaryNodeType::RotateY;
+                    node.value[0] = std::atan2(rotate->sin_theta, rotate->cos_theta) * 180.0 / pi;
+                    ok = add_hittable(rotate->ptr, node.index[0]);
+                    id = static_cast<uint32_t>(nodes.size());
+                    nodes.push_back(node);
+                }
+                else if(auto transform = std::dynamic_pointer_cast<Transform>(object)) {
+                    node.type = BinaryNodeType::Transform;
+                    for(int row = 0; row < 3; row++)
+                        for(int column = 0; column < 4; column++)
+                            node.value[row * 4 + column] = transform->to_world.m[row][column];
+                    ok = add_hittable(transform->ptr, node.index[0]);
+                    id = static_cast<uint32_t>(nodes.size());
+                    nodes.push_back(node);
+                }
+                else if(auto medium = std::dynamic_pointer_cast<ConstantMedium>(object)) {
+                    auto phase = std::dynamic_pointer_cast<Isotropic>(medium->phase_function);
+                    if(!phase)
+                        return unsupported("medium phase function");
+                    node.type = BinaryNodeType::Medium;
+                    node.value[0] = -1 / medium->neg_inv_density;
+                    ok = add_hittable(medium->boundary, node.index[0]) && add_texture(phase->albedo, node.index[1]);
+                    id = static_cast<uint32_t>(nodes.size());
+                    nodes.push_back(node);
+                }
+                else if(auto medium = std::dynamic_pointer_cast<GridMedium>(object)) {
+                    auto phase = std::dynamic_pointer_cast<Isotropic>(medium->phase_function);
+                    if(!phase)
+                        return unsupported("medium phase function");
+                    const DensityGrid &grid = *medium->grid;
+                    node.type = BinaryNodeType::GridMedium;
+                    for(int a = 0; a < 3; a++) {
+                        node.index[1 + a] = static_cast<uint32_t>(grid.size()[a]);
+                        node.value[a] = grid.bounds().min()[a];
+                        node.value[3 + a] = grid.bounds().max()[a];
+                    }
+                    node.index[4] = static_cast<uint32_t>(grid.layout());
+                    node.value[6] = medium->density_scale;
+                    ok = add_texture(phase->albedo, node.index[0]);
+                    id = static_cast<uint32_t>(nodes.size());
+                    nodes.push_back(node);
+
+                    // Media sharing a grid share its samples.
+                    auto blob = grid_blob_ids.find(&grid);
+                    if(blob == grid_blob_ids.end()) {
+                        grid_samples.push_back(grid.samples());
+                        const auto &samples = grid_samples.back();
+                        blob = grid_blob_ids.emplace(&grid, blobs.size()).first;
+                        blobs.push_back({reinterpret_cast<const unsigned char*>(samples.data()), samples.size() * sizeof(float), 0, {}, {}});
+                    }
+                    blobs[blob->second].nodes.push_back(id);
+                }
+                else {
+                    // A lone primitive, e.g. the boundary of a medium.
+                    Primitive prim;
+                    bool is_primitive;
+                    if(!as_primitive(object, prim, is_primitive))
+                        return false;
+                    if(!is_primitive)
+                        return unsupported("object");
+                    ok = add_primitives({prim}, id);
+                }
+
+                if(!ok)
+                    return false;
+                node_ids[object.get()] = id;
+                return true;
+            }
+
+        private:
+            struct Blob {
+                const unsigned char* data;
+                uint64_t size, offset;
+                std::vector<uint32_t> textures;
+                std::vector<uint32_t> nodes;
+            };
+
+            std::vector<BinaryTexture> textures;
+            std::vector<BinaryMaterial> materials;
+            std::vector<BinaryNode> nodes;
+            std::vector<uint32_t> children;
+            std::vector<Primitive> primitives;
+            std::vector<PrimitiveBVHNode> bvh_nodes;
+            std::vector<Blob> blobs;
+            std::vector<std::pair<uint32_t, std::string>> tiled_paths; // texture, path
+            std::unordered_map<const unsigned char*, size_t> blob_ids;
+            std::unordered_map<const DensityGrid*, size_t> grid_blob_ids;
+            std::deque<std::vector<float>> grid_samples; // the blobs of density grids
+
+            std::unordered_map<const Texture*, uint32_t> texture_ids;
+            std::unordered_map<const Material*, uint32_t> material_ids;
+            std::unordered_map<const Hittable*, uint32_t> node_ids;
+    };
+
+    bool save_binary_scene(const Scene &scene, const std::string &source, const std::string &path)
+    {
+        texture_loader().wait(); // the images' pixels are written out
+        BinarySceneWriter writer;
+        uint32_t root;
+        return writer.add_world(scene.world, root) && writer.write(scene, source, root, path);
+    }
+
+    bool is_binary_scene(const std::string &path)
+    {
+        char magic[sizeof(binary_scene_magic)];
+        std::ifstream in(path, std::ios::binary);
+        return in.read(magic, sizeof(magic)) && std::memcmp(magic, binary_scene_magic, sizeof(magic)) == 0;
+    }
+
+    template<typename T>
+    static bool section_array(const MappedFile &file, const BinarySceneSection &section, const T* &data, size_t &count)
+    {
+        if(section.offset > file.size() || section.size > file.size() - section.offset
+           || section.offset % alignof(T) != 0 || section.size % sizeof(T) != 0)
+            return false;
+        data = reinterpret_cast<const T*>(file.data() + section.offset);
+        count = section.size / sizeof(T);
+        return true;
+    }
+
+    // Checks that a primitive array's BVH only refers to its own nodes and primitives,
+    // and that its traversal fits the stack. Returns what is wrong, or nullptr.
+    static const char* check_bvh(const PrimitiveBVHNode* nodes, size_t node_count, size_t primitive_count)
+    {
+        // Children follow their parents, so one pass sees every parent before its children.
+        std::vector<uint8_t> depth(node_count, 0);
+        for(size_t i = 0; i < node_count; i++) {
+            const auto &node = nodes[i];
+            if(node.count > 0) {
+                if(node.offset > primitive_count || node.count > primitive_count - node.offset)
+                    return "BVH leaf out of bounds";
+                continue;
+            }
+
+            if(i + 1 >= node_count || node.offset <= i + 1 || node.offset >= node_count || node.axis > 2)
+                return "bad BVH node";
+            if(depth[i] >= max_bvh_depth)
+                return "BVH too deep";
+            depth[i + 1] = std::max<uint8_t>(depth[i + 1], depth[i] + 1);
+            depth[node.offset] = std::max<uint8_t>(depth[node.offset], depth[i] + 1);
+        }
+        return nullptr;
+    }
+
+    // Checks that primitives are of known types and use materials of the table. Returns
+    // what is wrong, or nullptr.
+    static const char* check_primitives(const Primitive* prims, size_t count, size_t material_count)
+    {
+        for(size_t i = 0; i < count; i++) {
+            if(prims[i].type > PrimitiveType::Box)
+                return "unknown primitive type";
+            if(prims[i].material >= material_count)
+                return "bad material reference";
+        }
+        return nullptr;
+    }
+
+    bool load_binary_scene(const std::string &path, Scene &scene)
+    {
+        auto file = std::make_shared<MappedFile>(path);
+        auto invalid = [&path](const char* reason) {
+            std::cerr << "ERROR: Invalid scene file `" << path << "`: " << reason << "." << std::endl;
+            return false;
+        };
+
+        if(!file->valid()) {
+            std::cerr << "ERROR: Could not map scene file `" << path << "`." << std::endl;
+            return false;
+        }
+        if(file->size() < sizeof(BinarySceneHeader))
+            return invalid("truncated header");
+
+        const auto &header = *reinterpret_cast<const BinarySceneHeader*>(file->data());
+        if(std::memcmp(header.magic, binary_scene_magic, sizeof(header.magic)) != 0)
+            return invalid("not a binary scene");
+        if(header.version != binary_scene_version)
+            return invalid("unsupported version");
+        if(header.primitive_size != sizeof(Primitive) || header.bvh_node_size != sizeof(PrimitiveBVHNode))
+            return invalid("primitive layout does not match this build (float, double and SIMD builds differ)");
+
+        const BinaryTexture* texture_records = nullptr;
+        const BinaryMaterial* material_records = nullptr;
+        const BinaryNode* node_records = nullptr;
+        const uint32_t* child_indices = nullptr;
+        const Primitive* prims = nullptr;
+        const PrimitiveBVHNode* bvh = nullptr;
+        const char* strings = nullptr;
+        const unsigned char* blobs = nullptr;
+        size_t string_size = 0, texture_count = 0, material_count = 0, node_count = 0, child_count = 0, primitive_count = 0,
+               bvh_count = 0, blob_size = 0;
+
+        if(!section_array(*file, header.strings, strings, string_size)
+           || !section_array(*file, header.textures, texture_records, texture_count)
+           || !section_array(*file, header.materials, material_records, material_count)
+           || !section_array(*file, header.nodes, node_records, node_count)
+           || !section_array(*file, header.children, child_indices, child_count)
+           || !section_array(*file, header.primitives, prims, primitive_count)
+           || !section_array(*file, header.bvh_nodes, bvh, bvh_count)
+           || !section_array(*file, header.blobs, blobs, blob_size))
+            return invalid("section out of bounds");
+
+        std::vector<std::shared_ptr<Texture>> textures;
+        std::unordered_map<uint64_t, std::shared_ptr<const ImagePyramid>> pyramids; // by blob offset
+        for(size_t i = 0; i < texture_count; i++) {
+            const auto &record = texture_records[i];
+            switch(record.type) {
+                case BinaryTextureType::Solid:
+                    textures.push_back(std::make_shared<SolidColor>(record.color[0], record.color[1], record.color[2]));
+                    break;
+                case BinaryTextureType::Checker:
+                    if(record.children[0] >= i || record.children[1] >= i)
+                        return invalid("bad texture reference");
+                    textures.push_back(std::make_shared<CheckerTexture>(textures[record.children[0]], textures[record.children[1]]));
+                    break;
+                case BinaryTextureType::Noise:
+                    textures.push_back(std::make_shared<NoiseTexture>(record.scale, record.seed));
+                    break;
+                case BinaryTextureType::Image:
+                    if(record.width == 0) {
+                        textures.push_back(std::make_shared<ImageTexture>());
+                        break;
+                    }
+                    if(record.filter > static_cast<uint32_t>(TextureFilter::Trilinear))
+                        return invalid("unknown texture filter");
+                    if(record.format > static_cast<uint32_t>(TextureFormat::Float))
+                        return invalid("unknown texture format");
+                    if(record.width > 1u << 16 || record.height > 1u << 16 || record.blob > blob_size
+                       || ImagePyramid::pyramid_size(record.width, record.height, static_cast<TextureFormat>(record.format)) > blob_size - record.blob)
+                        return invalid("image out of bounds");
+                    if(!pyramids[record.blob])
+                        pyramids[record.blob] = std::make_shared<ImagePyramid>(blobs + record.blob, record.width, record.height,
+                                                                               static_cast<TextureFormat>(record.format));
+                    else if(pyramids[record.blob]->image_width() != static_cast<int>(record.width)
+                            || pyramids[record.blob]->image_height() != static_cast<int>(record.height)
+                            || pyramids[record.blob]->texel_format() != static_cast<TextureFormat>(record.format))
+                        return invalid("images of different sizes share their pixels");
+                    textures.push_back(std::make_shared<ImageTexture>(pyramids[record.blob], static_cast<TextureFilter>(record.filter)));
+                    break;
+                case BinaryTextureType::TiledImage:
+                    if(record.blob >= string_size || !std::memchr(strings + record.blob, '\0', string_size - record.blob))
+                        return invalid("texture path out of bounds");
+                    if(record.filter > static_cast<uint32_t>(TextureFilter::Trilinear))
+                        return invalid("unknown texture filter");
+                    textures.push_back(load_image_texture(strings + record.blob, static_cast<TextureFilter>(record.filter)));
+                    break;
+                default:
+                    return invalid("unknown texture type");
+            }
+        }
+
+        std::vector<std::shared_ptr<Material>> materials;
+        for(size_t i = 0; i < material_count; i++) {
+            const auto &record = material_records[i];
+            bool uses_texture = record.type == BinaryMaterialType::Lambertian || record.type == BinaryMaterialType::DiffuseLight
+                             || record.type == BinaryMaterialType::Isotropic;
+            if(uses_texture && record.texture >= textures.size())
+                return invalid("bad texture reference");
+
+            switch(record.type) {
+                case BinaryMaterialType::Lambertian:
+                    materials.push_back(std::make_shared<Lambertian>(textures[record.texture]));
+                    break;
+                case BinaryMaterialType::Metal:
+                    materials.push_back(std::make_shared<Metal>(Color(record.color[0], record.color[1], record.color[2]), record.value));
+                    break;
+                case BinaryMaterialType::Dielectric:
+                    materials.push_back(std::make_shared<Dielectric>(record.value));
+                    break;
+                case BinaryMaterialType::DiffuseLight:
+                    materials.push_back(std::make_shared<DiffuseLight>(textures[record.texture]));
+                    break;
+                case BinaryMaterialType::Isotropic:
+                    materials.push_back(std::make_shared<Isotropic>(textures[record.texture]));
+                    break;
+                default:
+                    return invalid("unknown material type");
+            }
+        }
+
+        // Primitive arrays are used in place, so their records and BVH nodes are checked
+        // here, once.
+        std::vector<std::shared_ptr<Hittable>> nodes;
+        for(size_t i = 0; i < node_count; i++) {
+            const auto &record = node_records[i];
+            const auto &index = record.index;
+            const auto &value = record.value;
+
+            switch(record.type) {
+                case BinaryNodeType::Primitives:
+                    if(index[0] > primitive_count || index[1] > primitive_count - index[0]
+                       || index[2] > bvh_count || index[3] > bvh_count - index[2])
+                        return invalid("primitive range out of bounds");
+                    if(const char* reason = check_primitives(prims + index[0], index[1], materials.size()))
+                        return invalid(reason);
+                    if(const char* reason = check_bvh(bvh + index[2], index[3], index[1]))
+                        return invalid(reason);
+                    nodes.push_back(std::make_shared<PrimitiveArray>(prims + index[0], index[1], bvh + index[2], index[3], materials));
+                    break;
+                case BinaryNodeType::List: {
+                    if(index[0] > child_count || index[1] > child_count - index[0])
+                        return invalid("child range out of bounds");
+                    auto list = std::make_shared<HittableList>();
+                    for(uint32_t c = index[0]; c < index[0] + index[1]; c++) {
+                        if(child_indices[c] >= i)
+                            return invalid("bad child reference");
+                        list->add(nodes[child_indices[c]]);
+                    }
+                    nodes.push_back(list);
+                    break;
+                }
+                case BinaryNodeType::Translate:
+                    if(index[0] >= i)
+                        return invalid("bad child reference");
+                    nodes.push_back(std::make_shared<Translate>(nodes[index[0]], Vec3(value[0], value[1], value[2])));
+                    break;
+                case BinaryNodeType::RotateY:
+                    if(index[0] >= i)
+                        return invalid("bad child reference");
+                    nodes.push_back(std::make_shared<RotateY>(nodes[index[0]], value[0]));
+                    break;
+                case BinaryNodeType::Medium:
+                    if(index[0] >= i || index[1] >= textures.size())
+                        return invalid("bad medium reference");
+                    nodes.push_back(std::make_shared<ConstantMedium>(nodes[index[0]], value[0], textures[index[1]]));
+                    break;
+                case BinaryNodeType::Transform: {
+                    if(index[0] >= i)
+                        return invalid("bad child reference");
+                    Affine to_world, to_object;
+                    for(int row = 0; row < 3; row++)
+                        for(int column = 0; column < 4; column++)
+                            to_world.m[row][column] = value[row * 4 + column];
+                    if(!to_world.inverse(to_object))
+                        return invalid("singular transform");
+                    nodes.push_back(std::make_shared<Transform>(nodes[index[0]], to_world));
+                    break;
+                }
+                case BinaryNodeType::GridMedium: {
+                    if(index[0] >= textures.size())
+                        return invalid("bad medium reference");
+                    if(index[1] < 2 || index[2] < 2 || index[3] < 2 || index[1] > 4096 || index[2] > 4096 || index[3] > 4096
+                       || index[4] > static_cast<uint32_t>(GridLayout::Sparse))
+                        return invalid("bad density grid");
+                    const size_t sample_count = static_cast<size_t>(index[1]) * index[2] * index[3];
+                    if(record.blob > blob_size || sample_count * sizeof(float) > blob_size - record.blob || record.blob % alignof(float) != 0)
+                        return invalid("density grid out of bounds");
+                    const float* first = reinterpret_cast<const float*>(blobs + record.blob);
+                    std::vector<float> samples(first, first + sample_count);
+                    for(float sample : samples)
+                        if(!(sample >= 0) || !std::isfinite(sample))
+                            return invalid("negative or non-finite density");
+                    AABB bounds(Point3(value[0], value[1], value[2]), Point3(value[3], value[4], value[5]));
+                    auto grid = std::make_shared<DensityGrid>(bounds, index[1], index[2], index[3], samples, static_cast<GridLayout>(index[4]));
+                    nodes.push_back(std::make_shared<GridMedium>(grid, value[6], textures[index[0]]));
+                    break;
+                }
+                default:
+                    return invalid("unknown node type");
+            }
+        }
+
+        if(header.root >= nodes.size())
+            return invalid("missing root");
+
+        scene.world.clear();
+        auto root = std::dynamic_pointer_cast<HittableList>(nodes[header.root]);
+        if(root)
+            scene.world.objects = root->objects;
+        else
+            scene.world.add(nodes[header.root]);
+
+        scene.lookfrom = Point3(header.lookfrom[0], header.lookfrom[1], header.lookfrom[2]);
+        scene.lookat = Point3(header.lookat[0], header.lookat[1], header.lookat[2]);
+        scene.vup = Vec3(header.vup[0], header.vup[1], header.vup[2]);
+        scene.background = Color(header.background[0], header.background[1], header.background[2]);
+        scene.vfov = header.vfov;
+        scene.aperture = header.aperture;
+        scene.dist_to_focus = header.dist_to_focus;
+        scene.aspect_ratio = header.aspect_ratio;
+        scene.samples_per_pixel = header.samples_per_pixel;
+        scene.storage = file;
+
+        return true;
+    }
+}
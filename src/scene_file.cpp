@@ -0,0 +1,591 @@
+#include <scene_file.hpp>
+#include <constant_medium.hpp>
+#include <grid_medium.hpp>
+#include <hittable.hpp>
+#include <material.hpp>
+#include <primitive.hpp>
+#include <texture.hpp>
+#include <texture_loader.hpp>
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace raytracing {
+    // Reads a file in large blocks and hands out one line at a time, without
+    // copying lines that lie entirely inside a block.
+    class LineReader {
+        public:
+            LineReader(FILE* f) : file(f), buffer(1 << 20) {}
+
+            bool next(std::string_view &line)
+            {
+                while(true) {
+                    auto newline = static_cast<char*>(std::memchr(buffer.data() + begin, '\n', end - begin));
+                    if(newline) {
+                        line = std::string_view(buffer.data() + begin, newline - (buffer.data() + begin));
+                        begin = newline - buffer.data() + 1;
+                        return true;
+                    }
+
+                    if(eof) {
+                        if(begin == end)
+                            return false;
+                        line = std::string_view(buffer.data() + begin, end - begin);
+                        begin = end;
+                        return true;
+                    }
+
+                    // Move the partial line to the front and refill behind it.
+                    std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+                    end -= begin;
+                    begin = 0;
+                    if(end == buffer.size())
+                        buffer.resize(buffer.size() * 2);
+                    size_t read = std::fread(buffer.data() + end, 1, buffer.size() - end, file);
+                    end += read;
+                    eof = read == 0;
+                }
+            }
+
+        private:
+            FILE* file;
+            std::vector<char> buffer;
+            size_t begin = 0, end = 0;
+            bool eof = false;
+    };
+
+    class SceneParser {
+        public:
+            SceneParser(const std::string &p, Scene &s) : path(p), scene(s) {}
+
+            bool parse(FILE* file)
+            {
+                LineReader reader(file);
+                std::string_view line;
+
+                while(reader.next(line)) {
+                    line_number++;
+                    if(!tokenize(line))
+                        return false;
+                    if(token_count == 0)
+                        continue;
+                    if(!directive())
+                        return false;
+                }
+
+                if(in_object)
+                    return error("missing `end` for object `" + object_name + "`");
+
+                auto world = finish_group(top);
+                if(world)
+                    scene.world.add(world);
+                return true;
+            }
+
+        private:
+            // A set of objects under construction: plain primitives are gathered into
+            // one array, everything else (instances, media) is kept as Hittables.
+            struct Group {
+                std::vector<Primitive> primitives;
+                HittableList objects;
+            };
+
+            bool error(const std::string &message)
+            {
+                std::cerr << "ERROR: " << path << ":" << line_number << ": " << message << "." << std::endl;
+                return false;
+            }
+
+            bool tokenize(std::string_view line)
+            {
+                token_count = 0;
+                size_t i = 0;
+                while(i < line.size()) {
+                    while(i < line.size() && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r'))
+                        i++;
+                    if(i == line.size() || line[i] == '#')
+                        break;
+                    size_t start = i;
+                    while(i < line.size() && line[i] != ' ' && line[i] != '\t' && line[i] != '\r')
+                        i++;
+                    if(token_count == max_tokens)
+                        return error("too many values on one line");
+                    tokens[token_count++] = line.substr(start, i - start);
+                }
+                return true;
+            }
+
+            template<typename T>
+            bool number(size_t index, T &value)
+            {
+                if(index >= token_count)
+                    return error("expected a number after `" + std::string(tokens[index - 1]) + "`");
+                auto token = tokens[index];
+                auto result = std::from_chars(token.data(), token.data() + token.size(), value);
+                if(result.ec == std::errc::result_out_of_range)
+                    return error("`" + std::string(token) + "` is out of range");
+                if(result.ec != std::errc() || result.ptr != token.data() + token.size())
+                    return error(std::string(std::is_integral_v<T> ? "expected a whole number" : "expected a number") + ", got `"
+                                 + std::string(token) + "`");
+                return true;
+            }
+
+            bool vec3(size_t index, Vec3 &value)
+            {
+                return number(index, value[0]) && number(index + 1, value[1]) && number(index + 2, value[2]);
+            }
+
+            // Whether the token can start a number `number` accepts, which takes no `+`.
+            bool is_number(size_t index) const
+            {
+                char c = tokens[index][0];
+                return (c >= '0' && c <= '9') || c == '-' || c == '.';
+            }
+
+            bool expect_count(size_t count)
+            {
+                if(token_count != count)
+                    return error("`" + std::string(tokens[0]) + "` expects " + std::to_string(count - 1) + " values");
+                return true;
+            }
+
+            // A texture is either the name of a `texture` or an inline `r g b` color.
+            bool texture_ref(size_t &index, std::shared_ptr<Texture> &texture)
+            {
+                if(index >= token_count)
+                    return error("expected a texture");
+                if(is_number(index)) {
+                    Color c;
+                    if(!vec3(index, c))
+                        return false;
+                    texture = std::make_shared<SolidColor>(c);
+                    index += 3;
+                    return true;
+                }
+                auto it = textures.find(std::string(tokens[index]));
+                if(it == textures.end())
+                    return error("unknown texture `" + std::string(tokens[index]) + "`");
+                texture = it->second;
+                index++;
+                return true;
+            }
+
+            bool material_ref(size_t index, uint32_t &material)
+            {
+                if(index >= token_count)
+                    return error("expected a material");
+                // Consecutive primitives usually share a material, so skip the lookup.
+                if(tokens[index] == last_material_name) {
+                    material = last_material;
+                    return true;
+                }
+                auto it = material_ids.find(std::string(tokens[index]));
+                if(it == material_ids.end())
+                    return error("unknown material `" + std::string(tokens[index]) + "`");
+                last_material_name = it->first;
+                last_material = material = it->second;
+                return true;
+            }
+
+            bool directive()
+            {
+                auto name = tokens[0];
+                Group &group = in_object ? object : top;
+
+                if(name == "sphere") {
+                    Point3 center;
+                    double radius;
+                    uint32_t material;
+                    if(!expect_count(6) || !vec3(1, center) || !number(4, radius) || !material_ref(5, material))
+                        return false;
+                    group.primitives.push_back(Primitive::sphere(center, radius, material));
+                }
+                else if(name == "moving_sphere") {
+                    Point3 center0, center1;
+                    double time0, time1, radius;
+                    uint32_t material;
+                    if(!expect_count(11) || !vec3(1, center0) || !vec3(4, center1) || !number(7, time0) || !number(8, time1)
+                       || !number(9, radius) || !material_ref(10, material))
+                        return false;
+                    group.primitives.push_back(Primitive::moving_sphere(center0, center1, time0, time1, radius, material));
+                }
+                else if(name == "xy_rect" || name == "xz_rect" || name == "yz_rect") {
+                    double a0, a1, b0, b1, k;
+                    uint32_t material;
+                    if(!expect_count(7) || !number(1, a0) || !number(2, a1) || !number(3, b0) || !number(4, b1) || !number(5, k)
+                       || !material_ref(6, material))
+                        return false;
+                    auto type = name == "xy_rect" ? PrimitiveType::XYRect : name == "xz_rect" ? PrimitiveType::XZRect : PrimitiveType::YZRect;
+                    group.primitives.push_back(Primitive::rect(type, a0, a1, b0, b1, k, material));
+                }
+                else if(name == "box") {
+                    Point3 p0, p1;
+                    uint32_t material;
+                    if(!expect_count(8) || !vec3(1, p0) || !vec3(4, p1) || !material_ref(7, material))
+                        return false;
+                    group.primitives.push_back(Primitive::box(p0, p1, material));
+                }
+                else if(name == "instance")
+                    return instance(group);
+                else if(name == "volume")
+                    return volume(group);
+                else if(name == "object") {
+                    if(in_object)
+                        return error("objects cannot be nested");
+                    if(!expect_count(2))
+                        return false;
+                    in_object = true;
+                    object_name = tokens[1];
+                    object = Group();
+                }
+                else if(name == "end") {
+                    if(!in_object)
+                        return error("`end` without `object`");
+                    auto hittable = finish_group(object);
+                    if(!hittable)
+                        return error("object `" + object_name + "` is empty");
+                    objects[object_name] = hittable;
+                    in_object = false;
+                }
+                else if(name == "material")
+                    return material();
+                else if(name == "texture")
+                    return texture();
+                else if(name == "camera")
+                    return camera();
+                else if(name == "background") {
+                    if(!expect_count(4) || !vec3(1, scene.background))
+                        return false;
+                }
+                else if(name == "samples") {
+                    int spp;
+                    if(!expect_count(2) || !number(1, spp))
+                        return false;
+                    if(spp < 1)
+                        return error("`samples` must be at least 1");
+                    scene.samples_per_pixel = spp;
+                }
+                else
+                    return error("unknown directive `" + std::string(name) + "`");
+
+                return true;
+            }
+
+            // instance <object> [translate x y z | rotate_y degrees]... [medium <density> <texture>]
+            bool instance(Group &group)
+            {
+                if(token_count < 2)
+                    return error("`instance` expects an object name");
+                auto it = objects.find(std::string(tokens[1]));
+                if(it == objects.end())
+                    return error("unknown object `" + std::string(tokens[1]) + "`");
+
+                std::shared_ptr<Hittable> hittable = it->second;
+                size_t i = 2;
+                while(i < token_count) {
+                    auto keyword = tokens[i];
+                    if(keyword == "translate") {
+                        Vec3 offset;
+                        if(!vec3(i + 1, offset))
+                            return false;
+                        hittable = std::make_shared<Translate>(hittable, offset);
+                        i += 4;
+                    }
+                    else if(keyword == "rotate_y") {
+                        double angle;
+                        if(!number(i + 1, angle))
+                            return false;
+                        hittable = std::make_shared<RotateY>(hittable, angle);
+                        i += 2;
+                    }
+                    else if(keyword == "medium") {
+                        double density;
+                        std::shared_ptr<Texture> albedo;
+                        i += 2;
+                        if(!number(i - 1, density) || !texture_ref(i, albedo))
+                            return false;
+                        if(i != token_count)
+                            return error("`medium` must come last in an `instance`");
+                        hittable = std::make_shared<ConstantMedium>(hittable, density, albedo);
+                    }
+                    else
+                        return error("unknown instance keyword `" + std::string(keyword) + "`");
+                }
+
+                group.objects.add(hittable);
+                return true;
+            }
+
+            // volume x0 y0 z0 x1 y1 z1 <density> <texture> (noise <frequency> <voxel size> [seed] | file <path>) [dense | sparse]
+            bool volume(Group &group)
+            {
+                Point3 p0, p1;
+                double density;
+                std::shared_ptr<Texture> albedo;
+                size_t i = 8;
+                if(!vec3(1, p0) || !vec3(4, p1) || !number(7, density) || !texture_ref(i, albedo))
+                    return false;
+                if(!(p0.x() < p1.x() && p0.y() < p1.y() && p0.z() < p1.z()))
+                    return error("`volume` expects the minimum corner of its box first");
+                if(i >= token_count)
+                    return error("`volume` expects a density source, `noise` or `file`");
+
+                auto source = tokens[i++];
+                AABB bounds(p0, p1);
+                std::shared_ptr<const DensityGrid> grid;
+                auto layout = [&](GridLayout &value) {
+                    if(i == token_count)
+                        return true;
+                    if(!parse_grid_layout(std::string(tokens[i]), value))
+                        return error("unknown grid layout `" + std::string(tokens[i]) + "`");
+                    i++;
+                    return true;
+                };
+                GridLayout grid_layout = GridLayout::Dense;
+                if(source == "noise") {
+                    double frequency, voxel_size;
+                    if(!number(i, frequency) || !number(i + 1, voxel_size))
+                        return false;
+                    if(voxel_size <= 0)
+                        return error("the voxel size must be positive");
+                    i += 2;
+                    uint64_t seed = 0;
+                    bool has_seed = i < token_count && tokens[i] != "dense" && tokens[i] != "sparse";
+                    if(has_seed && !number(i++, seed))
+                        return false;
+                    if(!layout(grid_layout))
+                        return false;
+                    if(DensityGrid::noise_samples(bounds, voxel_size) > max_noise_samples)
+                        return error("the volume would hold more than " + std::to_string(max_noise_samples)
+                                     + " samples, use a larger voxel size");
+                    grid = DensityGrid::from_noise(has_seed ? Perlin(seed) : Perlin(), frequency, bounds, voxel_size, grid_layout);
+                }
+                else if(source == "file") {
+                    if(i >= token_count)
+                        return error("`file` expects a file name");
+                    // Voxel files are relative to the scene file, like images.
+                    std::string file(tokens[i++]);
+                    auto slash = path.find_last_of('/');
+                    if(file[0] != '/' && slash != std::string::npos)
+                        file = path.substr(0, slash + 1) + file;
+                    if(!layout(grid_layout))
+                        return false;
+                    grid = DensityGrid::load(file, bounds, grid_layout);
+                    if(!grid)
+                        return false;
+                }
+                else
+                    return error("unknown density source `" + std::string(source) + "`");
+
+                if(i != token_count)
+                    return error("too many values for `volume`");
+                group.objects.add(std::make_shared<GridMedium>(grid, density, albedo));
+                return true;
+            }
+
+            bool material()
+            {
+                if(token_count < 3)
+                    return error("`material` expects a name and a type");
+                std::string material_name(tokens[1]);
+                auto type = tokens[2];
+                size_t i = 3;
+                std::shared_ptr<Material> mat;
+
+                if(type == "lambertian" || type == "light" || type == "isotropic") {
+                    std::shared_ptr<Texture> tex;
+                    if(!texture_ref(i, tex))
+                        return false;
+                    if(type == "lambertian")
+                        mat = std::make_shared<Lambertian>(tex);
+                    else if(type == "light")
+                        mat = std::make_shared<DiffuseLight>(tex);
+                    else
+                        mat = std::make_shared<Isotropic>(tex);
+                }
+                else if(type == "metal") {
+                    Color albedo;
+                    double fuzz;
+                    if(!vec3(i, albedo) || !number(i + 3, fuzz))
+                        return false;
+                    mat = std::make_shared<Metal>(albedo, fuzz);
+                    i += 4;
+                }
+                else if(type == "dielectric") {
+                    double ir;
+                    if(!number(i, ir))
+                        return false;
+                    mat = std::make_shared<Dielectric>(ir);
+                    i += 1;
+                }
+                else
+                    return error("unknown material type `" + std::string(type) + "`");
+
+                if(i != token_count)
+                    return error("too many values for material `" + material_name + "`");
+                if(material_ids.count(material_name))
+                    return error("material `" + material_name + "` is already defined");
+
+                material_ids[material_name] = static_cast<uint32_t>(materials.size());
+                materials.push_back(mat);
+                return true;
+            }
+
+            bool texture()
+            {
+                if(token_count < 3)
+                    return error("`texture` expects a name and a type");
+                std::string texture_name(tokens[1]);
+                if(textures.count(texture_name))
+                    return error("texture `" + texture_name + "` is already defined");
+                auto type = tokens[2];
+                size_t i = 3;
+                std::shared_ptr<Texture> tex;
+
+                if(type == "solid") {
+                    Color c;
+                    if(!vec3(i, c))
+                        return false;
+                    tex = std::make_shared<SolidColor>(c);
+                    i += 3;
+                }
+                else if(type == "checker") {
+                    std::shared_ptr<Texture> even, odd;
+                    if(!texture_ref(i, even) || !texture_ref(i, odd))
+                        return false;
+                    tex = std::make_shared<CheckerTexture>(even, odd);
+                }
+                else if(type == "noise") {
+                    double scale;
+                    if(!number(i, scale))
+                        return false;
+                    i += 1;
+                    if(i < token_count) {
+                        uint64_t seed;
+                        if(!number(i, seed))
+                            return false;
+                        tex = std::make_shared<NoiseTexture>(scale, seed);
+                        i += 1;
+                    }
+                    else
+                        tex = std::make_shared<NoiseTexture>(scale);
+                }
+                else if(type == "image") {
+                    if(i >= token_count)
+                        return error("`image` texture expects a file name");
+                    // Image paths are relative to the scene file.
+                    std::string file(tokens[i]);
+                    auto slash = path.find_last_of('/');
+                    if(file[0] != '/' && slash != std::string::npos)
+                        file = path.substr(0, slash + 1) + file;
+                    i += 1;
+                    TextureFilter filter = TextureFilter::Trilinear;
+                    TextureFormat format = TextureFormat::SRGB8;
+                    for(bool has_filter = false, has_format = false; i < token_count; i++) {
+                        std::string option(tokens[i]);
+                        if(!has_filter && parse_texture_filter(option, filter))
+                            has_filter = true;
+                        else if(!has_format && parse_texture_format(option, format))
+                            has_format = true;
+                        else
+                            return error("unknown texture filter or format `" + option + "`");
+                    }
+                    tex = load_image_texture(file, filter, format);
+                }
+                else
+                    return error("unknown texture type `" + std::string(type) + "`");
+
+                if(i != token_count)
+                    return error("too many values for texture `" + texture_name + "`");
+                textures[texture_name] = tex;
+                return true;
+            }
+
+            // camera [lookfrom x y z] [lookat x y z] [vup x y z] [vfov deg] [aperture a] [focus d] [aspect r]
+            bool camera()
+            {
+                size_t i = 1;
+                while(i < token_count) {
+                    auto key = tokens[i++];
+                    bool ok;
+                    if(key == "lookfrom")
+                        ok = vec3(i, scene.lookfrom);
+                    else if(key == "lookat")
+                        ok = vec3(i, scene.lookat);
+                    else if(key == "vup")
+                        ok = vec3(i, scene.vup);
+                    else if(key == "vfov")
+                        ok = number(i, scene.vfov);
+                    else if(key == "aperture")
+                        ok = number(i, scene.aperture);
+                    else if(key == "focus")
+                        ok = number(i, scene.dist_to_focus);
+                    else if(key == "aspect")
+                        ok = number(i, scene.aspect_ratio);
+                    else
+                        return error("unknown camera parameter `" + std::string(key) + "`");
+                    if(!ok)
+                        return false;
+                    i += (key == "lookfrom" || key == "lookat" || key == "vup") ? 3 : 1;
+                }
+                return true;
+            }
+
+            std::shared_ptr<Hittable> finish_group(Group &group)
+            {
+                std::shared_ptr<Hittable> primitives;
+                if(!group.primitives.empty())
+                    primitives = std::make_shared<PrimitiveArray>(std::move(group.primitives), materials, 0.0, 1.0);
+
+                if(group.objects.objects.empty())
+                    return primitives;
+
+                auto list = std::make_shared<HittableList>(group.objects);
+                if(primitives)
+                    list->add(primitives);
+                return list;
+            }
+
+        private:
+            static const size_t max_tokens = 32;
+
+            const std::string &path;
+            Scene &scene;
+            size_t line_number = 0;
+
+            std::string_view tokens[max_tokens];
+            size_t token_count = 0;
+
+            std::unordered_map<std::string, std::shared_ptr<Texture>> textures;
+            std::unordered_map<std::string, uint32_t> material_ids;
+            std::vector<std::shared_ptr<Material>> materials;
+            std::unordered_map<std::string, std::shared_ptr<Hittable>> objects;
+            std::string last_material_name;
+            uint32_t last_material = 0;
+
+            Group top, object;
+            bool in_object = false;
+            std::string object_name;
+    };
+
+    bool load_scene_file(const std::string &path, Scene &scene)
+    {
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if(!file) {
+            std::cerr << "ERROR: Could not open scene file `" << path << "`." << std::endl;
+            return false;
+        }
+
+        SceneParser parser(path, scene);
+        bool ok = parser.parse(file);
+        std::fclose(file);
+        return ok;
+    }
+}
@@ -1,8 +1,26 @@
+#include <algorithm>
 #include <cmath>
 #include <sphere.hpp>
+#include <stats.hpp>
 
 namespace raytracing {
-    bool Sphere::hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const
+    static void get_sphere_uv(const Point3 &p, real &u, real &v) 
+    {
+        // p: a given point on the sphere of radius one, centered at the origin.
+        // u: returned value [0,1] of angle around the Y axis from X=-1.
+        // v: returned value [0,1] of angle from Y=-1 to Y=+1.
+        //     <1 0 0> yields <0.50 0.50>       <-1  0  0> yields <0.00 0.50>
+        //     <0 1 0> yields <0.50 1.00>       < 0 -1  0> yields <0.50 0.00>
+        //     <0 0 1> yields <0.25 0.50>       < 0  0 -1> yields <0.75 0.50>
+
+        auto theta = acos(-p.y());
+        auto phi = atan2(-p.z(), p.x()) + pi;
+
+        u = phi / (2 * pi);
+        v = theta / pi;
+    }
+
+    bool hit_sphere(const Point3 &center, real radius, const Ray &r, real t_min, real t_max, HitRecord &rec)
     {
         Vec3 oc = r.origin() - center;
         auto a = r.direction().length_squared();
@@ -25,76 +43,108 @@ namespace raytracing {
         }
 
         rec.t = root;
-        rec.p = r.at(rec.t);
+        // Project the hit point back onto the sphere. Its distance from the center is
+        // then accurate up to the magnitudes of the center and radius, rather than up to
+        // the error of the root, which grows with the distance the ray travelled.
+        Vec3 from_center = r.at(rec.t) - center;
+        rec.p = center + from_center * (std::fabs(radius) / from_center.length());
+        real magnitude = fmax(fabs(center.x()), fmax(fabs(center.y()), fabs(center.z()))) + std::fabs(radius);
+        rec.p_error = 32 * std::numeric_limits<real>::epsilon() * magnitude;
         Vec3 outward_normal = (rec.p - center) / radius;
         rec.set_face_normal(r, outward_normal);
         get_sphere_uv(outward_normal, rec.u, rec.v);
-        rec.mat_ptr = mat_ptr;
+
+        rec.curvature = rec.front_face ? 1 / radius : -1 / radius;
+        if(r.has_differentials) {
+            Vec3 dpdx, dpdy;
+            rec.position_differentials(r, dpdx, dpdy);
+            Vec3 dnx = dpdx / radius, dny = dpdy / radius;
+
+            // Derivatives of the angles in `get_sphere_uv`. sqrt(x^2 + z^2) is the
+            // distance from the axis, clamped so the poles stay finite.
+            const Vec3 &n = outward_normal;
+            real axis2 = std::max(n.x() * n.x() + n.z() * n.z(), real(1e-6));
+            real inv_axis = 1 / std::sqrt(axis2);
+            rec.duv.dudx = (n.z() * dnx.x() - n.x() * dnx.z()) / (axis2 * 2 * pi);
+            rec.duv.dudy = (n.z() * dny.x() - n.x() * dny.z()) / (axis2 * 2 * pi);
+            rec.duv.dvdx = dnx.y() * inv_axis / pi;
+            rec.duv.dvdy = dny.y() * inv_axis / pi;
+        }
+        else {
+            // The cone's width, as a change of `u` along the equator and of `v` along a
+            // meridian.
+            real width = r.footprint(rec.t);
+            rec.duv.dudx = width / (2 * pi * std::fabs(radius));
+            rec.duv.dvdy = width / (pi * std::fabs(radius));
+            rec.duv.dvdx = rec.duv.dudy = 0;
+        }
 
         return true;
     }
 
-    bool Sphere::bounding_box(double time0, double time1, AABB &output_box) const
+    bool sphere_interval(const Point3 &center, real radius, const Ray &r, real &t_enter, real &t_exit)
     {
-        output_box = AABB(
-            center - Vec3(radius, radius, radius),
-            center + Vec3(radius, radius, radius)
-        );
+        Vec3 oc = r.origin() - center;
+        auto a = r.direction().length_squared();
+        auto half_b = dot(oc, r.direction());
+        auto c = oc.length_squared() - radius * radius;
+
+        auto discriminant = half_b * half_b - a * c;
+        if(discriminant < 0)
+            return false;
+
+        auto sqrtd = std::sqrt(discriminant);
+        t_enter = (-half_b - sqrtd) / a;
+        t_exit = (-half_b + sqrtd) / a;
         return true;
     }
 
-    void Sphere::get_sphere_uv(const Point3 &p, double &u, double &v) 
+    bool Sphere::hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const
     {
-        // p: a given point on the sphere of radius one, centered at the origin.
-        // u: returned value [0,1] of angle around the Y axis from X=-1.
-        // v: returned value [0,1] of angle from Y=-1 to Y=+1.
-        //     <1 0 0> yields <0.50 0.50>       <-1  0  0> yields <0.00 0.50>
-        //     <0 1 0> yields <0.50 1.00>       < 0 -1  0> yields <0.50 0.00>
-        //     <0 0 1> yields <0.25 0.50>       < 0  0 -1> yields <0.75 0.50>
+        STATS_INC(primitive_tests[StatSphere]);
+        if(!hit_sphere(center, radius, r, t_min, t_max, rec))
+            return false;
 
-        auto theta = acos(-p.y());
-        auto phi = atan2(-p.z(), p.x()) + pi;
+        STATS_INC(primitive_hits[StatSphere]);
+        rec.mat_ptr = mat_ptr;
+        return true;
+    }
 
-        u = phi / (2 * pi);
-        v = theta / pi;
+    bool Sphere::interval(const Ray &r, real &t_enter, real &t_exit) const
+    {
+        return sphere_interval(center, radius, r, t_enter, t_exit);
     }
 
-    Point3 MovingSphere::center(double time) const 
+    bool Sphere::bounding_box(double time0, double time1, AABB &output_box) const
     {
-        return center0 + ((time - time0) / (time1 - time0)) * (center1 - center0);
+        output_box = AABB(
+            center - Vec3(radius, radius, radius),
+            center + Vec3(radius, radius, radius)
+        );
+        return true;
     }
 
-    bool MovingSphere::hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const
+    Point3 MovingSphere::center(real time) const 
     {
-        Vec3 oc = r.origin() - center(r.time());
-        auto a = r.direction().length_squared();
-        auto half_b = dot(oc, r.direction());
-        auto c = oc.length_squared() - radius * radius;
+        return center0 + ((time - time0) / (time1 - time0)) * (center1 - center0);
+    }
 
-        auto discriminant = half_b * half_b - a * c;
-        if(discriminant < 0)
+    bool MovingSphere::hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const
+    {
+        STATS_INC(primitive_tests[StatMovingSphere]);
+        if(!hit_sphere(center(r.time()), radius, r, t_min, t_max, rec))
             return false;
 
-        auto sqrtd = std::sqrt(discriminant);
-
-        // Find the nearest root that lies in the acceptable range.
-        auto root = (-half_b - sqrtd) / a;
-        if(root < t_min || root > t_max)
-        {
-            root = (-half_b + sqrtd) / a;
-            if(root < t_min || root > t_max)
-                return false;
-        }
-
-        rec.t = root;
-        rec.p = r.at(rec.t);
-        Vec3 outward_normal = (rec.p - center(r.time())) / radius;
-        rec.set_face_normal(r, outward_normal);
+        STATS_INC(primitive_hits[StatMovingSphere]);
         rec.mat_ptr = mat_ptr;
-
         return true;
     }
 
+    bool MovingSphere::interval(const Ray &r, real &t_enter, real &t_exit) const
+    {
+        return sphere_interval(center(r.time()), radius, r, t_enter, t_exit);
+    }
+
     bool MovingSphere::bounding_box(double _time0, double _time1, AABB &output_box) const
     {
         AABB box0(
@@ -0,0 +1,85 @@
+#include <stats.hpp>
+
+#include <cstdio>
+
+namespace raytracing {
+    static const char* primitive_names[StatPrimitiveCount] = {"sphere", "moving sphere", "rect", "box", "medium"};
+    static const char* material_names[StatMaterialCount] = {"lambertian", "metal", "dielectric", "diffuse light", "isotropic"};
+
+    uint64_t RenderCounters::traversal_steps() const
+    {
+        uint64_t steps = bvh_nodes;
+        for(int i = 0; i < StatPrimitiveCount; i++)
+            steps += primitive_tests[i];
+        return steps;
+    }
+
+    RenderCounters &RenderCounters::operator+=(const RenderCounters &other)
+    {
+        bvh_nodes += other.bvh_nodes;
+        aabb_tests += other.aabb_tests;
+        for(int i = 0; i < StatPrimitiveCount; i++) {
+            primitive_tests[i] += other.primitive_tests[i];
+            primitive_hits[i] += other.primitive_hits[i];
+        }
+        paths_escaped += other.paths_escaped;
+        paths_absorbed += other.paths_absorbed;
+        paths_truncated += other.paths_truncated;
+        for(int i = 0; i < StatMaterialCount; i++) {
+            scatter_calls[i] += other.scatter_calls[i];
+            scatter_absorbed[i] += other.scatter_absorbed[i];
+        }
+        return *this;
+    }
+
+    static double ratio(uint64_t a, uint64_t b)
+    {
+        return b ? static_cast<double>(a) / b : 0.0;
+    }
+
+    void write_counters(std::ostream &out, const RenderCounters &counters, uint64_t samples, uint64_t rays)
+    {
+        char line[128];
+        auto print = [&](const char* label, double value, const char* unit = "") {
+            std::snprintf(line, sizeof(line), "  %-28s %12.3f%s\n", label, value, unit);
+            out << line;
+        };
+
+        uint64_t tests = 0, hits = 0;
+        for(int i = 0; i < StatPrimitiveCount; i++) {
+            tests += counters.primitive_tests[i];
+            hits += counters.primitive_hits[i];
+        }
+        uint64_t paths = counters.paths_escaped + counters.paths_absorbed + counters.paths_truncated;
+
+        out << "Statistics:\n";
+        print("rays per sample", ratio(rays, samples));
+        print("BVH nodes per ray", ratio(counters.bvh_nodes, rays));
+        print("AABB tests per ray", ratio(counters.aabb_tests, rays));
+        print("primitive tests per ray", ratio(tests, rays));
+        print("primitive hit rate", 100 * ratio(hits, tests), "%");
+        for(int i = 0; i < StatPrimitiveCount; i++) {
+            if(counters.primitive_tests[i] == 0)
+                continue;
+            std::snprintf(line, sizeof(line), "    %-26s %12.3f tests/ray, %5.1f%% hit\n", primitive_names[i],
+                          ratio(counters.primitive_tests[i], rays),
+                          100 * ratio(counters.primitive_hits[i], counters.primitive_tests[i]));
+            out << line;
+        }
+
+        out << "Paths:\n";
+        print("escaped", 100 * ratio(counters.paths_escaped, paths), "%");
+        print("absorbed", 100 * ratio(counters.paths_absorbed, paths), "%");
+        print("truncated at max depth", 100 * ratio(counters.paths_truncated, paths), "%");
+
+        out << "Scattering:\n";
+        for(int i = 0; i < StatMaterialCount; i++) {
+            if(counters.scatter_calls[i] == 0)
+                continue;
+            std::snprintf(line, sizeof(line), "  %-28s %12llu calls, %5.1f%% absorbed\n", material_names[i],
+                          static_cast<unsigned long long>(counters.scatter_calls[i]),
+                          100 * ratio(counters.scatter_absorbed[i], counters.scatter_calls[i]));
+            out << line;
+        }
+    }
+}
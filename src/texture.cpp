@@ -1,49 +1,332 @@
 #include <texture.hpp>
+#include <texture_cache.hpp>
 #include <stb_image.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 
 namespace raytracing {
-    Color CheckerTexture::value(double u, double v, const Point3 &p) const
+    Color CheckerTexture::value(real u, real v, const Point3 &p, const UVDerivatives &duv) const
     {
-        auto sines = sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z());
-        return sines < 0 ? odd->value(u, v, p) : even->value(u, v, p);
+        if(folded)
+            return odd_cell(p) ? odd_color : even_color;
+        return odd_cell(p) ? odd_texture->value(u, v, p, duv) : even_texture->value(u, v, p, duv);
     }
 
-    ImageTexture::ImageTexture(const char* filename)
+    void CheckerTexture::fold()
+    {
+        auto even_solid = std::dynamic_pointer_cast<SolidColor>(even_texture);
+        auto odd_solid = std::dynamic_pointer_cast<SolidColor>(odd_texture);
+        folded = even_solid && odd_solid;
+        if(folded) {
+            even_color = even_solid->color();
+            odd_color = odd_solid->color();
+        }
+    }
+
+    bool parse_texture_filter(const std::string &name, TextureFilter &filter)
+    {
+        if(name == "nearest")
+            filter = TextureFilter::Nearest;
+        else if(name == "bilinear")
+            filter = TextureFilter::Bilinear;
+        else if(name == "trilinear")
+            filter = TextureFilter::Trilinear;
+        else
+            return false;
+        return true;
+    }
+
+    bool parse_texture_format(const std::string &name, TextureFormat &format)
+    {
+        if(name == "srgb8")
+            format = TextureFormat::SRGB8;
+        else if(name == "half")
+            format = TextureFormat::Half;
+        else if(name == "float")
+            format = TextureFormat::Float;
+        else
+            return false;
+        return true;
+    }
+
+    // sRGB encoded bytes to linear intensity, and the linear intensities half way between
+    // neighbouring bytes, which encoding searches.
+    struct SRGBTables {
+        float to_linear[256];
+        float thresholds[255];
+
+        SRGBTables()
+        {
+            for(int i = 0; i < 256; i++) {
+                double c = i / 255.0;
+                to_linear[i] = static_cast<float>(c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+            }
+            for(int i = 0; i < 255; i++)
+                thresholds[i] = 0.5f * (to_linear[i] + to_linear[i + 1]);
+        }
+    };
+    static const SRGBTables srgb;
+
+    static unsigned char encode_srgb(real linear)
+    {
+        return static_cast<unsigned char>(std::upper_bound(srgb.thresholds, srgb.thresholds + 255, static_cast<float>(linear)) - srgb.thresholds);
+    }
+
+    // IEEE half precision, rounded to nearest even. Texels are never negative, infinite
+    // or NaN.
+    static uint16_t float_to_half(float f)
+    {
+        uint32_t x;
+        std::memcpy(&x, &f, sizeof(x));
+        if(x >= 0x47800000)
+            return 0x7c00;
+        if(x < 0x38800000)
+            return static_cast<uint16_t>(std::lrint(f * 0x1.0p24f)); // subnormal
+        x += 0xc8000fff + ((x >> 13) & 1); // rebias the exponent and round
+        return static_cast<uint16_t>(x >> 13);
+    }
+
+    static float half_to_float(uint16_t h)
+    {
+        if(h < 0x0400)
+            return h * 0x1.0p-24f; // subnormal
+        uint32_t x = (static_cast<uint32_t>(h) << 13) + ((127 - 15) << 23);
+        float f;
+        std::memcpy(&f, &x, sizeof(f));
+        return f;
+    }
+
+    std::vector<ImagePyramid::Level> ImagePyramid::layout(int w, int h, TextureFormat format)
+    {
+        const size_t texel_tile_bytes = tile_size * tile_size * texel_bytes(format);
+        std::vector<Level> levels;
+        size_t offset = 0;
+        while(true) {
+            Level level;
+            level.width = w;
+            level.height = h;
+            level.tiles_x = (w + tile_size - 1) / tile_size;
+            level.offset = offset;
+            levels.push_back(level);
+            offset += static_cast<size_t>(level.tiles_x) * ((h + tile_size - 1) / tile_size) * texel_tile_bytes;
+            if(w == 1 && h == 1)
+                return levels;
+            w = std::max(1, w / 2);
+            h = std::max(1, h / 2);
+        }
+    }
+
+    size_t ImagePyramid::pyramid_size(int w, int h, TextureFormat format)
+    {
+        if(w <= 0 || h <= 0)
+            return 0;
+        const Level last = layout(w, h, format).back();
+        return last.offset + tile_size * tile_size * texel_bytes(format);
+    }
+
+    ImageTexture::ImageTexture(const char* filename, TextureFilter _filter, TextureFormat format)
+        : filter(_filter)
+    {
+        auto decoded = std::make_shared<ImagePyramid>(format);
+        decoded->load(filename);
+        pyramid = decoded;
+    }
+
+    template<TextureFormat F>
+    Color ImagePyramid::texel_color(const Level &level, int x, int y) const
+    {
+        unsigned char scratch[bytes_per_pixel];
+        const unsigned char* t = texel<F>(level, x, y, scratch);
+        if constexpr(F == TextureFormat::SRGB8)
+            return Color(srgb.to_linear[t[0]], srgb.to_linear[t[1]], srgb.to_linear[t[2]]);
+        else if constexpr(F == TextureFormat::Half) {
+            uint16_t h[3];
+            std::memcpy(h, t, sizeof(h));
+            return Color(half_to_float(h[0]), half_to_float(h[1]), half_to_float(h[2]));
+        }
+        else {
+            float f[3];
+            std::memcpy(f, t, sizeof(f));
+            return Color(f[0], f[1], f[2]);
+        }
+    }
+
+    template<TextureFormat F>
+    void ImagePyramid::store(const Level &level, int x, int y, const Color &color)
+    {
+        unsigned char* t = const_cast<unsigned char*>(texel<F>(level, x, y, nullptr));
+        for(int i = 0; i < 3; i++) {
+            if constexpr(F == TextureFormat::SRGB8)
+                t[i] = encode_srgb(color[i]);
+            else if constexpr(F == TextureFormat::Half) {
+                uint16_t h = float_to_half(static_cast<float>(color[i]));
+                std::memcpy(t + i * sizeof(h), &h, sizeof(h));
+            }
+            else {
+                float f = static_cast<float>(color[i]);
+                std::memcpy(t + i * sizeof(f), &f, sizeof(f));
+            }
+        }
+    }
+
+    // Each level averages 2x2 texels of the previous one, in linear color. Odd rows and
+    // columns of a level are dropped, except where it is only one texel wide or high.
+    template<TextureFormat F>
+    void ImagePyramid::build_levels(const unsigned char* image)
+    {
+        for(int y = 0; y < height; y++)
+            for(int x = 0; x < width; x++) {
+                const unsigned char* p = image + (static_cast<size_t>(y) * width + x) * bytes_per_pixel;
+                if constexpr(F == TextureFormat::SRGB8)
+                    std::memcpy(const_cast<unsigned char*>(texel<F>(mip[0], x, y, nullptr)), p, bytes_per_pixel);
+                else
+                    store<F>(mip[0], x, y, Color(srgb.to_linear[p[0]], srgb.to_linear[p[1]], srgb.to_linear[p[2]]));
+            }
+
+        for(size_t l = 1; l < mip.size(); l++) {
+            const Level &from = mip[l - 1], &to = mip[l];
+            for(int y = 0; y < to.height; y++)
+                for(int x = 0; x < to.width; x++) {
+                    int x0 = std::min(2 * x, from.width - 1), x1 = std::min(2 * x + 1, from.width - 1);
+                    int y0 = std::min(2 * y, from.height - 1), y1 = std::min(2 * y + 1, from.height - 1);
+                    Color sum = texel_color<F>(from, x0, y0) + texel_color<F>(from, x1, y0)
+                              + texel_color<F>(from, x0, y1) + texel_color<F>(from, x1, y1);
+                    store<F>(to, x, y, 0.25 * sum);
+                }
+        }
+    }
+
+    bool ImagePyramid::load(const char* filename)
+    {
+        auto components_per_pixel = bytes_per_pixel;
+        return build(stbi_load(filename, &width, &height, &components_per_pixel, components_per_pixel), filename);
+    }
+
+    bool ImagePyramid::load(const unsigned char* encoded, size_t size, const char* name)
     {
         auto components_per_pixel = bytes_per_pixel;
-        data = stbi_load(filename, &width, &height, &components_per_pixel, components_per_pixel);
+        return build(stbi_load_from_memory(encoded, static_cast<int>(size), &width, &height, &components_per_pixel, components_per_pixel), name);
+    }
 
-        if(!data) 
+    bool ImagePyramid::build(unsigned char* image, const char* name)
+    {
+        if(!image)
         {
-            std::cerr << "ERROR: Could not load texture image file `" << filename << "`." << std::endl;
+            std::cerr << "ERROR: Could not load texture image file `" << name << "`." << std::endl;
             width = height = 0;
+            return false;
+        }
+
+        mip = layout(width, height, format);
+        storage.resize(pyramid_size(width, height, format) / tile_bytes);
+        data = storage[0].texels;
+        switch(format) {
+            case TextureFormat::SRGB8: build_levels<TextureFormat::SRGB8>(image); break;
+            case TextureFormat::Half:  build_levels<TextureFormat::Half>(image); break;
+            case TextureFormat::Float: build_levels<TextureFormat::Float>(image); break;
+        }
+        stbi_image_free(image);
+        return true;
+    }
+
+    ImagePyramid::ImagePyramid(const unsigned char* pyramid, int w, int h, TextureFormat _format)
+        : width(w), height(h), format(_format), mip(layout(w, h, _format)), data(pyramid)
+    {}
+
+    ImagePyramid::ImagePyramid(std::shared_ptr<const TiledTexture> _tiles)
+        : width(_tiles->width()), height(_tiles->height()), format(TextureFormat::SRGB8),
+          mip(layout(width, height, format)), data(nullptr), tiles(std::move(_tiles))
+    {}
+
+    void ImagePyramid::read_tile(uint32_t tile, int offset, unsigned char* texel) const
+    {
+        tiles->read(tile, offset, texel);
+    }
+
+    // log2 of x >= 1, exact at powers of two and linear in between (at most 0.09 too
+    // small), which is all mip level selection needs and a fraction of `std::log2`'s cost.
+    static real approximate_log2(double x)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        int exponent = static_cast<int>(bits >> 52) - 1023;
+        double mantissa = static_cast<double>(bits & ((1ull << 52) - 1)) * 0x1.0p-52;
+        return static_cast<real>(exponent + mantissa);
+    }
+
+    template<TextureFormat F>
+    Color ImagePyramid::bilinear(int level, real u, real v) const
+    {
+        const Level &l = mip[level];
+        real x = u * l.width - real(0.5), y = v * l.height - real(0.5);
+        // x, y >= -0.5, so shifting them by one makes truncation round down.
+        int x0 = static_cast<int>(x + 1) - 1, y0 = static_cast<int>(y + 1) - 1;
+        real fx = x - x0, fy = y - y0;
+
+        // Texels beyond the border repeat the border, like the clamped coordinates.
+        int x1 = std::min(x0 + 1, l.width - 1), y1 = std::min(y0 + 1, l.height - 1);
+        x0 = std::max(x0, 0);
+        y0 = std::max(y0, 0);
+
+        Color a = texel_color<F>(l, x0, y0), b = texel_color<F>(l, x1, y0);
+        Color c = texel_color<F>(l, x0, y1), d = texel_color<F>(l, x1, y1);
+        Color top = a + fx * (b - a);
+        Color bottom = c + fx * (d - c);
+        return top + fy * (bottom - top);
+    }
+
+    template<TextureFormat F>
+    Color ImagePyramid::lookup(TextureFilter filter, real u, real v, const UVDerivatives &duv) const
+    {
+        if(filter == TextureFilter::Nearest) {
+            auto i = static_cast<int>(u * width);
+            auto j = static_cast<int>(v * height);
+
+            // Clamp integer mapping, since actual coordinates should be less than 1.0
+            if(i >= width) i = width - 1;
+            if(j >= height) j = height - 1;
+
+            return texel_color<F>(mip[0], i, j);
         }
 
-        bytes_per_scanline = bytes_per_pixel * width;
+        // Level l has texels 2^l times wider than the full image's, so the level whose
+        // texels match the footprint is log2 of the number of full texels it covers,
+        // along the longer of the pixel's two edges.
+        real xu = duv.dudx * width, xv = duv.dvdx * height;
+        real yu = duv.dudy * width, yv = duv.dvdy * height;
+        real texels2 = std::max(xu * xu + xv * xv, yu * yu + yv * yv);
+        if(!(texels2 > 1))
+            return bilinear<F>(0, u, v);
+        real lod = std::min(real(0.5) * approximate_log2(texels2), real(levels() - 1));
+
+        if(filter == TextureFilter::Bilinear)
+            return bilinear<F>(static_cast<int>(lod + real(0.5)), u, v);
+
+        int level = static_cast<int>(lod);
+        real blend = lod - level;
+        Color color = bilinear<F>(level, u, v);
+        if(blend > 0)
+            color += blend * (bilinear<F>(level + 1, u, v) - color);
+        return color;
     }
 
-    Color ImageTexture::value(double u, double v, const Vec3 &p) const
+    Color ImagePyramid::value(TextureFilter filter, real u, real v, const UVDerivatives &duv) const
     {
         // If we have no texture data, then return solid cyan as a debugging aid.
-        if (data == nullptr)
+        if (data == nullptr && !tiles)
             return Color(0, 1, 1);
         
         // Clamp input texture coordinates to [0,1] x [1,0]
         u = clamp(u, 0.0, 1.0);
         v = 1.0 - clamp(v, 0.0, 1.0); // Flip V to image coordinates
 
-        auto i = static_cast<int>(u * width);
-        auto j = static_cast<int>(v * height);
-
-        // Clamp integer mapping, since actual coordinates should be less than 1.0
-        if(i >= width) i = width - 1;
-        if(j >= height) j = height - 1;
-
-        const auto color_scale = 1.0 / 255.0;
-        auto pixel = data + j * bytes_per_scanline + i * bytes_per_pixel;
-
-        return Color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
+        switch(format) {
+            case TextureFormat::Half:  return lookup<TextureFormat::Half>(filter, u, v, duv);
+            case TextureFormat::Float: return lookup<TextureFormat::Float>(filter, u, v, duv);
+            default:                   return lookup<TextureFormat::SRGB8>(filter, u, v, duv);
+        }
     }
-}
\ No newline at end of file
+}
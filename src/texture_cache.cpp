@@ -0,0 +1,259 @@
+#include <texture_cache.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace raytracing {
+    static const char tiled_texture_magic[8] = {'R', 'T', 'T', 'I', 'L', 'E', 'S', '\0'};
+    static const uint32_t tiled_texture_version = 1;
+    static const uint64_t tiled_texture_alignment = 64;
+
+    bool is_tiled_texture(const std::string &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        char magic[sizeof(tiled_texture_magic)];
+        return file.read(magic, sizeof(magic)) && std::memcmp(magic, tiled_texture_magic, sizeof(magic)) == 0;
+    }
+
+    std::string tiled_texture_path(const std::string &image_path)
+    {
+        auto slash = image_path.find_last_of('/');
+        auto dot = image_path.find_last_of('.');
+        if(dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            return image_path + ".rtt";
+        return image_path.substr(0, dot) + ".rtt";
+    }
+
+    bool write_tiled_texture(const std::string &image_path, const std::string &path)
+    {
+        ImageTexture image(image_path.c_str());
+        if(!image.pixels())
+            return false;
+
+        TiledTextureHeader header = {};
+        std::memcpy(header.magic, tiled_texture_magic, sizeof(header.magic));
+        header.version = tiled_texture_version;
+        header.width = image.image_width();
+        header.height = image.image_height();
+        header.tile_bytes = ImagePyramid::tile_bytes;
+        header.pyramid_offset = (sizeof(header) + tiled_texture_alignment - 1) & ~(tiled_texture_alignment - 1);
+        header.pyramid_size = ImagePyramid::pyramid_size(image.image_width(), image.image_height());
+
+        std::ofstream file(path, std::ios::binary);
+        static const char zeros[tiled_texture_alignment] = {};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(zeros, header.pyramid_offset - sizeof(header));
+        file.write(reinterpret_cast<const char*>(image.pixels()), header.pyramid_size);
+        if(!file) {
+            std::cerr << "ERROR: Could not write tiled texture `" << path << "`." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    TiledTexture::TiledTexture(TextureCache &_cache, uint32_t _id, const std::string &path, int _fd, const TiledTextureHeader &_header)
+        : cache(_cache), id(_id), file_path(path), fd(_fd), header(_header), tile_count(static_cast<uint32_t>(header.pyramid_size / ImagePyramid::tile_bytes)),
+          pages(new std::atomic<uint32_t>[tile_count]), read_failed(false)
+    {
+        for(uint32_t i = 0; i < tile_count; i++)
+            pages[i].store(0, std::memory_order_relaxed);
+    }
+
+    TiledTexture::~TiledTexture()
+    {
+        cache.release(*this);
+        close(fd);
+    }
+
+    void TiledTexture::read(uint32_t tile, int offset, unsigned char texel[ImagePyramid::bytes_per_pixel]) const
+    {
+        cache.count_lookup();
+        const uint64_t key = static_cast<uint64_t>(id) << 32 | tile;
+        while(true) {
+            uint32_t index = pages[tile].load(std::memory_order_acquire);
+            if(index == 0 || index == TextureCache::loading)
+                index = cache.fault(*this, tile);
+
+            // The copy may race with a refill of the slot, which the sequence number
+            // then tells, so the texel is only used if it did not change.
+            TextureCache::Slot &slot = cache.slot(index - 1);
+            uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if(sequence % 2 == 0 && slot.key.load(std::memory_order_relaxed) == key) {
+                std::memcpy(texel, slot.texels + offset, ImagePyramid::bytes_per_pixel);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if(slot.sequence.load(std::memory_order_relaxed) == sequence) {
+                    if(!slot.referenced.load(std::memory_order_relaxed))
+                        slot.referenced.store(true, std::memory_order_relaxed);
+                    return;
+                }
+            }
+            // The slot was evicted (its page entry is cleared first) or is being refilled.
+        }
+    }
+
+    TextureCache::TextureCache(size_t capacity_bytes)
+    {
+        set_capacity(capacity_bytes);
+    }
+
+    bool TextureCache::set_capacity(size_t capacity_bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(next_id != 1)
+            return false;
+        slot_count = static_cast<uint32_t>(std::max<size_t>(capacity_bytes / sizeof(Slot), min_slots));
+        chunks.reset(new std::unique_ptr<Slot[]>[(slot_count + chunk_slots - 1) / chunk_slots]);
+        return true;
+    }
+
+    std::shared_ptr<TiledTexture> TextureCache::open(const std::string &path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            std::cerr << "ERROR: Could not open tiled texture `" << path << "`." << std::endl;
+            return nullptr;
+        }
+
+        TiledTextureHeader header;
+        struct stat st;
+        auto invalid = [&](const char* reason) {
+            std::cerr << "ERROR: Invalid tiled texture `" << path << "`: " << reason << "." << std::endl;
+            close(fd);
+            return nullptr;
+        };
+        if(pread(fd, &header, sizeof(header), 0) != sizeof(header) || std::memcmp(header.magic, tiled_texture_magic, sizeof(header.magic)) != 0)
+            return invalid("not a tiled texture");
+        if(header.version != tiled_texture_version || header.tile_bytes != ImagePyramid::tile_bytes)
+            return invalid("unsupported version or tile layout");
+        if(header.width == 0 || header.height == 0 || header.width > 1u << 16 || header.height > 1u << 16
+           || header.pyramid_size != ImagePyramid::pyramid_size(header.width, header.height))
+            return invalid("bad size");
+        if(fstat(fd, &st) != 0 || header.pyramid_offset > static_cast<uint64_t>(st.st_size)
+           || header.pyramid_size > static_cast<uint64_t>(st.st_size) - header.pyramid_offset)
+            return invalid("truncated");
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<TiledTexture> texture(new TiledTexture(*this, next_id++, path, fd, header));
+        textures.push_back(texture.get());
+        page_table_bytes += texture->tile_count * sizeof(std::atomic<uint32_t>);
+        return texture;
+    }
+
+    uint32_t TextureCache::fault(const TiledTexture &texture, uint32_t tile)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        uint32_t resident;
+        loaded.wait(lock, [&] { return (resident = texture.pages[tile].load(std::memory_order_relaxed)) != loading; });
+        if(resident != 0)
+            return resident;
+
+        // Fill the slots in order while there are free ones, then go round them and take
+        // the first one that was not read since the hand last passed it (CLOCK), passing
+        // over the ones other threads are reading tiles into.
+        uint32_t index;
+        if(used_slots < slot_count) {
+            index = used_slots++;
+            if(!chunks[index / chunk_slots])
+                chunks[index / chunk_slots].reset(new Slot[chunk_slots]);
+        }
+        else {
+            while(true) {
+                index = clock_hand;
+                clock_hand = (clock_hand + 1) % slot_count;
+                if(slot(index).sequence.load(std::memory_order_relaxed) % 2 == 0
+                   && !slot(index).referenced.exchange(false, std::memory_order_relaxed))
+                    break;
+            }
+        }
+
+        Slot &s = slot(index);
+        uint64_t old = s.key.load(std::memory_order_relaxed);
+        if(old != 0) {
+            textures[(old >> 32) - 1]->pages[static_cast<uint32_t>(old)].store(0, std::memory_order_relaxed);
+            evictions++;
+        }
+
+        uint32_t sequence = s.sequence.load(std::memory_order_relaxed);
+        s.sequence.store(sequence + 1, std::memory_order_relaxed);
+        s.key.store(0, std::memory_order_relaxed);
+        texture.pages[tile].store(loading, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        lock.unlock();
+
+        uint64_t at = texture.header.pyramid_offset + static_cast<uint64_t>(tile) * ImagePyramid::tile_bytes;
+        if(pread(texture.fd, s.texels, ImagePyramid::tile_bytes, at) != ImagePyramid::tile_bytes) {
+            std::memset(s.texels, 0, ImagePyramid::tile_bytes);
+            if(!texture.read_failed.exchange(true))
+                std::cerr << "ERROR: Could not read a tile of `" << texture.file_path << "`." << std::endl;
+        }
+
+        lock.lock();
+        s.key.store(static_cast<uint64_t>(texture.id) << 32 | tile, std::memory_order_relaxed);
+        s.referenced.store(true, std::memory_order_relaxed);
+        s.sequence.store(sequence + 2, std::memory_order_release);
+        texture.pages[tile].store(index + 1, std::memory_order_release);
+        misses++;
+        loaded.notify_all();
+        return index + 1;
+    }
+
+    void TextureCache::release(TiledTexture &texture)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // The texture's slots become the least valuable ones: empty, but still counted
+        // as used, so the clock hand takes them first.
+        for(uint32_t i = 0; i < used_slots; i++) {
+            Slot &s = slot(i);
+            if(s.key.load(std::memory_order_relaxed) >> 32 == texture.id) {
+                s.key.store(0, std::memory_order_relaxed);
+                s.referenced.store(false, std::memory_order_relaxed);
+            }
+        }
+        textures[texture.id - 1] = nullptr;
+        page_table_bytes -= texture.tile_count * sizeof(std::atomic<uint32_t>);
+    }
+
+    void TextureCache::count_lookup()
+    {
+        static std::atomic<int> next_stripe{0};
+        thread_local const int stripe = next_stripe.fetch_add(1, std::memory_order_relaxed) % counter_stripes;
+        lookups[stripe].value.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    TextureCache::Stats TextureCache::stats() const
+    {
+        Stats stats;
+        for(const auto &counter : lookups)
+            stats.lookups += counter.value.load(std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.misses = misses;
+        stats.evictions = evictions;
+        stats.resident_bytes = used_slots * sizeof(Slot) + page_table_bytes;
+        stats.capacity_bytes = slot_count * sizeof(Slot);
+        return stats;
+    }
+
+    TextureCache &texture_cache()
+    {
+        static TextureCache cache(size_t(256) << 20);
+        return cache;
+    }
+
+    void write_texture_cache_stats(std::ostream &out, const TextureCache::Stats &stats)
+    {
+        char line[160];
+        double hit_rate = stats.lookups ? 100.0 * (stats.lookups - stats.misses) / stats.lookups : 0.0;
+        std::snprintf(line, sizeof(line), "Texture cache: %llu lookups, %.2f%% hits, %llu evictions, %.1f of %.1f MiB resident\n",
+                      static_cast<unsigned long long>(stats.lookups), hit_rate, static_cast<unsigned long long>(stats.evictions),
+                      stats.resident_bytes / 1048576.0, stats.capacity_bytes / 1048576.0);
+        out << line;
+    }
+}
@@ -0,0 +1,182 @@
+#include <texture_loader.hpp>
+#include <texture_cache.hpp>
+
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace raytracing {
+    // The innermost TextureScope of this thread.
+    static thread_local TextureScope* current_scope = nullptr;
+
+    template<typename Map>
+    static void erase_expired(Map &map)
+    {
+        for(auto it = map.begin(); it != map.end();)
+            it = it->second.expired() ? map.erase(it) : std::next(it);
+    }
+
+    void TextureRegistry::prune()
+    {
+        erase_expired(by_path);
+        erase_expired(by_content);
+    }
+
+    TextureScope::TextureScope()
+        : outer(current_scope)
+    {
+        current_scope = this;
+    }
+
+    TextureScope::~TextureScope()
+    {
+        current_scope = outer;
+    }
+
+    TextureLoader::TextureLoader(int threads)
+        : max_threads(threads > 0 ? threads : static_cast<int>(std::thread::hardware_concurrency()))
+    {
+        if(max_threads < 1)
+            max_threads = 1;
+    }
+
+    TextureLoader::~TextureLoader()
+    {
+        wait();
+    }
+
+    // FNV-1a, to find images with the same contents under different paths.
+    static uint64_t content_hash(const std::vector<unsigned char> &bytes)
+    {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for(unsigned char c : bytes)
+            hash = (hash ^ c) * 0x100000001b3ull;
+        return hash;
+    }
+
+    static TextureDecode decode(ImagePyramid &pyramid, const std::string &path, const std::vector<unsigned char> &encoded)
+    {
+        auto start = std::chrono::steady_clock::now();
+        pyramid.load(encoded.data(), encoded.size(), path.c_str());
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return {path, pyramid.image_width(), pyramid.image_height(), seconds};
+    }
+
+    std::shared_ptr<ImageTexture> TextureLoader::load(const std::string &path, TextureFilter filter, TextureFormat format)
+    {
+        char resolved[PATH_MAX];
+        const std::pair<std::string, TextureFormat> path_key(realpath(path.c_str(), resolved) ? resolved : path, format);
+
+        // A scope's registry belongs to its thread and needs no lock.
+        TextureScope* scope = current_scope;
+        TextureRegistry &found = scope ? scope->registry : registry;
+        auto lock_registry = [&] { return scope ? std::unique_lock<std::mutex>() : std::unique_lock<std::mutex>(mutex); };
+        {
+            auto lock = lock_registry();
+            found.prune();
+            if(auto pyramid = found.by_path[path_key].lock())
+                return std::make_shared<ImageTexture>(pyramid, filter);
+        }
+
+        std::string tiled = is_tiled_texture(path) ? path : tiled_texture_path(path);
+        if(tiled == path && format != TextureFormat::SRGB8)
+            std::cerr << "WARNING: Tiled texture `" << path << "` is stored in 8 bits." << std::endl;
+        if(tiled == path || (format == TextureFormat::SRGB8 && is_tiled_texture(tiled))) {
+            if(auto tiles = texture_cache().open(tiled)) {
+                auto pyramid = std::make_shared<const ImagePyramid>(tiles);
+                auto lock = lock_registry();
+                found.by_path[path_key] = pyramid;
+                return std::make_shared<ImageTexture>(pyramid, filter);
+            }
+            if(tiled == path)
+                return std::make_shared<ImageTexture>();
+            std::cerr << "WARNING: Decoding `" << path << "` instead." << std::endl;
+        }
+
+        std::ifstream file(path, std::ios::binary);
+        std::vector<unsigned char> encoded((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if(!file.good() && !file.eof()) {
+            std::cerr << "ERROR: Could not load texture image file `" << path << "`." << std::endl;
+            return std::make_shared<ImageTexture>();
+        }
+        const std::pair<uint64_t, TextureFormat> content_key(content_hash(encoded), format);
+
+        auto lock = lock_registry();
+        auto pyramid = std::const_pointer_cast<ImagePyramid>(found.by_content[content_key].lock());
+        if(!pyramid && scope) {
+            pyramid = std::make_shared<ImagePyramid>(format);
+            found.by_content[content_key] = pyramid;
+            TextureDecode decoded = decode(*pyramid, path, encoded);
+            std::lock_guard<std::mutex> finished_lock(mutex);
+            finished.push_back(decoded);
+        }
+        else if(!pyramid) {
+            pyramid = std::make_shared<ImagePyramid>(format);
+            found.by_content[content_key] = pyramid;
+            queue.push_back({pyramid, path, std::move(encoded)});
+            // Workers leave once the queue is empty, so start one per job up to the limit.
+            if(active < max_threads) {
+                active++;
+                threads.emplace_back(&TextureLoader::work, this);
+            }
+        }
+        found.by_path[path_key] = pyramid;
+        return std::make_shared<ImageTexture>(pyramid, filter);
+    }
+
+    void TextureLoader::work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while(!queue.empty()) {
+            Job job = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+
+            TextureDecode decoded = decode(*job.pyramid, job.path, job.encoded);
+
+            lock.lock();
+            finished.push_back(decoded);
+        }
+        active--;
+        idle.notify_all();
+    }
+
+    std::vector<TextureDecode> TextureLoader::wait()
+    {
+        std::vector<std::thread> workers;
+        std::vector<TextureDecode> decodes;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            idle.wait(lock, [this] { return active == 0; });
+            workers.swap(threads);
+            decodes.swap(finished);
+        }
+        for(auto &worker : workers)
+            worker.join();
+        return decodes;
+    }
+
+    TextureLoader &texture_loader()
+    {
+        static TextureLoader loader;
+        return loader;
+    }
+
+    std::shared_ptr<ImageTexture> load_image_texture(const std::string &path, TextureFilter filter, TextureFormat format)
+    {
+        return texture_loader().load(path, filter, format);
+    }
+
+    void write_texture_decodes(std::ostream &out, const std::vector<TextureDecode> &decodes)
+    {
+        char line[64];
+        for(const auto &decode : decodes) {
+            std::snprintf(line, sizeof(line), "%dx%d in %.1f ms", decode.width, decode.height, 1000 * decode.seconds);
+            out << "Decoded `" << decode.path << "` (" << line << ")\n";
+        }
+    }
+}
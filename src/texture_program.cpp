@@ -0,0 +1,180 @@
+#include <texture_program.hpp>
+
+#include <algorithm>
+#include <numeric>
+
+namespace raytracing {
+    Color TextureProgram::value(real u, real v, const Point3 &p, const UVDerivatives &duv) const
+    {
+        const Instruction* instruction = &code.back();
+        while(instruction->op == Op::Checker)
+            instruction = &code[CheckerTexture::odd_cell(p) ? instruction->odd : instruction->even];
+        return leaf(*instruction, u, v, p, duv);
+    }
+
+    Color TextureProgram::leaf(const Instruction &instruction, real u, real v, const Point3 &p, const UVDerivatives &duv) const
+    {
+        switch(instruction.op) {
+            case Op::Constant:
+                return instruction.color;
+            case Op::Noise:
+                return static_cast<const NoiseTexture*>(instruction.texture)->NoiseTexture::value(u, v, p);
+            case Op::Image:
+                return instruction.pyramid->value(instruction.filter, u, v, duv);
+            default:
+                return instruction.texture->value(u, v, p, duv);
+        }
+    }
+
+    void TextureProgram::value(const TextureQuery* queries, size_t count, Color* colors) const
+    {
+        struct Range {
+            uint32_t instruction;
+            size_t begin, end;
+        };
+
+        // The points' indices, sorted in place by every checker into the ones that go on
+        // to its even and its odd side.
+        std::vector<uint32_t> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        std::vector<Range> pending = {{static_cast<uint32_t>(code.size() - 1), 0, count}};
+
+        while(!pending.empty()) {
+            Range range = pending.back();
+            pending.pop_back();
+            if(range.begin == range.end)
+                continue;
+
+            const Instruction &instruction = code[range.instruction];
+            const uint32_t* begin = order.data() + range.begin;
+            const uint32_t* end = order.data() + range.end;
+            switch(instruction.op) {
+                case Op::Checker: {
+                    auto middle = std::partition(order.begin() + range.begin, order.begin() + range.end, [&](uint32_t i) {
+                        return !CheckerTexture::odd_cell(queries[i].p);
+                    });
+                    size_t split = middle - order.begin();
+                    pending.push_back({instruction.even, range.begin, split});
+                    pending.push_back({instruction.odd, split, range.end});
+                    break;
+                }
+                case Op::Constant:
+                    for(const uint32_t* i = begin; i != end; i++)
+                        colors[*i] = instruction.color;
+                    break;
+                case Op::Image:
+                    for(const uint32_t* i = begin; i != end; i++) {
+                        const TextureQuery &q = queries[*i];
+                        colors[*i] = instruction.pyramid->value(instruction.filter, q.u, q.v, q.duv);
+                    }
+                    break;
+                default:
+                    for(const uint32_t* i = begin; i != end; i++) {
+                        const TextureQuery &q = queries[*i];
+                        colors[*i] = leaf(instruction, q.u, q.v, q.p, q.duv);
+                    }
+                    break;
+            }
+        }
+    }
+
+    std::shared_ptr<Texture> TextureCompiler::compile(const std::shared_ptr<Texture> &texture)
+    {
+        if(!texture)
+            return texture;
+        auto found = compiled.find(texture.get());
+        if(found != compiled.end())
+            return found->second;
+
+        auto program = std::make_shared<TextureProgram>();
+        emit(*program, texture, Side::Both);
+
+        std::shared_ptr<Texture> result = program;
+        if(program->code.size() == 1) {
+            const TextureProgram::Instruction &root = program->code[0];
+            if(root.op != TextureProgram::Op::Constant)
+                result = program->leaves[0];
+            else if(std::dynamic_pointer_cast<SolidColor>(texture))
+                result = texture;
+            else
+                result = std::make_shared<SolidColor>(root.color);
+            if(result != texture)
+                compile_stats.folded++;
+        }
+        else {
+            compile_stats.programs++;
+            compile_stats.instructions += static_cast<int>(program->code.size());
+        }
+        compiled[texture.get()] = result;
+        return result;
+    }
+
+    uint32_t TextureCompiler::emit(TextureProgram &program, const std::shared_ptr<Texture> &texture, Side side)
+    {
+        using Op = TextureProgram::Op;
+
+        compile_stats.nodes++;
+        TextureProgram::Instruction instruction = {};
+        if(auto checker = std::dynamic_pointer_cast<CheckerTexture>(texture)) {
+            // Every checker has the same cells, so below the even side of one only the even
+            // side of another is ever reached.
+            if(side == Side::Even)
+                return emit(program, checker->even(), side);
+            if(side == Side::Odd)
+                return emit(program, checker->odd(), side);
+
+            instruction.op = Op::Checker;
+            instruction.even = emit(program, checker->even(), Side::Even);
+            instruction.odd = emit(program, checker->odd(), Side::Odd);
+            if(instruction.even == instruction.odd)
+                return instruction.even;
+        }
+        else if(auto solid = std::dynamic_pointer_cast<SolidColor>(texture)) {
+            instruction.op = Op::Constant;
+            instruction.color = solid->color();
+        }
+        else if(auto noise = std::dynamic_pointer_cast<NoiseTexture>(texture)) {
+            instruction.op = Op::Noise;
+            instruction.texture = noise.get();
+        }
+        else if(auto image = std::dynamic_pointer_cast<ImageTexture>(texture)) {
+            instruction.op = Op::Image;
+            instruction.filter = image->filter;
+            instruction.pyramid = image->image().get();
+        }
+        else {
+            instruction.op = Op::Call;
+            instruction.texture = texture.get();
+        }
+        return add(program, instruction, texture);
+    }
+
+    uint32_t TextureCompiler::add(TextureProgram &program, const TextureProgram::Instruction &instruction, const std::shared_ptr<Texture> &owner)
+    {
+        using Op = TextureProgram::Op;
+
+        auto same = [&](const TextureProgram::Instruction &other) {
+            if(other.op != instruction.op)
+                return false;
+            switch(instruction.op) {
+                case Op::Constant:
+                    return other.color.x() == instruction.color.x() && other.color.y() == instruction.color.y()
+                        && other.color.z() == instruction.color.z();
+                case Op::Checker:
+                    return other.even == instruction.even && other.odd == instruction.odd;
+                case Op::Image:
+                    return other.pyramid == instruction.pyramid && other.filter == instruction.filter;
+                default:
+                    return other.texture == instruction.texture;
+            }
+        };
+        auto existing = std::find_if(program.code.begin(), program.code.end(), same);
+        if(existing != program.code.end())
+            return static_cast<uint32_t>(existing - program.code.begin());
+
+        program.code.push_back(instruction);
+        if(instruction.op != Op::Constant && instruction.op != Op::Checker)
+            program.leaves.push_back(owner);
+        return static_cast<uint32_t>(program.code.size() - 1);
+    }
+}
@@ -0,0 +1,123 @@
+#include <tiles.hpp>
+
+#include <algorithm>
+
+namespace raytracing {
+    bool parse_tile_order(const std::string &name, TileOrder &order)
+    {
+        if(name == "scanline")
+            order = TileOrder::Scanline;
+        else if(name == "morton")
+            order = TileOrder::Morton;
+        else if(name == "hilbert")
+            order = TileOrder::Hilbert;
+        else if(name == "cost")
+            order = TileOrder::Cost;
+        else
+            return false;
+        return true;
+    }
+
+    std::vector<Tile> make_tiles(int width, int height, int size)
+    {
+        std::vector<Tile> tiles;
+        for(int y1 = height; y1 > 0; y1 -= size)
+            for(int x0 = 0; x0 < width; x0 += size)
+                tiles.push_back(Tile{x0, std::max(0, y1 - size), std::min(width, x0 + size), y1});
+        return tiles;
+    }
+
+    static uint64_t morton_index(uint32_t x, uint32_t y)
+    {
+        auto spread = [](uint64_t v) {
+            v = (v | (v << 16)) & 0x0000ffff0000ffffull;
+            v = (v | (v << 8)) & 0x00ff00ff00ff00ffull;
+            v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0full;
+            v = (v | (v << 2)) & 0x3333333333333333ull;
+            v = (v | (v << 1)) & 0x5555555555555555ull;
+            return v;
+        };
+        return spread(x) | (spread(y) << 1);
+    }
+
+    static uint64_t hilbert_index(uint32_t n, uint32_t x, uint32_t y)
+    {
+        // Distance along the Hilbert curve filling an n x n grid (n a power of two).
+        uint64_t d = 0;
+        for(uint32_t s = n / 2; s > 0; s /= 2) {
+            uint32_t rx = (x & s) > 0;
+            uint32_t ry = (y & s) > 0;
+            d += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+            if(ry == 0) {
+                if(rx == 1) {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return d;
+    }
+
+    std::vector<uint32_t> spatial_tile_order(size_t count, int columns, TileOrder order)
+    {
+        std::vector<uint32_t> indices(count);
+        for(size_t i = 0; i < count; i++)
+            indices[i] = static_cast<uint32_t>(i);
+        if(order != TileOrder::Morton && order != TileOrder::Hilbert)
+            return indices;
+
+        // Curves are laid over the smallest power-of-two grid covering all tiles;
+        // the cells outside the image are simply skipped.
+        uint32_t rows = static_cast<uint32_t>((count + columns - 1) / columns);
+        uint32_t n = 1;
+        while(n < static_cast<uint32_t>(columns) || n < rows)
+            n *= 2;
+
+        std::vector<uint64_t> keys(count);
+        for(size_t i = 0; i < count; i++) {
+            uint32_t x = static_cast<uint32_t>(i % columns), y = static_cast<uint32_t>(i / columns);
+            keys[i] = order == TileOrder::Morton ? morton_index(x, y) : hilbert_index(n, x, y);
+        }
+        std::sort(indices.begin(), indices.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+        return indices;
+    }
+
+    TileScheduler::TileScheduler(const std::vector<uint32_t> &tasks, int workers, bool contiguous)
+    {
+        for(int w = 0; w < workers; w++)
+            queues.push_back(std::make_unique<Queue>());
+
+        for(size_t i = 0; i < tasks.size(); i++) {
+            size_t owner = contiguous ? i * workers / tasks.size() : i % workers;
+            queues[owner]->tasks.push_back(tasks[i]);
+        }
+    }
+
+    bool TileScheduler::next(int worker, uint32_t &task)
+    {
+        {
+            Queue &own = *queues[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if(!own.tasks.empty()) {
+                task = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+
+        // Steal from the back of the other queues, starting with the next worker's.
+        const int workers = static_cast<int>(queues.size());
+        for(int i = 1; i < workers; i++) {
+            Queue &victim = *queues[(worker + i) % workers];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if(!victim.tasks.empty()) {
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+                queues[worker]->steals++;
+                return true;
+            }
+        }
+        return false;
+    }
+}
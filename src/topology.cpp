@@ -0,0 +1,101 @@
+#include <topology.hpp>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace raytracing {
+    // Parses a kernel CPU list such as "0-3,8-11".
+    static std::vector<int> parse_cpu_list(const std::string &text)
+    {
+        std::vector<int> cpus;
+        std::stringstream ranges(text);
+        std::string range;
+        while(std::getline(ranges, range, ',')) {
+            int first, last;
+            char dash;
+            std::stringstream in(range);
+            if(!(in >> first))
+                continue;
+            last = (in >> dash >> last) ? last : first;
+            for(int cpu = first; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    static CpuTopology read_topology()
+    {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+            for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                CPU_SET(cpu, &allowed);
+
+        CpuTopology topology;
+        for(int node = 0;; node++) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if(!file)
+                break;
+            std::string list;
+            std::getline(file, list);
+
+            std::vector<int> cpus;
+            for(int cpu : parse_cpu_list(list))
+                if(cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                    cpus.push_back(cpu);
+            if(!cpus.empty())
+                topology.nodes.push_back(cpus);
+        }
+
+        if(topology.nodes.empty()) {
+            std::vector<int> cpus;
+            for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                if(CPU_ISSET(cpu, &allowed))
+                    cpus.push_back(cpu);
+            topology.nodes.push_back(cpus);
+        }
+        return topology;
+    }
+
+    const CpuTopology &cpu_topology()
+    {
+        static const CpuTopology topology = read_topology();
+        return topology;
+    }
+
+    int CpuTopology::cpu_count() const
+    {
+        int count = 0;
+        for(const auto &node : nodes)
+            count += static_cast<int>(node.size());
+        return count;
+    }
+
+    int CpuTopology::node_of_thread(int thread) const
+    {
+        return nodes.empty() ? -1 : thread % static_cast<int>(nodes.size());
+    }
+
+    int CpuTopology::cpu_of_thread(int thread) const
+    {
+        int node = node_of_thread(thread);
+        if(node < 0 || nodes[node].empty())
+            return -1;
+        const auto &cpus = nodes[node];
+        return cpus[(thread / nodes.size()) % cpus.size()];
+    }
+
+    bool pin_current_thread(int cpu)
+    {
+        if(cpu < 0 || cpu >= CPU_SETSIZE)
+            return false;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+}
@@ -0,0 +1,137 @@
+#include <transform.hpp>
+#include <bvh.hpp>
+#include <primitive.hpp>
+#include <sphere.hpp>
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace raytracing {
+    // Levels of BVHs below a transform that are bounded node by node.
+    static const int bounds_depth = 6;
+
+    std::shared_ptr<Hittable> transform_child(const std::shared_ptr<Hittable> &object, Affine &to_world)
+    {
+        if(auto translate = std::dynamic_pointer_cast<Translate>(object)) {
+            to_world = Affine::translation(translate->offset);
+            return translate->ptr;
+        }
+        if(auto rotate = std::dynamic_pointer_cast<RotateY>(object)) {
+            to_world = Affine::rotation_y(rotate->sin_theta, rotate->cos_theta);
+            return rotate->ptr;
+        }
+        if(auto transform = std::dynamic_pointer_cast<Transform>(object)) {
+            to_world = transform->to_world;
+            return transform->ptr;
+        }
+        return nullptr;
+    }
+
+    static bool transformed_bounds(const Hittable &object, const Affine &to_world, double time0, double time1, int depth,
+                                   AABB &output_box)
+    {
+        if(auto sphere = dynamic_cast<const Sphere*>(&object)) {
+            output_box = to_world.bounds(sphere->center, sphere->radius);
+            return true;
+        }
+        if(auto translate = dynamic_cast<const Translate*>(&object))
+            return transformed_bounds(*translate->ptr, to_world * Affine::translation(translate->offset), time0, time1, depth, output_box);
+        if(auto rotate = dynamic_cast<const RotateY*>(&object))
+            return transformed_bounds(*rotate->ptr, to_world * Affine::rotation_y(rotate->sin_theta, rotate->cos_theta), time0, time1, depth,
+                                      output_box);
+        if(auto transform = dynamic_cast<const Transform*>(&object))
+            return transformed_bounds(*transform->ptr, to_world * transform->to_world, time0, time1, depth, output_box);
+
+        if(depth < bounds_depth) {
+            if(auto node = dynamic_cast<const BVHNode*>(&object)) {
+                AABB left, right;
+                if(!transformed_bounds(*node->left, to_world, time0, time1, depth + 1, left)
+                   || !transformed_bounds(*node->right, to_world, time0, time1, depth + 1, right))
+                    return false;
+                output_box = surrounding_box(left, right);
+                return true;
+            }
+            if(auto array = dynamic_cast<const PrimitiveArray*>(&object)) {
+                if(array->node_count() == 0)
+                    return false;
+
+                // Leaves above the depth limit by their primitives, anything below by the
+                // box of the node at the limit.
+                struct Entry { uint32_t node; int depth; };
+                std::vector<Entry> stack = {{0, depth}};
+                bool first = true;
+                while(!stack.empty()) {
+                    Entry entry = stack.back();
+                    stack.pop_back();
+                    const PrimitiveBVHNode &node = array->nodes()[entry.node];
+                    AABB box;
+                    if(node.count == 0 && entry.depth < bounds_depth) {
+                        stack.push_back({node.offset, entry.depth + 1});
+                        stack.push_back({entry.node + 1, entry.depth + 1});
+                        continue;
+                    }
+                    if(node.count == 0)
+                        box = to_world.bounds(node.box);
+                    else
+                        for(uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                            const Primitive &prim = array->primitives()[i];
+                            AABB prim_box = prim.type == PrimitiveType::Sphere
+                                          ? to_world.bounds(Point3(prim.data[0], prim.data[1], prim.data[2]), prim.data[3])
+                                          : to_world.bounds(prim.bounds(time0, time1));
+                            box = i == node.offset ? prim_box : surrounding_box(box, prim_box);
+                        }
+                    output_box = first ? box : surrounding_box(output_box, box);
+                    first = false;
+                }
+                return true;
+            }
+            if(auto list = dynamic_cast<const HittableList*>(&object)) {
+                if(list->objects.empty())
+                    return false;
+                for(size_t i = 0; i < list->objects.size(); i++) {
+                    AABB box;
+                    if(!transformed_bounds(*list->objects[i], to_world, time0, time1, depth + 1, box))
+                        return false;
+                    output_box = i == 0 ? box : surrounding_box(output_box, box);
+                }
+                return true;
+            }
+        }
+
+        AABB box;
+        if(!object.bounding_box(time0, time1, box))
+            return false;
+        output_box = to_world.bounds(box);
+        return true;
+    }
+
+    bool transformed_bounds(const Hittable &object, const Affine &to_world, double time0, double time1, AABB &output_box)
+    {
+        return transformed_bounds(object, to_world, time0, time1, 0, output_box);
+    }
+
+    Transform::Transform(std::shared_ptr<Hittable> p, const Affine &m)
+        : ptr(p), to_world(m), to_object(Affine::identity())
+    {
+        // Callers check the matrix (collapse_transforms, the binary scene loader).
+        bool invertible = to_world.inverse(to_object);
+        assert(invertible);
+        (void)invertible;
+        hasbox = transformed_bounds(*ptr, to_world, 0, 1, bbox);
+    }
+
+    bool Transform::hit(const Ray &r, real t_min, real t_max, HitRecord &rec) const
+    {
+        if(!ptr->hit(to_object.ray(r), t_min, t_max, rec))
+            return false;
+
+        hit_to_world(to_world, to_object, rec);
+        return true;
+    }
+
+    bool Transform::interval(const Ray &r, real &t_enter, real &t_exit) const
+    {
+        return ptr->interval(Ray(to_object.point(r.origin()), to_object.vector(r.direction()), r.time()), t_enter, t_exit);
+    }
+}